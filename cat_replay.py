@@ -0,0 +1,315 @@
+"""
+Replay of CAT captures taken by the client (CAT_CAPTURE, cat.cap on the SD card).
+
+A capture holds every chunk of bytes the band decoder read from a radio, stamped
+with the UART event time in microseconds, the polls the client sent and markers
+where the UART FIFO overflowed. See main/cat_capture.h for the record layout.
+
+Without --port the capture is only decoded: every frame is listed with its parse
+result, the band it resolves to and the antenna --map gives for it. Frames and
+bands come from the client's own parser and band plan sources, built for the host
+as cat_decode in host_test (see --decoder):
+    cmake -S host_test -B build_host && cmake --build build_host
+
+With --port the received bytes of --radio are played into the CAT UART
+of a client, with the captured timing scaled by --speed or as fast as the line
+allows with --speed 0. Idle gaps are cut to --max-gap seconds. The stand-in
+server of virtual_station.py takes the antenna commands, so the capture runs
+through the real decoder and control path. At the end every band change is
+listed with the command it produced and its latency, followed by the report of
+virtual_station.py. With --csv the per frame results are also written to a file.
+
+The client must have automode enabled and a band map in NVS matching --map.
+
+Example:
+    python3 cat_replay.py cat.cap
+    python3 cat_replay.py cat.cap --port /dev/ttyUSB1 --speed 1
+    python3 cat_replay.py cat.cap --port /dev/ttyUSB1 --speed 0 --csv replay.csv
+"""
+
+import argparse
+import asyncio
+import csv
+import os
+import struct
+import subprocess
+import threading
+import time
+
+import virtual_station
+
+MAGIC = b'CATCAP1\n'
+HEADER = struct.Struct('<qBBH')
+
+CAPTURE_RX = 0
+CAPTURE_TX = 1
+CAPTURE_OVERFLOW = 2
+CAPTURE_INFO = 3
+
+DEFAULT_DECODER = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'build_host', 'cat_decode')
+
+
+class Record:
+    def __init__(self, time_us, radio, kind, data):
+        self.time_us = time_us
+        self.radio = radio
+        self.kind = kind
+        self.data = data
+
+
+def read_capture(path):
+    """ All records of a capture file. A capture spans reboots, the times start over at each INFO record. """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if not data.startswith(MAGIC):
+        raise ValueError('{} is not a CAT capture'.format(path))
+    records = []
+    offset = len(MAGIC)
+    while offset + HEADER.size <= len(data):
+        time_us, radio, kind, length = HEADER.unpack_from(data, offset)
+        offset += HEADER.size
+        if offset + length > len(data):
+            print('Capture ends in the middle of a record')
+            break
+        records.append(Record(time_us, radio, kind, data[offset:offset + length]))
+        offset += length
+    return records
+
+
+class Frame:
+    """ One frame and what the client's parser makes of it """
+
+    def __init__(self, data, result, frequency=None, band=None, tx=None):
+        self.data = data
+        self.result = result            # 'state', 'rejected' or 'discarded'
+        self.frequency = frequency
+        self.band = band
+        self.tx = tx
+
+    def text(self):
+        try:
+            text = self.data.decode('ascii')
+            if text.isprintable():
+                return text
+        except UnicodeDecodeError:
+            pass
+        return self.data.hex(' ')
+
+
+def decode_frames(records, radio, args):
+    """
+    Frames of one radio as the client parses them, by index into records. The bytes
+    run through cat_decode, built from the client's parser sources in host_test.
+    """
+    commands = []
+    indexes = []
+    for index, record in enumerate(records):
+        if record.radio != radio:
+            continue
+        if record.kind == CAPTURE_INFO:
+            name = record.data.decode('ascii', errors='replace').partition(' ')[0]
+            commands.append('P {} {}'.format(name, args.civ_address))
+        elif record.kind == CAPTURE_OVERFLOW:
+            commands.append('O')
+        elif record.kind == CAPTURE_RX:
+            commands.append('R ' + record.data.hex())
+        else:
+            continue
+        indexes.append(index)
+    try:
+        result = subprocess.run([args.decoder], input='\n'.join(commands) + '\n', capture_output=True, text=True, check=True)
+    except FileNotFoundError:
+        raise SystemExit('{} not found, build it with: cmake -S host_test -B build_host && cmake --build build_host'.format(args.decoder))
+    except subprocess.CalledProcessError as e:
+        raise SystemExit('{} failed: {}'.format(args.decoder, e.stderr.strip()))
+
+    frames = {}
+    for line in result.stdout.splitlines():
+        command, state, frequency, band, tx, _mode, _vfo, _split, data = line.split(' ')
+        frequency = int(frequency)
+        tx = int(tx)
+        frame = Frame(bytes.fromhex(data), state, frequency or None, band if frequency else None, None if tx < 0 else tx != 0)
+        frames.setdefault(indexes[int(command)], []).append(frame)
+    return frames
+
+
+def radio_protocols(records):
+    protocols = {}
+    for record in records:
+        if record.kind == CAPTURE_INFO:
+            name, _, baud = record.data.decode('ascii', errors='replace').partition(' ')
+            protocols[record.radio] = (name, int(baud) if baud.isdigit() else 0)
+    return protocols
+
+
+def decode(records, args, band_map):
+    """ Print every frame of the selected radio with its parse result """
+    frames = decode_frames(records, args.radio - 1, args)
+    counts = {'state': 0, 'rejected': 0, 'discarded': 0}
+    polls = 0
+    overflows = 0
+    band = None
+    changes = 0
+    for index, record in enumerate(records):
+        if record.radio != args.radio - 1:
+            continue
+        seconds = record.time_us / 1e6
+        if record.kind == CAPTURE_INFO:
+            print('{:12.6f} radio {} {}'.format(seconds, args.radio, record.data.decode('ascii', errors='replace')))
+        elif record.kind == CAPTURE_TX:
+            polls += 1
+        elif record.kind == CAPTURE_OVERFLOW:
+            overflows += 1
+            print('{:12.6f} FIFO overflow'.format(seconds))
+        else:
+            for frame in frames.get(index, []):
+                counts[frame.result] += 1
+                line = '{:12.6f} {:<40} {}'.format(seconds, frame.text(), frame.result)
+                if frame.frequency:
+                    line += ' {} Hz {}'.format(frame.frequency, frame.band)
+                if frame.tx is not None:
+                    line += ' tx' if frame.tx else ' rx'
+                changed = frame.band is not None and frame.band != band
+                if changed:
+                    band = frame.band
+                    changes += 1
+                    line += ' -> ANT{}'.format(band_map.get(band, '?'))
+                if args.verbose or changed or frame.result != 'state':
+                    print(line)
+    print('')
+    print('Frames              : {} state, {} rejected, {} discarded'.format(counts['state'], counts['rejected'], counts['discarded']))
+    print('Band changes        : {}'.format(changes))
+    print('Polls sent/overflows: {}/{}'.format(polls, overflows))
+
+
+class Replayer(threading.Thread):
+    """ Plays the received bytes of one radio into the client, used by the stand-in server like VirtualRadio """
+
+    def __init__(self, args, stats, records):
+        super().__init__(daemon=True)
+        self.args = args
+        self.stats = stats
+        self.records = records
+        self.frames = decode_frames(records, args.radio - 1, args)
+        self.link = virtual_station.SerialLink(args)
+        self.running = True
+        self.rows = []          # (time written, capture time, frame, index of the band change it caused or None)
+        self.polls = 0
+
+    def run(self):
+        """ The client keeps polling, the polls are counted and not answered """
+        while self.running:
+            data = self.link.read()
+            if not data:
+                time.sleep(0.001)
+                continue
+            self.polls += data.count(b';') + data.count(b'\xfd')
+
+    def sweep(self):
+        band = None
+        start = time.monotonic()
+        previous_us = None
+        for index, record in enumerate(self.records):
+            if record.radio != self.args.radio - 1:
+                continue
+            if record.kind == CAPTURE_INFO:
+                previous_us = None
+                continue
+            if record.kind != CAPTURE_RX:
+                continue
+            if self.args.speed > 0 and previous_us is not None:
+                gap = min(max(record.time_us - previous_us, 0) / 1e6, self.args.max_gap) / self.args.speed
+                start += gap
+                delay = start - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+            else:
+                start = time.monotonic()
+            previous_us = record.time_us
+            self.link.write(record.data)
+            self.stats.bytes_sent += len(record.data)
+            written = time.monotonic()
+            for frame in self.frames.get(index, []):
+                self.stats.frames_sent += 1
+                change = None
+                if frame.band and frame.band != 'UNKNOWN' and frame.band != band:
+                    band = frame.band
+                    self.stats.band_change(band)
+                    change = len(self.stats.changes) - 1
+                self.rows.append((written, record.time_us, frame, change))
+        self.stats.final_state(band)
+        time.sleep(self.args.dwell)
+        self.stats.close_final_state()
+
+    def report(self):
+        """ Every band change with the command it produced """
+        print('')
+        print('Poll frames from client: {} (not answered)'.format(self.polls))
+        for index, (stamp, band) in enumerate(self.stats.changes):
+            expected, latency_ms, transport = self.command_latency(index)
+            result = '{:.1f} ms over {}'.format(latency_ms, transport) if latency_ms is not None else 'no command'
+            print('{:10.3f} s {:<5} ANT{} {}'.format(stamp - self.stats.start, band, expected, result))
+
+    def command_latency(self, change):
+        """ Antenna expected for a band change and the ms until the client asked for it, None if it never did """
+        changes = self.stats.changes
+        stamp, band = changes[change]
+        end = changes[change + 1][0] if change + 1 < len(changes) else float('inf')
+        expected = self.stats.band_map.get(band)
+        received, transport = self.stats.first_command_between(expected, stamp, end)
+        return expected, (received - stamp) * 1000.0 if received else None, transport
+
+    def write_csv(self, path):
+        with open(path, 'w', newline='') as f:
+            writer = csv.writer(f)
+            writer.writerow(['replay_s', 'capture_s', 'frame', 'result', 'frequency', 'band', 'tx', 'antenna', 'command_ms'])
+            for written, time_us, frame, change in self.rows:
+                antenna, latency = '', ''
+                if change is not None:
+                    antenna, latency_ms, _ = self.command_latency(change)
+                    latency = '{:.1f}'.format(latency_ms) if latency_ms is not None else ''
+                writer.writerow(['{:.6f}'.format(written - self.stats.start), '{:.6f}'.format(time_us / 1e6),
+                                 frame.text(), frame.result, frame.frequency or '', frame.band or '',
+                                 '' if frame.tx is None else int(frame.tx), antenna, latency])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help='cat.cap from the SD card')
+    parser.add_argument('--port', help='serial port connected to the client CAT UART')
+    parser.add_argument('--baudrate', type=int, default=0, help='defaults to the baud rate in the capture')
+    virtual_station.add_server_arguments(parser)
+    parser.add_argument('--radio', type=int, default=1, help='radio of the capture to replay, from 1')
+    parser.add_argument('--civ-address', type=int, default=0, help='CI-V address of an icom radio, 0 for the default 0x94')
+    parser.add_argument('--decoder', default=DEFAULT_DECODER, help='cat_decode from the host_test build')
+    parser.add_argument('--speed', type=float, default=1.0, help='1 for the captured timing, 0 for as fast as possible')
+    parser.add_argument('--max-gap', type=float, default=2.0, help='longest idle gap replayed in seconds')
+    parser.add_argument('--dwell', type=float, default=2.0, help='seconds to wait for commands after the last frame')
+    parser.add_argument('--csv', help='write the per frame results to this file')
+    parser.add_argument('--verbose', action='store_true', help='list every frame, not only changes and errors')
+    args = parser.parse_args()
+
+    records = read_capture(args.capture)
+    band_map = virtual_station.parse_map(args.map)
+    if not args.port:
+        decode(records, args, band_map)
+        return
+
+    args.pty = False
+    if not args.baudrate:
+        args.baudrate = radio_protocols(records).get(args.radio - 1, ('kenwood', 57600))[1] or 57600
+    stats = virtual_station.Stats(band_map)
+    replayer = Replayer(args, stats, records)
+    try:
+        asyncio.run(virtual_station.serve(args, stats, replayer))
+    except KeyboardInterrupt:
+        pass
+    replayer.running = False
+    replayer.report()
+    stats.report()
+    if args.csv:
+        replayer.write_csv(args.csv)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,54 @@
+/*
+ * Parser throughput per backend: the sample frames of each backend are repeated
+ * into a buffer and fed byte by byte, as the band decoder does.
+ *   cat_benchmark [megabytes per backend, default 16]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cat_samples.h"
+
+#define BUFFER_SIZE (1024 * 1024)
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const int megabytes = argc > 1 ? atoi(argv[1]) : 16;
+    static uint8_t buffer[BUFFER_SIZE];
+
+    for(size_t b = 0; b < BACKEND_COUNT; b++) {
+        const cat_backend_samples_t *backend = &backend_samples[b];
+        size_t len = 0;
+        for(size_t i = 0; len + CAT_FRAME_MAX < BUFFER_SIZE; i++) {
+            const cat_sample_t *sample = &backend->samples[i % backend->count];
+            memcpy(buffer + len, sample->bytes, sample->len);
+            len += sample->len;
+        }
+
+        cat_parser_t parser;
+        cat_parser_init(&parser, backend->protocol, backend->address);
+        uint64_t frames = 0;
+        uint32_t checksum = 0;
+        const double start = now_s();
+        for(int round = 0; round < megabytes; round++) {
+            for(size_t i = 0; i < len; i++) {
+                cat_event_t event;
+                if(cat_parser_feed(&parser, buffer[i], &event)) {
+                    frames++;
+                    checksum += event.frequency;
+                }
+            }
+        }
+        const double elapsed = now_s() - start;
+        printf("%-9s %8.1f MB/s %10.0f frames/s (checksum %08x)\n", backend->protocol->name,
+               (double)len * megabytes / elapsed / 1e6, frames / elapsed, (unsigned)checksum);
+    }
+    return 0;
+}
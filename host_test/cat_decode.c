@@ -0,0 +1,78 @@
+/*
+ * Runs captured CAT bytes through the client's parsers for cat_replay.py.
+ * Reads one command per line on stdin:
+ *   P <protocol> <CI-V address>   start a new link, as at an INFO record
+ *   O                             bytes were lost, resync like the band decoder
+ *   R <hex bytes>                 bytes received from the radio
+ * and prints one line per frame a terminator completed:
+ *   <command nr> <result> <frequency> <band> <tx> <mode> <vfo> <split> <frame hex>
+ * The result is state (valid frame), rejected (no layout matched or a field was
+ * malformed) or discarded (dropped while resyncing). Commands count from 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cat_protocol.h"
+#include "band_plan.h"
+
+#define MAX_LINE 65536
+
+static void print_frame(unsigned long command, const char *result, const cat_event_t *event, const uint8_t *frame, size_t len)
+{
+    printf("%lu %s %u %s %d %d %d %d ", command, result, event->frequency,
+           event->frequency ? amateur_band_str(hz_to_amateur_band(event->frequency)) : "-",
+           event->tx, event->mode, event->vfo, event->split);
+    for(size_t i = 0; i < len; i++) {
+        printf("%02x", frame[i]);
+    }
+    printf("\n");
+}
+
+static void feed_hex(cat_parser_t *parser, unsigned long command, const char *hex)
+{
+    unsigned int byte;
+    while(sscanf(hex, "%2x", &byte) == 1) {
+        hex += 2;
+        // The frame buffer is reset by the terminator, keep what it held for the listing
+        uint8_t frame[CAT_FRAME_MAX];
+        const size_t len = parser->len;
+        const bool discarding = parser->discarding;
+        memcpy(frame, parser->frame, len);
+        frame[len] = (uint8_t)byte;
+
+        cat_event_t event = { 0, -1, CAT_MODE_UNKNOWN, -1, -1 };
+        if(cat_parser_feed(parser, (uint8_t)byte, &event)) {
+            print_frame(command, "state", &event, frame, len + 1);
+        } else if(byte == parser->protocol->terminator && (discarding || len > 0)) {
+            print_frame(command, discarding ? "discarded" : "rejected", &event, frame, len + 1);
+        }
+    }
+}
+
+int main()
+{
+    static char line[MAX_LINE];
+    cat_parser_t parser;
+    cat_parser_init(&parser, &cat_protocol_kenwood, 0);
+
+    for(unsigned long command = 0; fgets(line, sizeof(line), stdin) != NULL; command++) {
+        char name[16];
+        unsigned int address = 0;
+        if(line[0] == 'P' && sscanf(line, "P %15s %u", name, &address) >= 1) {
+            const cat_protocol_t *protocol = cat_protocol_find(name);
+            if(protocol == NULL) {
+                fprintf(stderr, "Unknown protocol %s, using kenwood\n", name);
+                protocol = &cat_protocol_kenwood;
+            }
+            cat_parser_init(&parser, protocol, (uint8_t)address);
+        } else if(line[0] == 'O') {
+            cat_parser_resync(&parser);
+        } else if(line[0] == 'R' && line[1] == ' ') {
+            feed_hex(&parser, command, line + 2);
+        } else if(line[0] != '\n') {
+            fprintf(stderr, "Line %lu not understood\n", command + 1);
+            return 1;
+        }
+    }
+    return 0;
+}
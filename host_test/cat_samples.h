@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cat_protocol.h"
+
+/**
+ * A frame as a radio sends it, terminator included, and the event it decodes to
+ */
+typedef struct {
+    const uint8_t *bytes;
+    size_t len;
+    cat_event_t event;
+} cat_sample_t;
+
+typedef struct {
+    const cat_protocol_t *protocol;
+    uint8_t address;
+    const cat_sample_t *samples;
+    size_t count;
+} cat_backend_samples_t;
+
+#define TEXT_SAMPLE(text, frequency, tx, mode, vfo, split) \
+    { (const uint8_t *)(text), sizeof(text) - 1, { frequency, tx, mode, vfo, split } }
+
+static const cat_sample_t kenwood_samples[] = {
+    TEXT_SAMPLE("IF00014175000     0000000000030000000;", 14175000, 0, CAT_MODE_CW, 0, 0),
+    TEXT_SAMPLE("IF00007050000     0000000000112010000;", 7050000, 1, CAT_MODE_LSB, 2, 1),
+    TEXT_SAMPLE("FA00028500000;", 28500000, -1, CAT_MODE_UNKNOWN, -1, -1),
+    TEXT_SAMPLE("TX0;", 0, 1, CAT_MODE_UNKNOWN, -1, -1),
+    TEXT_SAMPLE("RX;", 0, 0, CAT_MODE_UNKNOWN, -1, -1),
+};
+
+static const cat_sample_t elecraft_samples[] = {
+    TEXT_SAMPLE("IF00014074000     0000000000060000000;", 14074000, 0, CAT_MODE_DATA, 0, 0),
+    TEXT_SAMPLE("FA00003550000;", 3550000, -1, CAT_MODE_UNKNOWN, -1, -1),
+};
+
+static const cat_sample_t yaesu_samples[] = {
+    TEXT_SAMPLE("IF001014074000+000000C00000;", 14074000, -1, CAT_MODE_DATA, 0, -1),
+    TEXT_SAMPLE("IF002007030000+000000300000;", 7030000, -1, CAT_MODE_CW, 0, -1),
+    TEXT_SAMPLE("FA021200000;", 21200000, -1, CAT_MODE_UNKNOWN, -1, -1),
+    TEXT_SAMPLE("TX1;", 0, 1, CAT_MODE_UNKNOWN, -1, -1),
+};
+
+static const cat_sample_t flex_samples[] = {
+    TEXT_SAMPLE("ZZFA00018100000;", 18100000, -1, CAT_MODE_UNKNOWN, -1, -1),
+    TEXT_SAMPLE("ZZTX1;", 0, 1, CAT_MODE_UNKNOWN, -1, -1),
+    TEXT_SAMPLE("IF00050150000     0000000000020000000;", 50150000, 0, CAT_MODE_USB, 0, 0),
+};
+
+static const uint8_t icom_frequency[] = { 0xFE, 0xFE, 0xE0, 0x94, 0x03, 0x00, 0x40, 0x07, 0x14, 0x00, 0xFD };
+static const uint8_t icom_transceive[] = { 0xFE, 0xFE, 0x00, 0x94, 0x00, 0x00, 0x50, 0x10, 0x21, 0x00, 0xFD };
+static const uint8_t icom_mode[] = { 0xFE, 0xFE, 0xE0, 0x94, 0x04, 0x03, 0x01, 0xFD };
+static const uint8_t icom_tx[] = { 0xFE, 0xFE, 0xE0, 0x94, 0x1C, 0x00, 0x01, 0xFD };
+
+static const cat_sample_t icom_samples[] = {
+    { icom_frequency, sizeof(icom_frequency), { 14074000, -1, CAT_MODE_UNKNOWN, -1, -1 } },
+    { icom_transceive, sizeof(icom_transceive), { 21105000, -1, CAT_MODE_UNKNOWN, -1, -1 } },
+    { icom_mode, sizeof(icom_mode), { 0, -1, CAT_MODE_CW, -1, -1 } },
+    { icom_tx, sizeof(icom_tx), { 0, 1, CAT_MODE_UNKNOWN, -1, -1 } },
+};
+
+#define BACKEND_SAMPLES(protocol, address, samples) \
+    { &protocol, address, samples, sizeof(samples) / sizeof(samples[0]) }
+
+static const cat_backend_samples_t backend_samples[] = {
+    BACKEND_SAMPLES(cat_protocol_kenwood, 0, kenwood_samples),
+    BACKEND_SAMPLES(cat_protocol_elecraft, 0, elecraft_samples),
+    BACKEND_SAMPLES(cat_protocol_yaesu, 0, yaesu_samples),
+    BACKEND_SAMPLES(cat_protocol_flex, 0, flex_samples),
+    BACKEND_SAMPLES(cat_protocol_icom, 0x94, icom_samples),
+};
+
+#define BACKEND_COUNT (sizeof(backend_samples) / sizeof(backend_samples[0]))
@@ -0,0 +1,12 @@
+#pragma once
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+
+static inline const char* esp_err_to_name(esp_err_t err)
+{
+    return err == ESP_OK ? "ESP_OK" : "error";
+}
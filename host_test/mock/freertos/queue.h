@@ -0,0 +1,5 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct mock_queue *QueueHandle_t;
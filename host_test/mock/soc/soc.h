@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Register writes go to the test, which keeps the output state */
+void mock_reg_write(uint32_t reg, uint32_t value);
+
+#define REG_WRITE(reg, value) mock_reg_write((reg), (value))
@@ -0,0 +1,4 @@
+#pragma once
+
+/* ESP32 */
+#define SOC_GPIO_PIN_COUNT 40
@@ -0,0 +1,123 @@
+/*
+ * GPIO backend of antenna_output.c against mocked output registers. Every
+ * register write is applied to a model of the output latches, and after each one
+ * at most one antenna may be driven, also when the old and new antenna are in
+ * different register banks.
+ */
+#include <stdio.h>
+#include "antenna_output.h"
+#include "soc/gpio_reg.h"
+#include "driver/gpio.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)) { \
+        failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while(0)
+
+/* GPIO 2 belongs to another task and must keep its level */
+#define FOREIGN_GPIO 2
+
+static const int16_t leds[] = { 27, 4, 32, 33, -1, 5, 25 };
+#define ANTENNA_COUNT (sizeof(leds) / sizeof(leds[0]))
+
+static uint64_t outputs;
+static uint64_t configured;
+static int writes;
+static int max_driven;
+
+static int driven_antennas()
+{
+    int driven = 0;
+    for(size_t i = 0; i < ANTENNA_COUNT; i++) {
+        if(leds[i] >= 0 && (outputs & (1ULL << leds[i]))) {
+            driven++;
+        }
+    }
+    return driven;
+}
+
+void mock_reg_write(uint32_t reg, uint32_t value)
+{
+    switch(reg) {
+    case GPIO_OUT_W1TS_REG:
+        outputs |= value;
+        break;
+    case GPIO_OUT_W1TC_REG:
+        outputs &= ~(uint64_t)value;
+        break;
+    case GPIO_OUT1_W1TS_REG:
+        outputs |= (uint64_t)value << 32;
+        break;
+    case GPIO_OUT1_W1TC_REG:
+        outputs &= ~((uint64_t)value << 32);
+        break;
+    default:
+        CHECK(false, "write to unknown register 0x%08x", (unsigned)reg);
+    }
+    writes++;
+    if(driven_antennas() > max_driven) {
+        max_driven = driven_antennas();
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    configured = config->pin_bit_mask;
+    return ESP_OK;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    (void)ticks;
+}
+
+static uint64_t expected(unsigned int antenna)
+{
+    const int16_t led = antenna > 0 ? leds[antenna - 1] : -1;
+    return (led >= 0 ? 1ULL << led : 0) | (1ULL << FOREIGN_GPIO);
+}
+
+int main()
+{
+    antenna_table_t table = { .count = ANTENNA_COUNT };
+    uint64_t channels = 0;
+    for(size_t i = 0; i < ANTENNA_COUNT; i++) {
+        table.antennas[i].led = leds[i];
+        table.antennas[i].adc_channel = -1;
+        channels |= leds[i] >= 0 ? 1ULL << leds[i] : 0;
+    }
+
+    outputs = channels;
+    CHECK(init_antenna_output(&table) == ESP_OK, "init failed");
+    CHECK(configured == channels, "configured 0x%016llx", (unsigned long long)configured);
+    CHECK(driven_antennas() == 0, "outputs not off after init");
+    outputs |= 1ULL << FOREIGN_GPIO;
+
+    for(unsigned int from = 0; from <= ANTENNA_COUNT; from++) {
+        for(unsigned int to = 0; to <= ANTENNA_COUNT; to++) {
+            antenna_output_set(from > 0 ? 1UL << (from - 1) : 0);
+            CHECK(outputs == expected(from), "ANT%u: outputs 0x%016llx", from, (unsigned long long)outputs);
+
+            max_driven = driven_antennas();
+            writes = 0;
+            antenna_output_set(to > 0 ? 1UL << (to - 1) : 0);
+            CHECK(max_driven <= 1, "ANT%u to ANT%u drove %d antennas at once", from, to, max_driven);
+            CHECK(outputs == expected(to), "ANT%u to ANT%u: outputs 0x%016llx", from, to, (unsigned long long)outputs);
+            CHECK(antenna_output_get() == (to > 0 ? 1UL << (to - 1) : 0), "ANT%u to ANT%u: state not kept", from, to);
+            CHECK(writes == 4, "ANT%u to ANT%u: %d register writes", from, to, writes);
+        }
+    }
+
+    if(failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
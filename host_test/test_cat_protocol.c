@@ -0,0 +1,207 @@
+/*
+ * Decoding and fuzz tests of the CAT backends. Every backend decodes its sample
+ * frames, loses at most the frame a resync cuts, survives random and damaged
+ * input without reading outside its frame buffer (run with the sanitizers) and
+ * decodes the next clean frame after it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cat_samples.h"
+
+#define FUZZ_ROUNDS 20000
+#define MAX_NOISE 96
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)) { \
+        failures++; \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } \
+} while(0)
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static bool same_event(const cat_event_t *a, const cat_event_t *b)
+{
+    return a->frequency == b->frequency && a->tx == b->tx && a->mode == b->mode && a->vfo == b->vfo && a->split == b->split;
+}
+
+/**
+ * Feed bytes, returns the number of frames decoded and the last event
+ */
+static int feed(cat_parser_t *parser, const uint8_t *bytes, size_t len, cat_event_t *last)
+{
+    int frames = 0;
+    for(size_t i = 0; i < len; i++) {
+        cat_event_t event;
+        if(cat_parser_feed(parser, bytes[i], &event)) {
+            frames++;
+            *last = event;
+            CHECK(event.tx >= -1 && event.tx <= 1, "%s: tx %d", parser->protocol->name, event.tx);
+            CHECK(event.split >= -1 && event.split <= 1, "%s: split %d", parser->protocol->name, event.split);
+            CHECK(event.mode >= CAT_MODE_UNKNOWN && event.mode <= CAT_MODE_DATA, "%s: mode %d", parser->protocol->name, event.mode);
+            CHECK(event.vfo >= -1 && event.vfo <= 15, "%s: vfo %d", parser->protocol->name, event.vfo);
+        }
+        CHECK(parser->len < CAT_FRAME_MAX, "%s: frame length %u", parser->protocol->name, parser->len);
+    }
+    return frames;
+}
+
+static void test_samples(const cat_backend_samples_t *backend)
+{
+    cat_parser_t parser;
+    cat_parser_init(&parser, backend->protocol, backend->address);
+
+    uint8_t poll[CAT_POLL_MAX];
+    CHECK(cat_parser_poll_request(&parser, poll, sizeof(poll)) > 0, "%s: no poll request", backend->protocol->name);
+    CHECK(cat_parser_poll_request(&parser, poll, 1) == 0, "%s: poll request ignores the buffer size", backend->protocol->name);
+
+    for(size_t i = 0; i < backend->count; i++) {
+        const cat_sample_t *sample = &backend->samples[i];
+        cat_event_t event;
+        CHECK(feed(&parser, sample->bytes, sample->len, &event) == 1 && same_event(&event, &sample->event),
+              "%s: sample %zu decoded to %u tx %d mode %d vfo %d split %d", backend->protocol->name, i,
+              event.frequency, event.tx, event.mode, event.vfo, event.split);
+    }
+}
+
+/**
+ * A resync, as after a UART overflow, between two frames loses nothing. In the
+ * middle of a frame only that frame is lost and the next one is decoded.
+ */
+static void test_resync(const cat_backend_samples_t *backend)
+{
+    cat_parser_t parser;
+    cat_parser_init(&parser, backend->protocol, backend->address);
+
+    for(size_t i = 0; i < backend->count; i++) {
+        const cat_sample_t *sample = &backend->samples[i];
+        const cat_sample_t *next = &backend->samples[(i + 1) % backend->count];
+        cat_event_t event;
+
+        feed(&parser, sample->bytes, sample->len, &event);
+        const uint32_t resyncs = parser.resyncs;
+        cat_parser_resync(&parser);
+        CHECK(parser.resyncs == resyncs, "%s: sample %zu, resync counted at a frame boundary", backend->protocol->name, i);
+        CHECK(feed(&parser, next->bytes, next->len, &event) == 1 && same_event(&event, &next->event),
+              "%s: sample %zu, frame after a resync at a frame boundary not decoded", backend->protocol->name, i);
+
+        const size_t half = sample->len / 2;
+        feed(&parser, sample->bytes, half, &event);
+        cat_parser_resync(&parser);
+        CHECK(parser.resyncs == resyncs + 1, "%s: sample %zu, resync in a frame not counted", backend->protocol->name, i);
+        CHECK(feed(&parser, sample->bytes + half, sample->len - half, &event) == 0,
+              "%s: sample %zu, rest of the frame cut by a resync decoded", backend->protocol->name, i);
+        CHECK(feed(&parser, next->bytes, next->len, &event) == 1 && same_event(&event, &next->event),
+              "%s: sample %zu, frame after a resync in a frame not decoded", backend->protocol->name, i);
+    }
+}
+
+/**
+ * Noise, a sample cut short, a sample with a byte changed or bytes dropped, all
+ * followed by a terminator. The parser must decode the next clean sample.
+ */
+static void fuzz(const cat_backend_samples_t *backend)
+{
+    cat_parser_t parser;
+    cat_parser_init(&parser, backend->protocol, backend->address);
+    const uint8_t terminator = backend->protocol->terminator;
+    uint8_t junk[MAX_NOISE + CAT_FRAME_MAX + 1];
+
+    for(int round = 0; round < FUZZ_ROUNDS; round++) {
+        const cat_sample_t *sample = &backend->samples[rng() % backend->count];
+        size_t len = 0;
+        switch(rng() % 4) {
+        case 0:
+            len = rng() % MAX_NOISE;
+            for(size_t i = 0; i < len; i++) {
+                // Mostly bytes the backends look for, so the noise reaches the field parsers
+                junk[i] = rng() % 2 ? (uint8_t)rng() : sample->bytes[rng() % sample->len];
+            }
+            break;
+        case 1:
+            len = rng() % sample->len;
+            memcpy(junk, sample->bytes, len);
+            break;
+        case 2:
+            len = sample->len - 1;
+            memcpy(junk, sample->bytes, len);
+            junk[rng() % len] = (uint8_t)rng();
+            break;
+        case 3: {
+            const size_t cut = rng() % (sample->len - 1);
+            const size_t drop = 1 + rng() % (sample->len - 1 - cut);
+            memcpy(junk, sample->bytes, cut);
+            memcpy(junk + cut, sample->bytes + cut + drop, sample->len - 1 - cut - drop);
+            len = sample->len - 1 - drop;
+            break;
+        }
+        }
+        junk[len++] = terminator;
+
+        cat_event_t event;
+        feed(&parser, junk, len, &event);
+        if(rng() % 8 == 0) {
+            cat_parser_resync(&parser);
+            feed(&parser, &terminator, 1, &event);
+        }
+
+        const cat_sample_t *clean = &backend->samples[rng() % backend->count];
+        const int frames = feed(&parser, clean->bytes, clean->len, &event);
+        CHECK(frames == 1 && same_event(&event, &clean->event), "%s: round %d, clean frame not decoded after %zu bytes of junk",
+              backend->protocol->name, round, len);
+        if(failures > 20) {
+            return;
+        }
+    }
+}
+
+/**
+ * Random bytes only, the invariants in feed are all that is checked
+ */
+static void fuzz_random(const cat_backend_samples_t *backend)
+{
+    cat_parser_t parser;
+    cat_parser_init(&parser, backend->protocol, backend->address);
+    uint8_t bytes[4096];
+    for(int round = 0; round < FUZZ_ROUNDS / 100; round++) {
+        for(size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = (uint8_t)rng();
+        }
+        cat_event_t event;
+        feed(&parser, bytes, sizeof(bytes), &event);
+    }
+}
+
+int main()
+{
+    for(size_t i = 0; i < BACKEND_COUNT; i++) {
+        const cat_backend_samples_t *backend = &backend_samples[i];
+        CHECK(cat_protocol_find(backend->protocol->name) == backend->protocol, "%s: not found by name", backend->protocol->name);
+        test_samples(backend);
+        test_resync(backend);
+        fuzz(backend);
+        fuzz_random(backend);
+        printf("%-9s %zu samples, %d fuzz rounds\n", backend->protocol->name, backend->count, FUZZ_ROUNDS);
+    }
+    CHECK(cat_protocol_find("nonexistent") == NULL, "unknown protocol found");
+
+    if(failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("All passed\n");
+    return 0;
+}
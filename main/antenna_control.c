@@ -5,84 +5,263 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "websocket_client.h"
+#include "switch_trace.h"
+#include "antenna_output.h"
+#include "antenna_learning.h"
+#include "switch_scheduler.h"
+#include "local_server.h"
+#include "event_journal.h"
+#include "button_scanner.h"
+#include "system_state.h"
+#include "heap_guard.h"
+#include "telemetry.h"
+#include "esp_timer.h"
 #include "nvs.h"
-
-#define NUMBER_OF_ANTENNA 6
+#include <stdlib.h>
 
 static const char* TAG = "antenna_control";
-static int ant_led_gpio[NUMBER_OF_ANTENNA] = {CONFIG_ANT1_PIN_LED, CONFIG_ANT2_PIN_LED, CONFIG_ANT3_PIN_LED, CONFIG_ANT4_PIN_LED, CONFIG_ANT5_PIN_LED, CONFIG_ANT6_PIN_LED};
+static antenna_table_t antenna_table;
 #define automode_long_button_press_ms 1500
 #define automode_short_button_press_ms 100
 static bool automode_enabled = false;
 static TaskHandle_t xHandle;
 static TaskHandle_t antTaskHandle;
-static uint8_t ant1_value = 1;
-static uint8_t ant2_value = 2;
-static uint8_t ant3_value = 3;
-static uint8_t ant4_value = 4;
-static uint8_t ant5_value = 5;
-static uint8_t ant6_value = 6;
 static SemaphoreHandle_t automodeSemaphore = NULL;
+static StaticSemaphore_t automode_semaphore_buffer;
 QueueHandle_t qrg_queue;
+#define QRG_QUEUE_LEN 5
+static StaticQueue_t qrg_queue_buffer;
+static uint8_t qrg_queue_storage[QRG_QUEUE_LEN * sizeof(qrg_message_t)];
+static StaticTask_t automode_button_tcb;
+static StackType_t automode_button_stack[2048];
+static StaticTask_t antenna_button_tcb;
+static StackType_t antenna_button_stack[2048];
+static StaticTask_t automode_tcb;
+static StackType_t automode_stack[2048];
+static TaskHandle_t persist_task_handle;
+static StaticTask_t persist_tcb;
+static StackType_t persist_stack[3072];
 static nvs_handle_t my_nvs_handle;
+/* Antennas pinned to a band by a long press that the persist task has not stored yet, 0 if none */
+static uint8_t pinned_antenna[AMATEUR_BAND_COUNT];
+static portMUX_TYPE pinned_lock = portMUX_INITIALIZER_UNLOCKED;
+#if CONFIG_SYSTEM_STATE_SHOW_IN_USE
+#define IN_USE_BLINK_US (500 * 1000)
+static esp_timer_handle_t in_use_timer;
+static bool in_use_blink_on;
+#endif
+
+/**
+ * Band and antenna of one radio, the antenna is the one last confirmed by the server.
+ * automode_band and automode_segment are what automode last picked an antenna for,
+ * the last_vote fields are the last manual selection learned from. manual_antenna is
+ * the antenna the user asked for that the server has not confirmed yet, 0 if none.
+ */
+typedef struct {
+    enum AmateurBand active_band;
+    band_segment_t segment;
+    enum AmateurBand automode_band;
+    band_segment_t automode_segment;
+    unsigned int antenna;
+    enum AmateurBand last_vote_band;
+    band_segment_t last_vote_segment;
+    unsigned int last_vote_antenna;
+    volatile unsigned int manual_antenna;
+} radio_state_t;
+
+static radio_state_t radio_state[CONFIG_RADIO_COUNT];
+
+/**
+ * Fill the antenna table from the Kconfig defaults. ANTENNA_LED_GPIOS lists one LED per
+ * antenna, ANTENNA_BUTTONS lists "<adc channel>:<min>-<max>" per antenna in the same order.
+ */
+void antenna_table_default(antenna_table_t *table)
+{
+    const char *leds = CONFIG_ANTENNA_LED_GPIOS;
+    const char *buttons = CONFIG_ANTENNA_BUTTONS;
+    char *end;
+
+    table->count = 0;
+    while(*leds != '\0' && table->count < MAX_ANTENNAS) {
+        antenna_def_t *antenna = &table->antennas[table->count];
+        antenna->led = strtol(leds, &end, 10);
+        antenna->adc_channel = -1;
+        if(end == leds) {
+            break;
+        }
+        leds = *end == ',' ? end + 1 : end;
+
+        if(*buttons != '\0') {
+            long channel = strtol(buttons, &end, 10);
+            if(*end == ':') {
+                antenna->adc_channel = channel;
+                antenna->adc_min = strtol(end + 1, &end, 10);
+                antenna->adc_max = *end == '-' ? strtol(end + 1, &end, 10) : antenna->adc_min;
+            }
+            buttons = strchr(buttons, ',') ? strchr(buttons, ',') + 1 : "";
+        }
+        table->count++;
+    }
+}
 
-enum AmateurBand 
+/**
+ * The antenna LEDs show the antenna of the first radio. Antennas in use by other operating
+ * positions blink when that is enabled.
+ */
+void antenna_control_refresh_leds()
 {
-    _160M,
-    _80M,
-    _60M,
-    _40M,
-    _30M,
-    _20M,
-    _17M,
-    _15M,
-    _10M,
-    _6M,
-    UNKNOWN
-};
-
-static const char* const AmateurBandStr[] =
+    const unsigned int antenna = radio_state[0].antenna;
+    uint32_t leds = antenna != 0 ? 1UL << (antenna - 1) : 0;
+#if CONFIG_SYSTEM_STATE_SHOW_IN_USE
+    const uint32_t in_use = system_state_in_use_mask() & ~leds;
+    if(in_use == 0) {
+        esp_timer_stop(in_use_timer);
+        in_use_blink_on = false;
+    } else if(!esp_timer_is_active(in_use_timer)) {
+        esp_timer_start_periodic(in_use_timer, IN_USE_BLINK_US);
+    }
+    if(in_use_blink_on) {
+        leds |= in_use;
+    }
+#endif
+    antenna_output_set(leds);
+}
+
+#if CONFIG_SYSTEM_STATE_SHOW_IN_USE
+static void in_use_blink_cb(void *arg)
 {
-    "160M",
-    "80M",
-    "60M",
-    "40M",
-    "30M",
-    "20M",
-    "17M",
-    "15M",
-    "10M",
-    "6M",
-    "UNKNOWN"
-};
-
-static void init_leds()
+    in_use_blink_on = !in_use_blink_on;
+    antenna_control_refresh_leds();
+}
+#endif
+
+static esp_err_t init_leds()
 {
-    for(unsigned int i = 0; i < NUMBER_OF_ANTENNA; i++)
-    {
-        gpio_set_direction(ant_led_gpio[i], GPIO_MODE_OUTPUT);
+    esp_err_t err = init_antenna_output(&antenna_table);
+    if(err != ESP_OK) {
+        return err;
     }
     gpio_set_direction(CONFIG_AUTOMODE_PIN_LED, GPIO_MODE_OUTPUT);
+#if CONFIG_SYSTEM_STATE_SHOW_IN_USE
+    const esp_timer_create_args_t timer_args = {
+        .callback = in_use_blink_cb,
+        .name = "in_use_blink",
+    };
+    esp_timer_create(&timer_args, &in_use_timer);
+#endif
+    return ESP_OK;
 }
 
-static void disable_all_antenna_leds()
+/**
+ * Learn from an antenna the user selected while automode is off, once the server
+ * confirmed it. Repeated confirmations of the same selection count once.
+ */
+static void learn_selection(radio_state_t *state, unsigned int antenna)
 {
-    for(unsigned int i = 0; i < NUMBER_OF_ANTENNA; i++)
-    {
-        gpio_set_level(ant_led_gpio[i], false);
+#if CONFIG_AUTOMODE_LEARNING
+    if(automode_enabled || state->active_band == UNKNOWN) {
+        return;
+    }
+    if(state->last_vote_band == state->active_band && state->last_vote_segment == state->segment && state->last_vote_antenna == antenna) {
+        return;
     }
+    state->last_vote_band = state->active_band;
+    state->last_vote_segment = state->segment;
+    state->last_vote_antenna = antenna;
+    antenna_learning_vote(state->active_band, state->segment, antenna);
+    xTaskNotifyGive(persist_task_handle);
+#endif
 }
 
-void select_antenna(unsigned int antenna)
+/**
+ * Record the antenna the server selected for a radio. The LEDs show the antenna of the first radio.
+ */
+void select_antenna(uint8_t radio, unsigned int antenna)
 {
-    if(antenna >= 1 && antenna <= NUMBER_OF_ANTENNA) {
-        disable_all_antenna_leds();
-        gpio_set_level(ant_led_gpio[antenna - 1], true);
+    if(radio >= CONFIG_RADIO_COUNT) {
+        ESP_LOGE(TAG, "select_antenna invalid radio: %u", radio);
+    } else if(antenna >= 1 && antenna <= antenna_table.count) {
+        radio_state[radio].antenna = antenna;
+        event_journal_log(JOURNAL_SWITCH, radio, antenna);
+        /* Antennas the server selected on its own, like the answer to current_antenna, are not learned */
+        if(radio_state[radio].manual_antenna == antenna) {
+            learn_selection(&radio_state[radio], antenna);
+        }
+        radio_state[radio].manual_antenna = 0;
+        if(radio == 0) {
+            antenna_control_refresh_leds();
+        }
+        local_server_notify();
     } else {
         ESP_LOGE(TAG, "select_antenna invalid antenna number: %u", antenna);
     }
 }
 
+/**
+ * Ask for an antenna the user selected with a button or local control, without
+ * settle time. Only these selections are learned from.
+ */
+void request_manual_antenna(uint8_t radio, unsigned int antenna)
+{
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+    radio_state[radio].manual_antenna = antenna;
+    switch_scheduler_request_now(radio, antenna);
+}
+
+bool automode_is_enabled()
+{
+    return automode_enabled;
+}
+
+/**
+ * Switch automode on or off and show it on the automode LED
+ */
+void set_automode(bool enabled)
+{
+    if(automodeSemaphore == NULL) {
+        return;
+    }
+    if(xSemaphoreTake(automodeSemaphore, (TickType_t) 10) == pdTRUE) {
+        automode_enabled = enabled;
+        gpio_set_level(CONFIG_AUTOMODE_PIN_LED, enabled);
+        xSemaphoreGive(automodeSemaphore);
+        event_journal_log(JOURNAL_AUTOMODE, JOURNAL_NO_RADIO, enabled);
+        local_server_notify();
+    }
+}
+
+/**
+ * Band a radio is on, "UNKNOWN" before its first frequency report
+ */
+const char* get_radio_band(uint8_t radio)
+{
+    return radio < CONFIG_RADIO_COUNT ? amateur_band_str(radio_state[radio].active_band) : amateur_band_str(UNKNOWN);
+}
+
+/**
+ * Antenna of a radio as last confirmed by the server, 0 if none
+ */
+unsigned int get_radio_antenna(uint8_t radio)
+{
+    return radio < CONFIG_RADIO_COUNT ? radio_state[radio].antenna : 0;
+}
+
+unsigned int get_antenna_count()
+{
+    return antenna_table.count;
+}
+
+/**
+ * Whether a manual selection for a radio may go to the server, false when the
+ * server's antenna system state says it would be refused
+ */
+bool antenna_selection_allowed(uint8_t radio, unsigned int antenna)
+{
+    return radio < CONFIG_RADIO_COUNT && system_state_allow(radio_state[radio].active_band, antenna);
+}
+
 static void automode_button_click_cb(void *arg,void *usr_data)
 {
     xTaskNotify(xHandle, 2, eSetValueWithOverwrite);
@@ -93,56 +272,79 @@ static void automode_button_long_press_cb(void *arg,void *usr_data)
     xTaskNotify(xHandle, 1, eSetValueWithOverwrite);
 }
 
-static enum AmateurBand hz_to_amateur_band(unsigned int qrg)
+/**
+ * Antenna for a band segment: learned for the segment, learned for the band, then
+ * the band map in NVS. 0 if there is none.
+ */
+static unsigned int lookup_antenna(enum AmateurBand band, band_segment_t segment)
 {
-    if(qrg >= 1800000 && qrg <= 2000000) {
-        return _160M;
-    } else if(qrg >= 3500000 && qrg <= 3800000) {
-        return _80M;
-    } else if(qrg >= 5351500 && qrg <= 5366500) {
-        return _60M;
-    } else if(qrg >= 7000000 && qrg <= 7300000) {
-        return _40M;
-    } else if(qrg >= 10100000 && qrg <= 10150000) {
-        return _30M;
-    } else if(qrg >= 14000000 && qrg <= 14350000) {
-        return _20M;
-    } else if(qrg >= 18068000 && qrg <= 18168000) { 
-        return _17M;
-    } else if(qrg >= 21000000 && qrg <= 21450000) {
-        return _15M;
-    } else if(qrg >= 28000000 && qrg <= 29700000) {
-        return _10M;
-    } else if(qrg >= 50000000 && qrg <= 54000000) {
-        return _6M;
-    } else {
-        return UNKNOWN;
+    uint8_t antenna = antenna_learning_lookup(band, segment);
+    if(antenna == 0 && nvs_get_u8(my_nvs_handle, amateur_band_str(band), &antenna) != ESP_OK) {
+        antenna = 0;
     }
+    return antenna <= antenna_table.count ? antenna : 0;
 }
 
 static void automode_control_task()
 {
-    char qrg_str[11];
-    uint8_t antenna_number = 0;
-    enum AmateurBand previous_band = UNKNOWN;
-    enum AmateurBand active_band = UNKNOWN;
-    int qrg = 0;
+    qrg_message_t message;
+    bool was_enabled = false;
     for(;;) {
-        if (xQueueReceive(qrg_queue, (void *)&qrg_str, (TickType_t)portMAX_DELAY)) {
-            ESP_LOGD(TAG, "Received qrg: %s", qrg_str);
-            if(automode_enabled) {
-                qrg = atoi(qrg_str);
-                ESP_LOGD(TAG, "QRG number: %d", qrg);
-                previous_band = active_band;
-                active_band = hz_to_amateur_band(qrg);
-                if((active_band != previous_band) && active_band != UNKNOWN) {
-                    esp_err_t err = nvs_get_u8(my_nvs_handle, AmateurBandStr[active_band], &antenna_number);
-                    if(err == ESP_OK) {
-                        send_current_antenna(antenna_number);
-                    }
-                }
+        if(!xQueueReceive(qrg_queue, (void *)&message, portMAX_DELAY)) {
+            continue;
+        }
+        ESP_LOGD(TAG, "Received qrg: %" PRIu32 " from radio %u", message.cat.frequency, message.radio);
+        if(message.radio >= CONFIG_RADIO_COUNT) {
+            switch_trace_discard(message.trace_id);
+            continue;
+        }
+
+        /* Bands are tracked with automode off as well, manual selections are learned for them */
+        radio_state_t *radio = &radio_state[message.radio];
+        if(message.cat.mode != CAT_MODE_UNKNOWN) {
+            radio->segment = antenna_learning_segment(message.cat.mode);
+        }
+        bool band_changed = false;
+        if(message.cat.frequency != 0) {
+            enum AmateurBand band = hz_to_amateur_band(message.cat.frequency);
+            if(band != radio->active_band) {
+                radio->active_band = band;
+                band_changed = true;
+                event_journal_log(JOURNAL_BAND, message.radio, band);
+                local_server_notify();
+            }
+        }
+        if(message.cat.tx >= 0) {
+            switch_scheduler_set_tx(message.radio, message.cat.tx);
+        }
+        switch_trace_mark(message.trace_id, TRACE_STAGE_BAND_RESOLVED);
+        telemetry_update(message.radio, &message.cat, band_changed);
+
+        /* Pick an antenna for the current band as soon as automode is switched on */
+        if(automode_enabled && !was_enabled) {
+            for(int i = 0; i < CONFIG_RADIO_COUNT; i++) {
+                radio_state[i].automode_band = UNKNOWN;
             }
         }
+        was_enabled = automode_enabled;
+
+        if(automode_enabled && radio->active_band != UNKNOWN &&
+           (radio->active_band != radio->automode_band || radio->segment != radio->automode_segment)) {
+            radio->automode_band = radio->active_band;
+            radio->automode_segment = radio->segment;
+            unsigned int antenna = lookup_antenna(radio->active_band, radio->segment);
+            if(antenna != 0) {
+                antenna = system_state_resolve(radio->active_band, antenna);
+            }
+            switch_trace_mark(message.trace_id, TRACE_STAGE_MAP_LOOKUP);
+            if(antenna != 0 && antenna != radio->antenna) {
+                switch_scheduler_request(message.radio, antenna, message.trace_id);
+                continue;
+            }
+            /* Back on the selected antenna or no antenna known, a command still waiting is stale */
+            switch_scheduler_cancel(message.radio);
+        }
+        switch_trace_discard(message.trace_id);
     }
 }
 
@@ -157,6 +359,8 @@ static void automode_button_task()
                         portMAX_DELAY ); /* Block indefinitely. */
         if(ulNotifiedValue == 1) {
             ESP_LOGI(TAG, "Reset Automode");
+            antenna_learning_clear();
+            xTaskNotifyGive(persist_task_handle);
             for(int i = 0; i < 3;++i) {
                 gpio_set_level(CONFIG_AUTOMODE_PIN_LED, true);
                 vTaskDelay(300 / portTICK_PERIOD_MS);
@@ -168,25 +372,14 @@ static void automode_button_task()
             }
         } else if(ulNotifiedValue == 2) {
             ESP_LOGI(TAG, "Enable or disable AutoMode");
-            if(automodeSemaphore != NULL) {
-                if( xSemaphoreTake(automodeSemaphore, ( TickType_t ) 10 ) == pdTRUE ) {
-                    if(automode_enabled) {
-                        gpio_set_level(CONFIG_AUTOMODE_PIN_LED, false);
-                        automode_enabled = false;
-                    } else {
-                        gpio_set_level(CONFIG_AUTOMODE_PIN_LED, true);
-                        automode_enabled = true;
-                    }
-                    xSemaphoreGive(automodeSemaphore);
-                }
-            }
+            set_automode(!automode_enabled);
         }
     }
 }
 
 static void init_automode_button()
 {
-    automodeSemaphore = xSemaphoreCreateMutex();
+    automodeSemaphore = xSemaphoreCreateMutexStatic(&automode_semaphore_buffer);
 
     button_config_t automode_button_config = {
         .type = BUTTON_TYPE_GPIO,
@@ -195,6 +388,9 @@ static void init_automode_button()
         .gpio_button_config = {
             .gpio_num = CONFIG_AUTOMODE_BUTTON_GPIO,
             .active_level = 0,
+#if CONFIG_POWER_SAVE
+            .enable_power_save = true,
+#endif
         },
     };
     
@@ -204,22 +400,63 @@ static void init_automode_button()
         return;
     }
 
-    xTaskCreate(automode_button_task, "automode_button_task", 2048, NULL, 12, &xHandle);
+    xHandle = xTaskCreateStatic(automode_button_task, "automode_button_task", sizeof(automode_button_stack), NULL, 12,
+                                automode_button_stack, &automode_button_tcb);
     if(NULL == xHandle) {
         ESP_LOGE(TAG, "Cannot create automode button task");
     }
+    heap_guard_watch(xHandle);
 
     iot_button_register_cb(automode_button, BUTTON_SINGLE_CLICK, automode_button_click_cb, NULL);
     iot_button_register_cb(automode_button, BUTTON_LONG_PRESS_START, automode_button_long_press_cb, NULL);
 }
 
-static void antenna_button_cb(void *arg,void *usr_data)
+static void antenna_button_cb(button_gesture_t gesture, unsigned int antenna, unsigned int other)
+{
+    ESP_LOGI(TAG, "Antenna button %u gesture %d", antenna, gesture);
+    xTaskNotify(antTaskHandle, (gesture << 16) | (other << 8) | antenna, eSetValueWithOverwrite);
+}
+
+/**
+ * Make an antenna the band map entry of the band radio 1 is on. Learned antennas
+ * for the band still come first. The persist task stores it.
+ */
+static void pin_antenna_to_band(unsigned int antenna)
+{
+    const enum AmateurBand band = radio_state[0].active_band;
+    if(band == UNKNOWN) {
+        ESP_LOGW(TAG, "Band unknown, ANT%u not stored", antenna);
+        return;
+    }
+    portENTER_CRITICAL(&pinned_lock);
+    pinned_antenna[band] = antenna;
+    portEXIT_CRITICAL(&pinned_lock);
+    xTaskNotifyGive(persist_task_handle);
+}
+
+static void store_pinned_antennas()
 {
-    uint8_t value = *((uint8_t*)usr_data);
-    ESP_LOGI(TAG, "Antenna button clicked");
-    xTaskNotify(antTaskHandle, value, eSetValueWithOverwrite);
+    for(int band = 0; band < AMATEUR_BAND_COUNT; band++) {
+        portENTER_CRITICAL(&pinned_lock);
+        const uint8_t antenna = pinned_antenna[band];
+        pinned_antenna[band] = 0;
+        portEXIT_CRITICAL(&pinned_lock);
+        if(antenna == 0) {
+            continue;
+        }
+        if(nvs_set_u8(my_nvs_handle, amateur_band_str(band), antenna) != ESP_OK || nvs_commit(my_nvs_handle) != ESP_OK) {
+            ESP_LOGE(TAG, "Cannot store ANT%u for %s", antenna, amateur_band_str(band));
+            continue;
+        }
+        ESP_LOGI(TAG, "ANT%u stored for %s", antenna, amateur_band_str(band));
+    }
 }
 
+/**
+ * Click: select the antenna for radio 1. Long press: store it for the current band and
+ * select it. Combo: with two radios, select the first antenna for radio 1 and the second for radio 2.
+ * Selections the server's antenna system state rules out are not sent.
+ */
 static void antenna_button_task()
 {
     uint32_t ulNotifiedValue;
@@ -229,8 +466,31 @@ static void antenna_button_task()
                         ULONG_MAX, /* Reset the notification value to 0 on exit. */
                         &ulNotifiedValue, /* Notified value pass out in ulNotifiedValue. */
                         portMAX_DELAY ); /* Block indefinitely. */
-        if(!automode_enabled) {
-            send_current_antenna(ulNotifiedValue);
+        const button_gesture_t gesture = ulNotifiedValue >> 16;
+        const unsigned int antenna = ulNotifiedValue & 0xFF;
+        const unsigned int other = (ulNotifiedValue >> 8) & 0xFF;
+        switch(gesture) {
+        case BUTTON_GESTURE_CLICK:
+            if(!automode_enabled && antenna_selection_allowed(0, antenna)) {
+                request_manual_antenna(0, antenna);
+            }
+            break;
+        case BUTTON_GESTURE_LONG_PRESS:
+            pin_antenna_to_band(antenna);
+            if(antenna_selection_allowed(0, antenna)) {
+                request_manual_antenna(0, antenna);
+            }
+            break;
+        case BUTTON_GESTURE_COMBO:
+#if CONFIG_RADIO_COUNT > 1
+            if(!automode_enabled && antenna_selection_allowed(0, antenna) && antenna_selection_allowed(1, other)) {
+                request_manual_antenna(0, antenna);
+                request_manual_antenna(1, other);
+            }
+#else
+            ESP_LOGD(TAG, "Combo ANT%u+ANT%u needs two radios", antenna, other);
+#endif
+            break;
         }
     }
 
@@ -238,130 +498,59 @@ static void antenna_button_task()
 
 static void init_antenna_buttons()
 {
-    button_config_t ant1_button_config = {
-        .type = BUTTON_TYPE_ADC,
-        .long_press_time = automode_long_button_press_ms,
-        .short_press_time = automode_short_button_press_ms,
-        .adc_button_config = {
-            .adc_channel = 0,
-            .button_index = 0,
-            .min = 700,
-            .max = 2000,
-        },
-    };
-    
-    button_handle_t ant1_button = iot_button_create(&ant1_button_config);
-    if(NULL == ant1_button) {
-        ESP_LOGE(TAG, "ANT1 Button create failed");
-    }
-
-    button_config_t ant2_button_config = {
-    .type = BUTTON_TYPE_ADC,
-    .long_press_time = automode_long_button_press_ms,
-    .short_press_time = automode_short_button_press_ms,
-        .adc_button_config = {
-            .adc_channel = 0,
-            .button_index = 1,
-            .min = 2300,
-            .max = 2700,
-        },
-    };
-    button_handle_t ant2_button = iot_button_create(&ant2_button_config);
-    if(NULL == ant2_button) {
-        ESP_LOGE(TAG, "ANT2 Button create failed");
-    }
-
-    button_config_t ant3_button_config = {
-    .type = BUTTON_TYPE_ADC,
-    .long_press_time = automode_long_button_press_ms,
-    .short_press_time = automode_short_button_press_ms,
-    .adc_button_config = {
-        .adc_channel = 0,
-        .button_index = 2,
-        .min = 3000,
-        .max = 4000,
-    },
-    };
-    button_handle_t ant3_button = iot_button_create(&ant3_button_config);
-    if(NULL == ant3_button) {
-        ESP_LOGE(TAG, "ANT3 Button create failed");
-    }
-
-    button_config_t ant4_button_config = {
-        .type = BUTTON_TYPE_ADC,
-        .long_press_time = automode_long_button_press_ms,
-        .short_press_time = automode_short_button_press_ms,
-        .adc_button_config = {
-            .adc_channel = 1,
-            .button_index = 0,
-            .min = 700,
-            .max = 2000,
-        },
-    };
-    
-    button_handle_t ant4_button = iot_button_create(&ant4_button_config);
-    if(NULL == ant4_button) {
-        ESP_LOGE(TAG, "ANT4 Button create failed");
-    }
-
-    button_config_t ant5_button_config = {
-    .type = BUTTON_TYPE_ADC,
-    .long_press_time = automode_long_button_press_ms,
-    .short_press_time = automode_short_button_press_ms,
-        .adc_button_config = {
-            .adc_channel = 1,
-            .button_index = 1,
-            .min = 2300,
-            .max = 2700,
-        },
-    };
-    button_handle_t ant5_button = iot_button_create(&ant5_button_config);
-    if(NULL == ant5_button) {
-        ESP_LOGE(TAG, "ANT5 Button create failed");
-    }
+    antTaskHandle = xTaskCreateStatic(antenna_button_task, "antenna_button_task", sizeof(antenna_button_stack), NULL, 12,
+                                      antenna_button_stack, &antenna_button_tcb);
+    heap_guard_watch(antTaskHandle);
+    init_button_scanner(&antenna_table, antenna_button_cb);
+}
 
-    button_config_t ant6_button_config = {
-    .type = BUTTON_TYPE_ADC,
-    .long_press_time = automode_long_button_press_ms,
-    .short_press_time = automode_short_button_press_ms,
-    .adc_button_config = {
-        .adc_channel = 1,
-        .button_index = 2,
-        .min = 3000,
-        .max = 4000,
-    },
-    };
-    button_handle_t ant6_button = iot_button_create(&ant6_button_config);
-    if(NULL == ant6_button) {
-        ESP_LOGE(TAG, "ANT6 Button create failed");
+/**
+ * Writes to NVS for the tasks on the switching path. NVS allocates and a flash
+ * write blocks for milliseconds, neither may happen in a heap guarded task.
+ */
+static void persist_task()
+{
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, antenna_learning_commit());
+        store_pinned_antennas();
     }
-
-    xTaskCreate(antenna_button_task, "antenna_button_task", 2048, NULL, 12, &antTaskHandle);
-
-    iot_button_register_cb(ant1_button, BUTTON_SINGLE_CLICK, antenna_button_cb, &ant1_value);
-    iot_button_register_cb(ant2_button, BUTTON_SINGLE_CLICK, antenna_button_cb, &ant2_value);
-    iot_button_register_cb(ant3_button, BUTTON_SINGLE_CLICK, antenna_button_cb, &ant3_value);
-    iot_button_register_cb(ant4_button, BUTTON_SINGLE_CLICK, antenna_button_cb, &ant4_value);
-    iot_button_register_cb(ant5_button, BUTTON_SINGLE_CLICK, antenna_button_cb, &ant5_value);
-    iot_button_register_cb(ant6_button, BUTTON_SINGLE_CLICK, antenna_button_cb, &ant6_value);
 }
 
 /**
- * Assumes nvs_flash_init is already called!
+ * Assumes nvs_flash_init is already called! Fails without starting anything when the
+ * antenna outputs cannot be set up.
 */
-void init_antenna_control()
+esp_err_t init_antenna_control(const antenna_table_t *table)
 {
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_nvs_handle);
+    antenna_table = *table;
+    ESP_LOGI(TAG, "%u antennas configured", antenna_table.count);
+
+    esp_err_t err = init_leds();
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_open("storage", NVS_READWRITE, &my_nvs_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Could not initialize NVS handle!: (%s)", esp_err_to_name(err));
     }
 
-    qrg_queue = xQueueCreate(5, 11);
+    qrg_queue = xQueueCreateStatic(QRG_QUEUE_LEN, sizeof(qrg_message_t), qrg_queue_storage, &qrg_queue_buffer);
+    for(int i = 0; i < CONFIG_RADIO_COUNT; i++) {
+        radio_state[i].active_band = UNKNOWN;
+        radio_state[i].segment = SEGMENT_ANY;
+        radio_state[i].automode_band = UNKNOWN;
+        radio_state[i].last_vote_band = UNKNOWN;
+    }
+    init_antenna_learning(my_nvs_handle);
+    persist_task_handle = xTaskCreateStatic(persist_task, "persist_task", sizeof(persist_stack), NULL, tskIDLE_PRIORITY + 1,
+                                            persist_stack, &persist_tcb);
+    init_switch_scheduler();
 
-    init_leds();
-    disable_all_antenna_leds();
     init_automode_button();
     init_antenna_buttons();
     
-    xTaskCreate(automode_control_task, "automode_task", 2048, NULL, 12, NULL);
+    heap_guard_watch(xTaskCreateStatic(automode_control_task, "automode_task", sizeof(automode_stack), NULL, 12,
+                                       automode_stack, &automode_tcb));
+    return ESP_OK;
 }
\ No newline at end of file
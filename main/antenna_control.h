@@ -1,9 +1,48 @@
 #pragma once
 
+#include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "cat_protocol.h"
+#include "band_plan.h"
+
+/**
+ * Radio state report from the band decoder to the automode control task
+ */
+typedef struct {
+    cat_event_t cat;
+    uint8_t radio;
+    uint32_t trace_id;
+} qrg_message_t;
+
+#define MAX_ANTENNAS 16
+
+/**
+ * One antenna: the GPIO of its LED and the ADC window of its button.
+ * adc_channel is -1 for antennas without a button.
+ */
+typedef struct {
+    int16_t led;
+    int8_t adc_channel;
+    uint16_t adc_min;
+    uint16_t adc_max;
+} antenna_def_t;
+
+typedef struct {
+    uint8_t count;
+    antenna_def_t antennas[MAX_ANTENNAS];
+} antenna_table_t;
 
 extern QueueHandle_t qrg_queue;
 
-void init_antenna_control();
-void select_antenna(unsigned int antenna);
\ No newline at end of file
+void antenna_table_default(antenna_table_t *table);
+esp_err_t init_antenna_control(const antenna_table_t *table);
+void select_antenna(uint8_t radio, unsigned int antenna);
+void request_manual_antenna(uint8_t radio, unsigned int antenna);
+bool automode_is_enabled();
+void set_automode(bool enabled);
+const char* get_radio_band(uint8_t radio);
+unsigned int get_radio_antenna(uint8_t radio);
+unsigned int get_antenna_count();
+bool antenna_selection_allowed(uint8_t radio, unsigned int antenna);
+void antenna_control_refresh_leds();
\ No newline at end of file
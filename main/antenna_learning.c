@@ -0,0 +1,227 @@
+#include "antenna_learning.h"
+#include "esp_log.h"
+#include "freertos/task.h"
+#include "cat_protocol.h"
+#include <string.h>
+
+band_segment_t antenna_learning_segment(int8_t mode)
+{
+    switch(mode) {
+    case CAT_MODE_CW:
+    case CAT_MODE_CW_R:
+        return SEGMENT_CW;
+    case CAT_MODE_RTTY:
+    case CAT_MODE_RTTY_R:
+    case CAT_MODE_DATA:
+        return SEGMENT_DATA;
+    case CAT_MODE_LSB:
+    case CAT_MODE_USB:
+    case CAT_MODE_FM:
+    case CAT_MODE_AM:
+        return SEGMENT_PHONE;
+    default:
+        return SEGMENT_ANY;
+    }
+}
+
+#if CONFIG_AUTOMODE_LEARNING
+
+static const char *TAG = "antenna_learning";
+static const char *votes_key = "learned_votes";
+
+#define LEARNING_VERSION 1
+#define COMMIT_INTERVAL_TICKS (CONFIG_AUTOMODE_LEARN_COMMIT_INTERVAL * 1000 / portTICK_PERIOD_MS)
+
+/**
+ * Manual selections per band, segment and antenna. This is what is stored in NVS,
+ * the learned map is derived from it.
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t votes[AMATEUR_BAND_COUNT][SEGMENT_COUNT][MAX_ANTENNAS];
+} learned_votes_t;
+
+static learned_votes_t learned;
+/* Winning antenna per band and segment, 0 if none. The SEGMENT_ANY column holds the winner over the whole band. */
+static uint8_t learned_map[AMATEUR_BAND_COUNT][SEGMENT_COUNT];
+static portMUX_TYPE learning_mux = portMUX_INITIALIZER_UNLOCKED;
+static nvs_handle_t learning_nvs;
+static bool dirty;
+static bool commit_now;
+static TickType_t dirty_since;
+
+/* Only used by the task that commits, too large for its stack */
+static learned_votes_t commit_buffer;
+
+/**
+ * The antenna with the most votes, if it has enough votes and a large enough share
+ */
+static unsigned int winner(const uint32_t *votes)
+{
+    uint32_t total = 0;
+    uint32_t best = 0;
+    unsigned int antenna = 0;
+    for(unsigned int i = 0; i < MAX_ANTENNAS; i++) {
+        total += votes[i];
+        if(votes[i] > best) {
+            best = votes[i];
+            antenna = i + 1;
+        }
+    }
+    if(best < CONFIG_AUTOMODE_LEARN_MIN_VOTES || best * 100 < total * CONFIG_AUTOMODE_LEARN_MIN_SHARE) {
+        return 0;
+    }
+    return antenna;
+}
+
+static void update_map(int band)
+{
+    uint32_t band_votes[MAX_ANTENNAS] = {0};
+    uint32_t votes[MAX_ANTENNAS];
+    for(int segment = 0; segment < SEGMENT_COUNT; segment++) {
+        for(int i = 0; i < MAX_ANTENNAS; i++) {
+            votes[i] = learned.votes[band][segment][i];
+            band_votes[i] += votes[i];
+        }
+        if(segment != SEGMENT_ANY) {
+            learned_map[band][segment] = winner(votes);
+        }
+    }
+    learned_map[band][SEGMENT_ANY] = winner(band_votes);
+}
+
+static void mark_dirty()
+{
+    if(!dirty) {
+        dirty = true;
+        dirty_since = xTaskGetTickCount();
+    }
+}
+
+/**
+ * Record a manual antenna selection. Once a cell holds AUTOMODE_LEARN_HISTORY votes
+ * they are halved, so a changed preference wins again after a few selections.
+ */
+void antenna_learning_vote(enum AmateurBand band, band_segment_t segment, unsigned int antenna)
+{
+    if(band >= AMATEUR_BAND_COUNT || segment >= SEGMENT_COUNT || antenna < 1 || antenna > MAX_ANTENNAS) {
+        return;
+    }
+
+    portENTER_CRITICAL(&learning_mux);
+    uint8_t *votes = learned.votes[band][segment];
+    unsigned int total = 0;
+    for(int i = 0; i < MAX_ANTENNAS; i++) {
+        total += votes[i];
+    }
+    if(total >= CONFIG_AUTOMODE_LEARN_HISTORY) {
+        for(int i = 0; i < MAX_ANTENNAS; i++) {
+            votes[i] /= 2;
+        }
+    }
+    votes[antenna - 1]++;
+    update_map(band);
+    mark_dirty();
+    portEXIT_CRITICAL(&learning_mux);
+}
+
+/**
+ * Learned antenna for a band segment, falls back to the band as a whole. 0 if nothing is learned.
+ */
+unsigned int antenna_learning_lookup(enum AmateurBand band, band_segment_t segment)
+{
+    unsigned int antenna = 0;
+    if(band >= AMATEUR_BAND_COUNT || segment >= SEGMENT_COUNT) {
+        return 0;
+    }
+    portENTER_CRITICAL(&learning_mux);
+    antenna = learned_map[band][segment];
+    if(antenna == 0) {
+        antenna = learned_map[band][SEGMENT_ANY];
+    }
+    portEXIT_CRITICAL(&learning_mux);
+    return antenna;
+}
+
+/**
+ * Forget everything learned, stored at the next commit without waiting for the interval
+ */
+void antenna_learning_clear()
+{
+    portENTER_CRITICAL(&learning_mux);
+    memset(learned.votes, 0, sizeof(learned.votes));
+    memset(learned_map, 0, sizeof(learned_map));
+    mark_dirty();
+    commit_now = true;
+    portEXIT_CRITICAL(&learning_mux);
+    ESP_LOGI(TAG, "Learned antennas cleared");
+}
+
+/**
+ * Store the votes if they changed at least AUTOMODE_LEARN_COMMIT_INTERVAL seconds ago,
+ * so a burst of selections costs one flash write. Called from a task the heap guard
+ * does not watch, NVS allocates. Returns the ticks until the next commit
+ * is due, portMAX_DELAY when there is nothing to store.
+ */
+TickType_t antenna_learning_commit()
+{
+    TickType_t now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&learning_mux);
+    if(!dirty) {
+        portEXIT_CRITICAL(&learning_mux);
+        return portMAX_DELAY;
+    }
+    TickType_t elapsed = now - dirty_since;
+    if(!commit_now && elapsed < COMMIT_INTERVAL_TICKS) {
+        portEXIT_CRITICAL(&learning_mux);
+        return COMMIT_INTERVAL_TICKS - elapsed;
+    }
+    commit_buffer = learned;
+    dirty = false;
+    commit_now = false;
+    portEXIT_CRITICAL(&learning_mux);
+
+    esp_err_t err = nvs_set_blob(learning_nvs, votes_key, &commit_buffer, sizeof(commit_buffer));
+    if(err == ESP_OK) {
+        err = nvs_commit(learning_nvs);
+    }
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not store learned antennas: (%s)", esp_err_to_name(err));
+    }
+    return portMAX_DELAY;
+}
+
+/**
+ * Load the stored votes. Votes stored by a different layout are dropped.
+ */
+void init_antenna_learning(nvs_handle_t nvs_handle)
+{
+    learning_nvs = nvs_handle;
+
+    size_t size = sizeof(learned);
+    esp_err_t err = nvs_get_blob(learning_nvs, votes_key, &learned, &size);
+    if(err != ESP_OK || size != sizeof(learned) || learned.version != LEARNING_VERSION) {
+        memset(&learned, 0, sizeof(learned));
+        learned.version = LEARNING_VERSION;
+    }
+
+    unsigned int mappings = 0;
+    for(int band = 0; band < AMATEUR_BAND_COUNT; band++) {
+        update_map(band);
+        for(int segment = 0; segment < SEGMENT_COUNT; segment++) {
+            mappings += learned_map[band][segment] != 0;
+        }
+    }
+    ESP_LOGI(TAG, "%u learned antenna mappings", mappings);
+}
+
+#else
+
+void init_antenna_learning(nvs_handle_t nvs_handle) {}
+void antenna_learning_vote(enum AmateurBand band, band_segment_t segment, unsigned int antenna) {}
+unsigned int antenna_learning_lookup(enum AmateurBand band, band_segment_t segment) { return 0; }
+void antenna_learning_clear() {}
+TickType_t antenna_learning_commit() { return portMAX_DELAY; }
+
+#endif
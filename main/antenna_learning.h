@@ -0,0 +1,24 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+#include "antenna_control.h"
+
+/**
+ * Part of a band an antenna can be learned for, derived from the operating mode.
+ * SEGMENT_ANY collects selections made while the mode was not known.
+ */
+typedef enum {
+    SEGMENT_CW,
+    SEGMENT_DATA,
+    SEGMENT_PHONE,
+    SEGMENT_ANY,
+    SEGMENT_COUNT
+} band_segment_t;
+
+void init_antenna_learning(nvs_handle_t nvs_handle);
+band_segment_t antenna_learning_segment(int8_t mode);
+void antenna_learning_vote(enum AmateurBand band, band_segment_t segment, unsigned int antenna);
+unsigned int antenna_learning_lookup(enum AmateurBand band, band_segment_t segment);
+void antenna_learning_clear();
+TickType_t antenna_learning_commit();
@@ -0,0 +1,246 @@
+#include "antenna_output.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "antenna_output";
+
+#if CONFIG_ANTENNA_OUTPUT_GPIO
+#include "driver/gpio.h"
+#include "soc/soc.h"
+#include "soc/soc_caps.h"
+#include "soc/gpio_reg.h"
+
+static esp_err_t gpio_output_init(uint64_t channels)
+{
+    gpio_config_t io_conf = {
+        .pin_bit_mask = channels,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    return gpio_config(&io_conf);
+}
+
+/**
+ * The write-1-to-set/clear registers only touch the bits written, so other tasks
+ * driving GPIOs in the same bank are not disturbed and no lock is needed.
+ * Both banks are cleared before either is set, otherwise switching between
+ * antennas in different banks would drive both for a moment.
+ */
+static esp_err_t gpio_output_write(uint64_t clear, uint64_t set)
+{
+    REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clear);
+#if SOC_GPIO_PIN_COUNT > 32
+    REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clear >> 32));
+#endif
+    REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)set);
+#if SOC_GPIO_PIN_COUNT > 32
+    REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(set >> 32));
+#endif
+    return ESP_OK;
+}
+
+static const antenna_output_backend_t output_backend = { "gpio", gpio_output_init, gpio_output_write };
+
+#elif CONFIG_ANTENNA_OUTPUT_SHIFT_REGISTER
+#include "driver/spi_master.h"
+
+/* 74HC595 chain, the latch (RCLK) is driven by the chip select so all outputs change on its rising edge */
+static spi_device_handle_t shift_register;
+static uint64_t shift_register_state;
+
+static esp_err_t shift_register_init(uint64_t channels)
+{
+    if(channels >> (CONFIG_ANTENNA_OUTPUT_SHIFT_REGISTER_COUNT * 8)) {
+        ESP_LOGE(TAG, "Output channel beyond the end of the shift register chain");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    spi_bus_config_t buscfg = {
+        .miso_io_num = -1,
+        .mosi_io_num = CONFIG_ANTENNA_OUTPUT_SPI_MOSI_GPIO,
+        .sclk_io_num = CONFIG_ANTENNA_OUTPUT_SPI_SCLK_GPIO,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+    };
+    esp_err_t err = spi_bus_initialize(CONFIG_ANTENNA_OUTPUT_SPI_HOST, &buscfg, SPI_DMA_DISABLED);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    spi_device_interface_config_t devcfg = {
+        .mode = 0,
+        .clock_speed_hz = 1 * 1000 * 1000,
+        .spics_io_num = CONFIG_ANTENNA_OUTPUT_SPI_LATCH_GPIO,
+        .queue_size = 1,
+    };
+    return spi_bus_add_device(CONFIG_ANTENNA_OUTPUT_SPI_HOST, &devcfg, &shift_register);
+}
+
+static esp_err_t shift_register_write(uint64_t clear, uint64_t set)
+{
+    uint8_t data[CONFIG_ANTENNA_OUTPUT_SHIFT_REGISTER_COUNT];
+
+    shift_register_state = (shift_register_state & ~clear) | set;
+    /* The last register in the chain is shifted out first */
+    for(int i = 0; i < CONFIG_ANTENNA_OUTPUT_SHIFT_REGISTER_COUNT; i++) {
+        data[i] = shift_register_state >> ((CONFIG_ANTENNA_OUTPUT_SHIFT_REGISTER_COUNT - 1 - i) * 8);
+    }
+
+    spi_transaction_t t = {
+        .length = sizeof(data) * 8,
+        .tx_buffer = data,
+    };
+    return spi_device_polling_transmit(shift_register, &t);
+}
+
+static const antenna_output_backend_t output_backend = { "shift register", shift_register_init, shift_register_write };
+
+#elif CONFIG_ANTENNA_OUTPUT_I2C_EXPANDER
+#include "driver/i2c.h"
+
+/* PCF8575, 16 quasi-bidirectional outputs written as P00-P07 followed by P10-P17 */
+static uint16_t expander_state;
+
+static esp_err_t expander_init(uint64_t channels)
+{
+    if(channels >> 16) {
+        ESP_LOGE(TAG, "Output channel beyond the 16 expander outputs");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = CONFIG_ANTENNA_OUTPUT_I2C_SDA_GPIO,
+        .scl_io_num = CONFIG_ANTENNA_OUTPUT_I2C_SCL_GPIO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = 400000,
+    };
+    esp_err_t err = i2c_param_config(CONFIG_ANTENNA_OUTPUT_I2C_PORT, &conf);
+    if(err != ESP_OK) {
+        return err;
+    }
+    return i2c_driver_install(CONFIG_ANTENNA_OUTPUT_I2C_PORT, conf.mode, 0, 0, 0);
+}
+
+static esp_err_t expander_write(uint64_t clear, uint64_t set)
+{
+    expander_state = (expander_state & ~clear) | set;
+    const uint8_t data[2] = { expander_state & 0xFF, expander_state >> 8 };
+    return i2c_master_write_to_device(CONFIG_ANTENNA_OUTPUT_I2C_PORT, CONFIG_ANTENNA_OUTPUT_I2C_ADDRESS,
+                                      data, sizeof(data), 50 / portTICK_PERIOD_MS);
+}
+
+static const antenna_output_backend_t output_backend = { "i2c expander", expander_init, expander_write };
+
+#else
+
+/* No output hardware, every change is logged. For bench setups without LEDs or relays. */
+static esp_err_t log_output_init(uint64_t channels)
+{
+    return ESP_OK;
+}
+
+static esp_err_t log_output_write(uint64_t clear, uint64_t set)
+{
+    ESP_LOGI(TAG, "clear 0x%016" PRIx64 " set 0x%016" PRIx64, clear, set);
+    return ESP_OK;
+}
+
+static const antenna_output_backend_t output_backend = { "log", log_output_init, log_output_write };
+
+#endif
+
+static const antenna_output_backend_t *backend = &output_backend;
+static uint64_t antenna_channels[MAX_ANTENNAS];
+static uint8_t antenna_count;
+static uint32_t active_antennas;
+static SemaphoreHandle_t output_mutex;
+static StaticSemaphore_t output_mutex_buffer;
+
+/**
+ * All channels of the antennas in the bit set, bit 0 is antenna 1
+ */
+static uint64_t channel_mask(uint32_t antennas)
+{
+    uint64_t mask = 0;
+    for(uint8_t i = 0; i < antenna_count; i++) {
+        if(antennas & (1UL << i)) {
+            mask |= antenna_channels[i];
+        }
+    }
+    return mask;
+}
+
+/**
+ * Switch the outputs to exactly the antennas in the bit set, bit 0 is antenna 1.
+ * Outputs are cleared and set in one backend write, unless a break-before-make
+ * delay is configured: then the old outputs are released first and the new ones
+ * are only driven after the delay.
+ */
+void antenna_output_set(uint32_t antennas)
+{
+    if(output_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(output_mutex, portMAX_DELAY);
+    const uint64_t on = channel_mask(antennas);
+    const uint64_t off = channel_mask(~antennas) & ~on;
+    esp_err_t err;
+
+#if CONFIG_ANTENNA_OUTPUT_BREAK_BEFORE_MAKE_MS > 0
+    const uint64_t was_on = channel_mask(active_antennas);
+    if((was_on & off) && (on & ~was_on)) {
+        err = backend->write(off, 0);
+        if(err == ESP_OK) {
+            vTaskDelay((CONFIG_ANTENNA_OUTPUT_BREAK_BEFORE_MAKE_MS + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+            err = backend->write(0, on);
+        }
+    } else {
+        err = backend->write(off, on);
+    }
+#else
+    err = backend->write(off, on);
+#endif
+
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Output write failed: (%s)", esp_err_to_name(err));
+    }
+    active_antennas = antennas;
+    xSemaphoreGive(output_mutex);
+}
+
+uint32_t antenna_output_get()
+{
+    return active_antennas;
+}
+
+/**
+ * Set up the backend for the outputs in the antenna table, all outputs start off.
+ * Antennas with a negative output have none.
+ */
+esp_err_t init_antenna_output(const antenna_table_t *table)
+{
+    uint64_t channels = 0;
+
+    antenna_count = table->count;
+    for(uint8_t i = 0; i < antenna_count; i++) {
+        int16_t channel = table->antennas[i].led;
+        antenna_channels[i] = (channel >= 0 && channel < 64) ? 1ULL << channel : 0;
+        channels |= antenna_channels[i];
+    }
+
+    esp_err_t err = backend->init(channels);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not initialize %s outputs: (%s)", backend->name, esp_err_to_name(err));
+        return err;
+    }
+    output_mutex = xSemaphoreCreateMutexStatic(&output_mutex_buffer);
+    err = backend->write(channels, 0);
+    ESP_LOGI(TAG, "Antenna outputs on %s", backend->name);
+    return err;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "antenna_control.h"
+
+/**
+ * Hardware that drives the antenna outputs. A channel is a GPIO number for the
+ * GPIO backend and a bit position in the chain for the expander backends.
+ * write() clears and sets the given channels in as few bus writes as possible.
+ */
+typedef struct {
+    const char *name;
+    esp_err_t (*init)(uint64_t channels);
+    esp_err_t (*write)(uint64_t clear, uint64_t set);
+} antenna_output_backend_t;
+
+esp_err_t init_antenna_output(const antenna_table_t *table);
+void antenna_output_set(uint32_t antennas);
+uint32_t antenna_output_get();
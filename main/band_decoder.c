@@ -0,0 +1,283 @@
+#include "band_decoder.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "string.h"
+#include "antenna_control.h"
+#include "switch_trace.h"
+#include "cat_proxy.h"
+#include "power_save.h"
+#include "cat_capture.h"
+#include "heap_guard.h"
+
+static const char *TAG = "band_decoder";
+
+#define PATTERN_CHR_NUM    (1)
+
+#define RX_BUF_SIZE (1024)
+#define RD_BUF_SIZE (RX_BUF_SIZE)
+
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+/**
+ * State of one decoder instance, one per radio
+ */
+typedef struct {
+    band_decoder_config_t config;
+    QueueHandle_t uart_queue;
+    TaskHandle_t tx_task;
+    cat_parser_t parser;
+    uint32_t fifo_overflows;
+    uint32_t buffer_full;
+    uint8_t poll[CAT_POLL_MAX];
+    size_t poll_len;
+    uint8_t rx_buf[RD_BUF_SIZE];
+    StaticTask_t rx_tcb;
+    StackType_t rx_stack[2048];
+    StaticTask_t tx_tcb;
+    StackType_t tx_stack[2048];
+} band_decoder_t;
+
+static band_decoder_t decoders[CONFIG_RADIO_COUNT];
+static esp_timer_handle_t report_timer;
+
+static void tx_task(void *arg)
+{
+    const band_decoder_t *decoder = (const band_decoder_t*)arg;
+    const TickType_t reply_window = power_save_reply_window();
+    const TickType_t interval = decoder->config.poll_interval_ms / portTICK_PERIOD_MS;
+    while (1) {
+        power_save_stay_awake(true);
+        if(cat_proxy_active(decoder->config.radio)) {
+            // A logger shares the radio, the proxy fits the poll into its traffic
+            cat_proxy_send_poll(decoder->poll, decoder->poll_len);
+        } else {
+            uart_write_bytes(decoder->config.uart_num, decoder->poll, decoder->poll_len);
+        }
+        cat_capture_record(decoder->config.radio, CAPTURE_TX, decoder->poll, decoder->poll_len, esp_timer_get_time());
+        if(reply_window > 0) {
+            // Stay out of light sleep until the answer is in, the UART loses the bytes that wake the CPU
+            vTaskDelay(reply_window);
+        }
+        power_save_stay_awake(false);
+        // Wait for the next poll, the rx task cuts the wait short after an overflow
+        ulTaskNotifyTake(pdTRUE, interval > reply_window ? interval - reply_window : 0);
+    }
+}
+
+/**
+ * Read everything the UART driver has buffered and run it through the protocol parser.
+ * Every complete frame is passed on to the automode control task.
+ */
+static void read_frames(band_decoder_t *decoder, uint8_t *dtmp, int64_t detected_at)
+{
+    const uart_port_t uart_num = decoder->config.uart_num;
+    size_t buffered_size;
+    qrg_message_t message;
+    const bool proxy = cat_proxy_active(decoder->config.radio);
+
+    uart_get_buffered_data_len(uart_num, &buffered_size);
+    while(buffered_size > 0) {
+        int len = uart_read_bytes(uart_num, dtmp, buffered_size < RD_BUF_SIZE ? buffered_size : RD_BUF_SIZE, 0);
+        if(len <= 0) {
+            break;
+        }
+        buffered_size -= len;
+        cat_capture_record(decoder->config.radio, CAPTURE_RX, dtmp, len, detected_at);
+        if(proxy) {
+            cat_proxy_radio_data(dtmp, len, detected_at);
+        }
+        for(int i = 0; i < len; i++) {
+            if(cat_parser_feed(&decoder->parser, dtmp[i], &message.cat)) {
+                message.radio = decoder->config.radio;
+                message.trace_id = switch_trace_begin(detected_at);
+                switch_trace_mark(message.trace_id, TRACE_STAGE_FRAME_PARSED);
+                ESP_LOGD(TAG, "radio %u frame: %" PRIu32 " Hz tx %d mode %d", message.radio, message.cat.frequency, message.cat.tx, message.cat.mode);
+                if(xQueueSend(qrg_queue, &message, 0) != pdTRUE) {
+                    switch_trace_discard(message.trace_id);
+                }
+            }
+        }
+    }
+
+    // The parser finds the frame boundaries itself, positions of the patterns just read are not needed
+    while(uart_pattern_pop_pos(uart_num) != -1) {
+    }
+}
+
+static void rx_task(void *pvParameters)
+{
+    band_decoder_t *decoder = (band_decoder_t*)pvParameters;
+    const uart_port_t uart_num = decoder->config.uart_num;
+    uart_event_t event;
+    uint8_t* dtmp = decoder->rx_buf;
+    for (;;) {
+        //Waiting for UART event.
+        if (xQueueReceive(decoder->uart_queue, (void *)&event, (TickType_t)portMAX_DELAY)) {
+            ESP_LOGD(TAG, "uart[%d] event:", uart_num);
+            switch (event.type) {
+            //Event of UART receving data or of a frame terminator
+            /*We'd better handler data event fast, there would be much more data events than
+            other types of events. If we take too much time on data event, the queue might
+            be full.*/
+            case UART_DATA:
+            case UART_PATTERN_DET: {
+                const int64_t detected_at = esp_timer_get_time();
+                power_save_wake_handled(detected_at);
+                read_frames(decoder, dtmp, detected_at);
+                break;
+            }
+            //Event of HW FIFO overflow detected
+            case UART_FIFO_OVF:
+                // The ISR has already reset the rx FIFO, so bytes are missing after what is buffered.
+                // Keep the complete frames that are buffered. When they end in the middle of a frame,
+                // that frame lost bytes and is skipped up to its terminator. Poll right away to get the current state.
+                decoder->fifo_overflows++;
+                read_frames(decoder, dtmp, esp_timer_get_time());
+                cat_capture_record(decoder->config.radio, CAPTURE_OVERFLOW, NULL, 0, esp_timer_get_time());
+                cat_parser_resync(&decoder->parser);
+                xTaskNotifyGive(decoder->tx_task);
+                ESP_LOGW(TAG, "radio %u hw fifo overflow (overflows: %" PRIu32 ", resyncs: %" PRIu32 ")",
+                         decoder->config.radio, decoder->fifo_overflows, decoder->parser.resyncs);
+                break;
+            //Event of UART ring buffer full
+            case UART_BUFFER_FULL:
+                // The driver holds back the received data until there is room again, nothing is lost yet.
+                // Draining the buffer is enough, poll right away since the state read may be stale.
+                decoder->buffer_full++;
+                read_frames(decoder, dtmp, esp_timer_get_time());
+                xTaskNotifyGive(decoder->tx_task);
+                ESP_LOGW(TAG, "radio %u ring buffer full (count: %" PRIu32 ")", decoder->config.radio, decoder->buffer_full);
+                break;
+            //Event of UART RX break detected
+            case UART_BREAK:
+                ESP_LOGI(TAG, "uart rx break");
+                break;
+            //Event of UART parity check error
+            case UART_PARITY_ERR:
+                ESP_LOGI(TAG, "uart parity error");
+                break;
+            //Event of UART frame error
+            case UART_FRAME_ERR:
+                ESP_LOGI(TAG, "uart frame error");
+                break;
+            //Others
+            default:
+                ESP_LOGI(TAG, "uart event type: %d", event.type);
+                break;
+            }
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+/**
+ * Fill in the Kconfig defaults for the given radio
+ */
+void band_decoder_default_config(uint8_t radio, band_decoder_config_t *config)
+{
+    config->radio = radio;
+    config->protocol = &cat_protocol_kenwood;
+    config->address = 0;
+    config->baud_rate = cat_protocol_kenwood.default_baud_rate;
+    config->poll_interval_ms = CONFIG_CAT_POLL_INTERVAL_MS;
+#if CONFIG_POWER_SAVE
+    // One poll interval and the answer make the longest time until a band change is seen
+    config->poll_interval_ms = CONFIG_POWER_SAVE_MAX_LATENCY_MS - CONFIG_POWER_SAVE_REPLY_WINDOW_MS;
+#endif
+    if(radio == 0) {
+        config->uart_num = CONFIG_RADIO1_UART_NUM;
+        config->tx_pin = CONFIG_RADIO1_TX_PIN;
+        config->rx_pin = CONFIG_RADIO1_RX_PIN;
+    }
+#if CONFIG_RADIO_COUNT > 1
+    if(radio == 1) {
+        config->uart_num = CONFIG_RADIO2_UART_NUM;
+        config->tx_pin = CONFIG_RADIO2_TX_PIN;
+        config->rx_pin = CONFIG_RADIO2_RX_PIN;
+    }
+#endif
+}
+
+static void report_stats(void *arg)
+{
+    for(uint8_t r = 0; r < CONFIG_RADIO_COUNT; r++) {
+        if(decoders[r].tx_task == NULL) {
+            continue;
+        }
+        band_decoder_stats_t stats;
+        band_decoder_get_stats(r, &stats);
+        ESP_LOGI(TAG, "radio %u: %" PRIu32 " fifo overflows, %" PRIu32 " ring buffer full, %" PRIu32 " resyncs",
+                 r, stats.fifo_overflows, stats.buffer_full, stats.resyncs);
+    }
+}
+
+void init_band_decoder(const band_decoder_config_t *config)
+{
+    if(config->radio >= CONFIG_RADIO_COUNT) {
+        ESP_LOGE(TAG, "init_band_decoder invalid radio: %u", config->radio);
+        return;
+    }
+    band_decoder_t *decoder = &decoders[config->radio];
+    decoder->config = *config;
+    cat_parser_init(&decoder->parser, config->protocol, config->address);
+    decoder->poll_len = cat_parser_poll_request(&decoder->parser, decoder->poll, sizeof(decoder->poll));
+    cat_capture_add_radio(config);
+    const uart_port_t uart_num = config->uart_num;
+    ESP_LOGI(TAG, "Radio %u: %s protocol on UART %d at %d baud", config->radio, config->protocol->name, uart_num, config->baud_rate);
+
+    const uart_config_t uart_config = {
+        .baud_rate = config->baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    //Install UART driver, and get the queue.
+    uart_driver_install(uart_num, RX_BUF_SIZE * 2, 0, 20, &decoder->uart_queue, 0);
+    uart_param_config(uart_num, &uart_config);
+    ESP_ERROR_CHECK(uart_set_pin(uart_num, config->tx_pin, config->rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    //Set UART log level
+    esp_log_level_set(TAG, ESP_LOG_INFO);
+
+    //Set uart pattern detect function on the frame terminator so every frame is handled as soon as it is complete.
+    uart_enable_pattern_det_baud_intr(uart_num, config->protocol->terminator, PATTERN_CHR_NUM, 20, 0, 0);
+    
+    //Reset the pattern queue length to record at most 1 pattern positions.
+    uart_pattern_queue_reset(uart_num, 5);
+
+    //Create the tasks handling UART events and polling for this radio
+    char task_name[configMAX_TASK_NAME_LEN];
+    snprintf(task_name, sizeof(task_name), "rx_task_%u", config->radio);
+    heap_guard_watch(xTaskCreateStatic(rx_task, task_name, sizeof(decoder->rx_stack), decoder, 12,
+                                       decoder->rx_stack, &decoder->rx_tcb));
+    snprintf(task_name, sizeof(task_name), "tx_task_%u", config->radio);
+    decoder->tx_task = xTaskCreateStatic(tx_task, task_name, sizeof(decoder->tx_stack), decoder, configMAX_PRIORITIES - 2,
+                                         decoder->tx_stack, &decoder->tx_tcb);
+    heap_guard_watch(decoder->tx_task);
+
+    if(report_timer == NULL) {
+        const esp_timer_create_args_t report_args = {
+            .callback = report_stats,
+            .name = "decoder_report",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&report_args, &report_timer));
+        esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+    }
+}
+
+void band_decoder_get_stats(uint8_t radio, band_decoder_stats_t *stats)
+{
+    memset(stats, 0, sizeof(band_decoder_stats_t));
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+    stats->fifo_overflows = decoders[radio].fifo_overflows;
+    stats->buffer_full = decoders[radio].buffer_full;
+    stats->resyncs = decoders[radio].parser.resyncs;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include "cat_protocol.h"
+
+/**
+ * Settings of one band decoder instance, one instance per radio
+ */
+typedef struct {
+    uint8_t radio;
+    const cat_protocol_t *protocol;
+    uint8_t address;
+    int uart_num;
+    int tx_pin;
+    int rx_pin;
+    int baud_rate;
+    unsigned int poll_interval_ms;
+} band_decoder_config_t;
+
+/**
+ * Receive error counters of one decoder
+ */
+typedef struct {
+    uint32_t fifo_overflows;
+    uint32_t buffer_full;
+    uint32_t resyncs;
+} band_decoder_stats_t;
+
+void band_decoder_default_config(uint8_t radio, band_decoder_config_t *config);
+void init_band_decoder(const band_decoder_config_t *config);
+void band_decoder_get_stats(uint8_t radio, band_decoder_stats_t *stats);
@@ -0,0 +1,51 @@
+#include "band_plan.h"
+
+static const char* const AmateurBandStr[] =
+{
+    "160M",
+    "80M",
+    "60M",
+    "40M",
+    "30M",
+    "20M",
+    "17M",
+    "15M",
+    "10M",
+    "6M",
+    "UNKNOWN"
+};
+
+/**
+ * Band of a frequency in Hz, UNKNOWN outside the amateur bands
+ */
+enum AmateurBand hz_to_amateur_band(uint32_t qrg)
+{
+    if(qrg >= 1800000 && qrg <= 2000000) {
+        return _160M;
+    } else if(qrg >= 3500000 && qrg <= 3800000) {
+        return _80M;
+    } else if(qrg >= 5351500 && qrg <= 5366500) {
+        return _60M;
+    } else if(qrg >= 7000000 && qrg <= 7300000) {
+        return _40M;
+    } else if(qrg >= 10100000 && qrg <= 10150000) {
+        return _30M;
+    } else if(qrg >= 14000000 && qrg <= 14350000) {
+        return _20M;
+    } else if(qrg >= 18068000 && qrg <= 18168000) { 
+        return _17M;
+    } else if(qrg >= 21000000 && qrg <= 21450000) {
+        return _15M;
+    } else if(qrg >= 28000000 && qrg <= 29700000) {
+        return _10M;
+    } else if(qrg >= 50000000 && qrg <= 54000000) {
+        return _6M;
+    } else {
+        return UNKNOWN;
+    }
+}
+
+const char* amateur_band_str(int band)
+{
+    return band >= 0 && band < AMATEUR_BAND_COUNT ? AmateurBandStr[band] : AmateurBandStr[UNKNOWN];
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+enum AmateurBand 
+{
+    _160M,
+    _80M,
+    _60M,
+    _40M,
+    _30M,
+    _20M,
+    _17M,
+    _15M,
+    _10M,
+    _6M,
+    UNKNOWN
+};
+
+#define AMATEUR_BAND_COUNT ((int)UNKNOWN)
+
+enum AmateurBand hz_to_amateur_band(uint32_t qrg);
+const char* amateur_band_str(int band);
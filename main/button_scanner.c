@@ -0,0 +1,256 @@
+#include "button_scanner.h"
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "heap_guard.h"
+
+static const char *TAG = "button_scanner";
+
+#if CONFIG_POWER_SAVE
+/* Long enough for the CPU to reach light sleep between scans */
+#define SCAN_INTERVAL_MS CONFIG_POWER_SAVE_BUTTON_SCAN_MS
+#else
+#define SCAN_INTERVAL_MS CONFIG_BUTTON_SCAN_INTERVAL_MS
+#endif
+#define SCAN_INTERVAL_TICKS pdMS_TO_TICKS(SCAN_INTERVAL_MS)
+#define LONG_PRESS_SCANS (1500 / SCAN_INTERVAL_MS)
+#define MAX_CHANNELS 8
+
+/**
+ * One ADC channel with its resistor ladder. A single reading tells which of its
+ * buttons is pressed, at most one at a time.
+ */
+typedef struct {
+    adc_channel_t channel;
+    adc_cali_handle_t cali;         /* NULL when the chip has no calibration, raw values are used */
+    uint8_t button_count;
+    uint8_t antenna[MAX_ANTENNAS];  /* 1 based */
+    uint16_t min_mv[MAX_ANTENNAS];
+    uint16_t max_mv[MAX_ANTENNAS];
+    uint8_t candidate;              /* antenna the last readings fell in, 0 for none */
+    uint8_t stable_scans;
+    uint8_t pressed;                /* debounced antenna, 0 for none */
+} scan_channel_t;
+
+typedef enum {
+    GESTURE_IDLE,
+    GESTURE_PRESSED,
+    GESTURE_DONE,                   /* long press or combo fired, waiting for all buttons to be released */
+} gesture_state_t;
+
+static adc_oneshot_unit_handle_t adc_handle;
+static scan_channel_t channels[MAX_CHANNELS];
+static uint8_t channel_count;
+static button_gesture_cb_t gesture_cb;
+static gesture_state_t gesture_state;
+static uint8_t first_pressed;
+static uint32_t held_scans;
+static StaticTask_t scanner_tcb;
+static StackType_t scanner_stack[2048];
+
+static adc_cali_handle_t init_calibration(adc_channel_t channel)
+{
+    adc_cali_handle_t handle = NULL;
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    const adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1,
+        .chan = channel,
+        .atten = ADC_ATTEN_DB_11,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    err = adc_cali_create_scheme_curve_fitting(&cali_config, &handle);
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    const adc_cali_line_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTEN_DB_11,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    err = adc_cali_create_scheme_line_fitting(&cali_config, &handle);
+#endif
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "No ADC calibration for channel %d, button windows are compared to raw readings", channel);
+        return NULL;
+    }
+    return handle;
+}
+
+/**
+ * Oversampled reading of a channel in mV
+ */
+static int read_channel(const scan_channel_t *scan)
+{
+    int total = 0;
+    for(int i = 0; i < CONFIG_BUTTON_SCAN_OVERSAMPLE; i++) {
+        int raw = 0;
+        adc_oneshot_read(adc_handle, scan->channel, &raw);
+        total += raw;
+    }
+    const int raw = total / CONFIG_BUTTON_SCAN_OVERSAMPLE;
+    int voltage = raw;
+    if(scan->cali != NULL && adc_cali_raw_to_voltage(scan->cali, raw, &voltage) != ESP_OK) {
+        voltage = raw;
+    }
+    return voltage;
+}
+
+/**
+ * Classify a reading through the window table and debounce the result
+ */
+static void scan_channel(scan_channel_t *scan)
+{
+    const int voltage = read_channel(scan);
+    uint8_t antenna = 0;
+    for(uint8_t i = 0; i < scan->button_count; i++) {
+        if(voltage >= scan->min_mv[i] && voltage <= scan->max_mv[i]) {
+            antenna = scan->antenna[i];
+            break;
+        }
+    }
+
+    if(antenna != scan->candidate) {
+        scan->candidate = antenna;
+        scan->stable_scans = 0;
+    }
+    if(scan->stable_scans < CONFIG_BUTTON_DEBOUNCE_SCANS) {
+        scan->stable_scans++;
+        if(scan->stable_scans == CONFIG_BUTTON_DEBOUNCE_SCANS) {
+            scan->pressed = antenna;
+        }
+    }
+}
+
+/**
+ * One state machine for all buttons. A click fires on release, a long press while the
+ * button is held and a combo as soon as a second button joins the first.
+ */
+static void update_gesture()
+{
+    /* held is the first button while it is down, other a second one */
+    uint8_t held = 0;
+    uint8_t other = 0;
+    for(uint8_t c = 0; c < channel_count; c++) {
+        const uint8_t pressed = channels[c].pressed;
+        if(pressed == 0) {
+            continue;
+        }
+        if(held == 0 || pressed == first_pressed) {
+            other = held;
+            held = pressed;
+        } else {
+            other = pressed;
+        }
+    }
+
+    switch(gesture_state) {
+    case GESTURE_IDLE:
+        if(held != 0) {
+            first_pressed = held;
+            held_scans = 0;
+            gesture_state = GESTURE_PRESSED;
+        }
+        break;
+    case GESTURE_PRESSED:
+        if(held == 0) {
+            gesture_cb(BUTTON_GESTURE_CLICK, first_pressed, 0);
+            gesture_state = GESTURE_IDLE;
+        } else if(other != 0) {
+            gesture_cb(BUTTON_GESTURE_COMBO, held, other);
+            gesture_state = GESTURE_DONE;
+        } else if(held != first_pressed) {
+            // Slid to another button on the same ladder, that one counts
+            first_pressed = held;
+            held_scans = 0;
+        } else if(++held_scans >= LONG_PRESS_SCANS) {
+            gesture_cb(BUTTON_GESTURE_LONG_PRESS, first_pressed, 0);
+            gesture_state = GESTURE_DONE;
+        }
+        break;
+    case GESTURE_DONE:
+        if(held == 0) {
+            gesture_state = GESTURE_IDLE;
+        }
+        break;
+    }
+}
+
+static void button_scanner_task()
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    for(;;) {
+        vTaskDelayUntil(&last_wake, SCAN_INTERVAL_TICKS);
+        for(uint8_t c = 0; c < channel_count; c++) {
+            scan_channel(&channels[c]);
+        }
+        update_gesture();
+    }
+}
+
+static scan_channel_t* find_channel(adc_channel_t channel)
+{
+    for(uint8_t c = 0; c < channel_count; c++) {
+        if(channels[c].channel == channel) {
+            return &channels[c];
+        }
+    }
+    if(channel_count == MAX_CHANNELS) {
+        return NULL;
+    }
+    scan_channel_t *scan = &channels[channel_count++];
+    memset(scan, 0, sizeof(scan_channel_t));
+    scan->channel = channel;
+    return scan;
+}
+
+/**
+ * Scan the ADC buttons of the antenna table, windows are in mV. Every channel is read
+ * once per scan, whatever the number of buttons on it.
+ */
+void init_button_scanner(const antenna_table_t *table, button_gesture_cb_t callback)
+{
+    gesture_cb = callback;
+    for(unsigned int i = 0; i < table->count; i++) {
+        const antenna_def_t *antenna = &table->antennas[i];
+        if(antenna->adc_channel < 0) {
+            continue;
+        }
+        scan_channel_t *scan = find_channel(antenna->adc_channel);
+        if(scan == NULL) {
+            ESP_LOGE(TAG, "ANT%u: too many button channels", i + 1);
+            continue;
+        }
+        scan->antenna[scan->button_count] = i + 1;
+        scan->min_mv[scan->button_count] = antenna->adc_min;
+        scan->max_mv[scan->button_count] = antenna->adc_max;
+        scan->button_count++;
+    }
+    if(channel_count == 0) {
+        return;
+    }
+
+    const adc_oneshot_unit_init_cfg_t unit_config = {
+        .unit_id = ADC_UNIT_1,
+    };
+    esp_err_t err = adc_oneshot_new_unit(&unit_config, &adc_handle);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot open ADC unit 1 (%s)", esp_err_to_name(err));
+        return;
+    }
+    const adc_oneshot_chan_cfg_t channel_config = {
+        .atten = ADC_ATTEN_DB_11,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    for(uint8_t c = 0; c < channel_count; c++) {
+        adc_oneshot_config_channel(adc_handle, channels[c].channel, &channel_config);
+        channels[c].cali = init_calibration(channels[c].channel);
+    }
+
+    heap_guard_watch(xTaskCreateStatic(button_scanner_task, "button_scanner_task", sizeof(scanner_stack), NULL, 12,
+                                       scanner_stack, &scanner_tcb));
+    ESP_LOGI(TAG, "Scanning %u ADC channels every %d ms, %d conversions per channel", channel_count,
+             SCAN_INTERVAL_MS, CONFIG_BUTTON_SCAN_OVERSAMPLE);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "antenna_control.h"
+
+typedef enum {
+    BUTTON_GESTURE_CLICK,
+    BUTTON_GESTURE_LONG_PRESS,      /* fires while the button is still held */
+    BUTTON_GESTURE_COMBO,           /* two antenna buttons held together */
+} button_gesture_t;
+
+/**
+ * Called from the scanner task. Antennas count from 1, other is the second
+ * button of a combo and 0 for the other gestures.
+ */
+typedef void (*button_gesture_cb_t)(button_gesture_t gesture, unsigned int antenna, unsigned int other);
+
+void init_button_scanner(const antenna_table_t *table, button_gesture_cb_t callback);
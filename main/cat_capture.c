@@ -0,0 +1,138 @@
+#include "cat_capture.h"
+#include <string.h>
+#include "esp_log.h"
+
+#if CONFIG_CAT_CAPTURE
+
+#include <stdio.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "sd_log.h"
+
+static const char *TAG = "cat_capture";
+
+#define RING_SIZE (CONFIG_CAT_CAPTURE_RING_KB * 1024)
+#define MAX_INFO_LEN 24
+
+/* Start of every capture file, records follow */
+static const char file_magic[8] = { 'C', 'A', 'T', 'C', 'A', 'P', '1', '\n' };
+
+typedef struct __attribute__((packed)) {
+    int64_t time_us;
+    uint8_t radio;
+    uint8_t kind;
+    uint16_t len;
+} capture_header_t;
+
+/* Records as they will be written, the flush task copies them to the card unchanged */
+static uint8_t ring[RING_SIZE];
+
+/* Repeated at the start of every file so each one can be replayed on its own */
+static char radio_info[CONFIG_RADIO_COUNT][MAX_INFO_LEN];
+
+/**
+ * A new file starts with the radio info, stamped with the time of the first record
+ * that follows
+ */
+static int start_capture(int fd, const uint8_t *first)
+{
+    capture_header_t oldest;
+    if(first != NULL) {
+        memcpy(&oldest, first, sizeof(oldest));
+    } else {
+        oldest.time_us = esp_timer_get_time();
+    }
+
+    int size = write(fd, file_magic, sizeof(file_magic));
+    for(uint8_t radio = 0; radio < CONFIG_RADIO_COUNT && size >= 0; radio++) {
+        const size_t len = strlen(radio_info[radio]);
+        if(len == 0) {
+            continue;
+        }
+        const capture_header_t header = { oldest.time_us, radio, CAPTURE_INFO, len };
+        if(write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || write(fd, radio_info[radio], len) != (ssize_t)len) {
+            return -1;
+        }
+        size += sizeof(header) + len;
+    }
+    return size;
+}
+
+static void report_stats()
+{
+    cat_capture_stats_t stats;
+    cat_capture_get_stats(&stats);
+    ESP_LOGI(TAG, "%" PRIu32 " records, %" PRIu32 " bytes, %" PRIu32 " dropped; %" PRIu32 " flushes, max %" PRId64 "us, %" PRIu32 " rotations, %" PRIu32 " write errors",
+             stats.records, stats.bytes, stats.dropped, stats.flushes, stats.flush_max_us, stats.rotations, stats.write_errors);
+}
+
+static sd_log_t capture_log = {
+    .name = "cat",
+    .ext = "cap",
+    .ring = ring,
+    .ring_size = sizeof(ring),
+    .max_file_bytes = (int32_t)CONFIG_CAT_CAPTURE_MAX_FILE_KB * 1024,
+    .files = CONFIG_CAT_CAPTURE_FILES,
+    .flush_interval_ms = CONFIG_CAT_CAPTURE_FLUSH_INTERVAL_MS,
+    .start_file = start_capture,
+    .report = report_stats,
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+/**
+ * Queue a record. Called from the band decoder tasks, copies the bytes into the RAM
+ * ring under a spinlock. Records are dropped and counted when the ring is full.
+ */
+void cat_capture_record(uint8_t radio, cat_capture_kind_t kind, const uint8_t *data, size_t len, int64_t time_us)
+{
+    const capture_header_t header = { time_us, radio, kind, len };
+    sd_log_queue(&capture_log, &header, sizeof(header), data, len);
+}
+
+/**
+ * Record the protocol and baud rate of a radio, the replay needs them to feed the bytes back
+ */
+void cat_capture_add_radio(const band_decoder_config_t *config)
+{
+    if(config->radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+    char *info = radio_info[config->radio];
+    snprintf(info, MAX_INFO_LEN, "%s %d", config->protocol->name, config->baud_rate);
+    cat_capture_record(config->radio, CAPTURE_INFO, (const uint8_t*)info, strlen(info), esp_timer_get_time());
+}
+
+void cat_capture_get_stats(cat_capture_stats_t *stats)
+{
+    sd_log_stats_t log_stats;
+    sd_log_get_stats(&capture_log, &log_stats);
+    stats->records = log_stats.records;
+    stats->bytes = log_stats.bytes_queued;
+    stats->dropped = log_stats.dropped;
+    stats->flushes = log_stats.flushes;
+    stats->rotations = log_stats.rotations;
+    stats->write_errors = log_stats.write_errors;
+    stats->flush_max_us = log_stats.flush_max_us;
+}
+
+/**
+ * Start capturing to the mounted SD card, which then stays mounted. Must run
+ * before the band decoders are started.
+ */
+bool init_cat_capture()
+{
+    if(!sd_log_start(&capture_log, "capture_task")) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Capturing CAT traffic to the SD card, %d KB in RAM", CONFIG_CAT_CAPTURE_RING_KB);
+    return true;
+}
+
+#else
+
+bool init_cat_capture() { return false; }
+void cat_capture_add_radio(const band_decoder_config_t *config) {}
+void cat_capture_record(uint8_t radio, cat_capture_kind_t kind, const uint8_t *data, size_t len, int64_t time_us) {}
+void cat_capture_get_stats(cat_capture_stats_t *stats) { memset(stats, 0, sizeof(cat_capture_stats_t)); }
+
+#endif
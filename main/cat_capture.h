@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "band_decoder.h"
+
+/**
+ * Kinds of capture records. Every record is a 12 byte header, little endian
+ * int64 time in microseconds since boot, radio, kind, uint16 length, then the bytes.
+ */
+typedef enum {
+    CAPTURE_RX,             /* bytes read from the radio, all stamped with the UART event time */
+    CAPTURE_TX,             /* poll sent to the radio */
+    CAPTURE_OVERFLOW,       /* the FIFO overflowed, bytes are missing before the next record */
+    CAPTURE_INFO,           /* "<protocol> <baud rate>" of the radio */
+} cat_capture_kind_t;
+
+typedef struct {
+    uint32_t records;
+    uint32_t bytes;         /* queued, record headers included */
+    uint32_t dropped;       /* records lost because the ring was full */
+    uint32_t flushes;
+    uint32_t rotations;
+    uint32_t write_errors;
+    int64_t flush_max_us;
+} cat_capture_stats_t;
+
+bool init_cat_capture();
+void cat_capture_add_radio(const band_decoder_config_t *config);
+void cat_capture_record(uint8_t radio, cat_capture_kind_t kind, const uint8_t *data, size_t len, int64_t time_us);
+void cat_capture_get_stats(cat_capture_stats_t *stats);
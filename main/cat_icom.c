@@ -0,0 +1,136 @@
+#include "cat_protocol.h"
+
+/*
+ * Icom CI-V. Frames are FE FE <to> <from> <cmd> [sub] [data] FD, the
+ * frequency is 5 BCD bytes, least significant byte first.
+ */
+
+#define CIV_PREAMBLE 0xFE
+#define CIV_TERMINATOR 0xFD
+#define CIV_CONTROLLER 0xE0
+#define CIV_BROADCAST 0x00
+#define CIV_DEFAULT_ADDRESS 0x94
+
+typedef enum {
+    CIV_FIELD_FREQUENCY,
+    CIV_FIELD_MODE,
+    CIV_FIELD_TX,
+} civ_field_t;
+
+typedef struct {
+    uint8_t command;
+    int16_t sub_command;    /* -1 when the command has none */
+    civ_field_t field;
+} civ_frame_t;
+
+static const civ_frame_t civ_frames[] = {
+    { 0x00, -1, CIV_FIELD_FREQUENCY },  /* transceive frequency */
+    { 0x03, -1, CIV_FIELD_FREQUENCY },  /* read frequency */
+    { 0x01, -1, CIV_FIELD_MODE },       /* transceive mode */
+    { 0x04, -1, CIV_FIELD_MODE },       /* read mode */
+    { 0x1C, 0x00, CIV_FIELD_TX },       /* read transmit state */
+};
+
+static const int8_t civ_modes[] = {
+    CAT_MODE_LSB, CAT_MODE_USB, CAT_MODE_AM, CAT_MODE_CW, CAT_MODE_RTTY, CAT_MODE_FM, CAT_MODE_FM, CAT_MODE_CW_R, CAT_MODE_RTTY_R
+};
+
+static uint8_t civ_address(const cat_parser_t *parser)
+{
+    return parser->address != 0 ? parser->address : CIV_DEFAULT_ADDRESS;
+}
+
+static size_t civ_poll_request(const cat_parser_t *parser, uint8_t *buf, size_t size)
+{
+    const uint8_t address = civ_address(parser);
+    const uint8_t poll[] = {
+        CIV_PREAMBLE, CIV_PREAMBLE, address, CIV_CONTROLLER, 0x03, CIV_TERMINATOR,
+        CIV_PREAMBLE, CIV_PREAMBLE, address, CIV_CONTROLLER, 0x1C, 0x00, CIV_TERMINATOR,
+    };
+    if(sizeof(poll) > size) {
+        return 0;
+    }
+    for(size_t i = 0; i < sizeof(poll); i++) {
+        buf[i] = poll[i];
+    }
+    return sizeof(poll);
+}
+
+static bool civ_bcd_frequency(const uint8_t *data, size_t len, uint32_t *frequency)
+{
+    uint32_t value = 0;
+    for(size_t i = len; i > 0; i--) {
+        uint8_t high = data[i - 1] >> 4;
+        uint8_t low = data[i - 1] & 0x0F;
+        if(high > 9 || low > 9) {
+            return false;
+        }
+        value = value * 100 + high * 10 + low;
+    }
+    *frequency = value;
+    return true;
+}
+
+/**
+ * Parse a frame without its terminator. Line noise in front of the last
+ * preamble is skipped, frames not sent by our radio to us are ignored. That
+ * includes the echo of our own polls on a single wire CI-V bus.
+ */
+static bool civ_parse_frame(const cat_parser_t *parser, const uint8_t *frame, size_t len, cat_event_t *event)
+{
+    size_t start = len;
+    for(size_t i = 0; i + 1 < len; i++) {
+        if(frame[i] == CIV_PREAMBLE && frame[i + 1] == CIV_PREAMBLE && (i + 2 >= len || frame[i + 2] != CIV_PREAMBLE)) {
+            start = i + 2;
+        }
+    }
+    if(start + 3 > len) {
+        return false;
+    }
+
+    const uint8_t to = frame[start];
+    const uint8_t from = frame[start + 1];
+    const uint8_t command = frame[start + 2];
+    if((to != CIV_CONTROLLER && to != CIV_BROADCAST) || from != civ_address(parser)) {
+        return false;
+    }
+
+    for(size_t i = 0; i < sizeof(civ_frames) / sizeof(civ_frames[0]); i++) {
+        const civ_frame_t *layout = &civ_frames[i];
+        if(layout->command != command) {
+            continue;
+        }
+        size_t data = start + 3;
+        if(layout->sub_command >= 0) {
+            if(data >= len || frame[data] != layout->sub_command) {
+                continue;
+            }
+            data++;
+        }
+        const size_t data_len = len - data;
+
+        switch(layout->field) {
+        case CIV_FIELD_FREQUENCY:
+            /* Older radios report 4 bytes, current ones 5 */
+            if(data_len != 4 && data_len != 5) {
+                return false;
+            }
+            return civ_bcd_frequency(&frame[data], data_len, &event->frequency);
+        case CIV_FIELD_MODE:
+            if(data_len < 1) {
+                return false;
+            }
+            event->mode = frame[data] < sizeof(civ_modes) ? civ_modes[frame[data]] : CAT_MODE_UNKNOWN;
+            return true;
+        case CIV_FIELD_TX:
+            if(data_len != 1) {
+                return false;
+            }
+            event->tx = frame[data] != 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+const cat_protocol_t cat_protocol_icom = { "icom", CIV_TERMINATOR, 19200, civ_poll_request, civ_parse_frame, NULL };
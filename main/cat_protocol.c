@@ -0,0 +1,232 @@
+#include "cat_protocol.h"
+#include <string.h>
+#include <strings.h>
+
+/**
+ * Layout of one text frame, offsets are relative to the start of the prefix.
+ * Offsets of fields the frame does not carry are -1.
+ */
+typedef struct {
+    const char *prefix;
+    uint8_t length;         /* frame length without the terminator */
+    int8_t freq_offset;
+    uint8_t freq_digits;
+    int8_t tx_offset;       /* digit, anything but '0' means transmitting */
+    int8_t tx_fixed;        /* tx state implied by the frame itself, -1 if none */
+    int8_t mode_offset;     /* hex digit, translated through the mode map */
+    int8_t vfo_offset;
+    int8_t split_offset;
+} cat_text_frame_t;
+
+typedef struct {
+    const cat_text_frame_t *frames;
+    size_t frame_count;
+    const char *poll;
+    const int8_t *mode_map; /* 16 entries, indexed by the mode digit */
+} cat_text_table_t;
+
+static const int8_t kenwood_modes[16] = {
+    CAT_MODE_UNKNOWN, CAT_MODE_LSB, CAT_MODE_USB, CAT_MODE_CW, CAT_MODE_FM, CAT_MODE_AM, CAT_MODE_RTTY, CAT_MODE_CW_R,
+    CAT_MODE_UNKNOWN, CAT_MODE_RTTY_R, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN
+};
+
+static const int8_t elecraft_modes[16] = {
+    CAT_MODE_UNKNOWN, CAT_MODE_LSB, CAT_MODE_USB, CAT_MODE_CW, CAT_MODE_FM, CAT_MODE_AM, CAT_MODE_DATA, CAT_MODE_CW_R,
+    CAT_MODE_UNKNOWN, CAT_MODE_DATA, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN, CAT_MODE_UNKNOWN
+};
+
+static const int8_t yaesu_modes[16] = {
+    CAT_MODE_UNKNOWN, CAT_MODE_LSB, CAT_MODE_USB, CAT_MODE_CW, CAT_MODE_FM, CAT_MODE_AM, CAT_MODE_RTTY, CAT_MODE_CW_R,
+    CAT_MODE_DATA, CAT_MODE_RTTY_R, CAT_MODE_DATA, CAT_MODE_FM, CAT_MODE_DATA, CAT_MODE_AM, CAT_MODE_FM, CAT_MODE_UNKNOWN
+};
+
+/* IF answer: IF[freq 11][5 spaces][rit 5][rit][xit][bank][ch 2][tx][mode][vfo][scan][split][tone][tone nr 2][0] */
+#define KENWOOD_IF_FRAME { "IF", 37, 2, 11, 28, -1, 29, 30, 32 }
+
+static const cat_text_frame_t kenwood_frames[] = {
+    KENWOOD_IF_FRAME,
+    { "FA", 13, 2, 11, -1, -1, -1, -1, -1 },
+    { "TX", 3, -1, 0, -1, 1, -1, -1, -1 },
+    { "RX", 2, -1, 0, -1, 0, -1, -1, -1 },
+};
+
+/* Yaesu IF answer: IF[ch 3][freq 9][clar 5][rx clar][tx clar][mode][vfo][ctcss][00][shift] */
+static const cat_text_frame_t yaesu_frames[] = {
+    { "IF", 27, 5, 9, -1, -1, 21, 22, -1 },
+    { "FA", 11, 2, 9, -1, -1, -1, -1, -1 },
+    { "TX", 3, -1, 0, 2, -1, -1, -1, -1 },
+};
+
+static const cat_text_frame_t flex_frames[] = {
+    KENWOOD_IF_FRAME,
+    { "ZZFA", 15, 4, 11, -1, -1, -1, -1, -1 },
+    { "ZZTX", 5, -1, 0, 4, -1, -1, -1, -1 },
+};
+
+static const cat_text_table_t kenwood_table = { kenwood_frames, sizeof(kenwood_frames) / sizeof(kenwood_frames[0]), "IF;", kenwood_modes };
+static const cat_text_table_t elecraft_table = { kenwood_frames, sizeof(kenwood_frames) / sizeof(kenwood_frames[0]), "IF;", elecraft_modes };
+static const cat_text_table_t yaesu_table = { yaesu_frames, sizeof(yaesu_frames) / sizeof(yaesu_frames[0]), "IF;TX;", yaesu_modes };
+static const cat_text_table_t flex_table = { flex_frames, sizeof(flex_frames) / sizeof(flex_frames[0]), "ZZFA;ZZTX;", kenwood_modes };
+
+static int hex_digit(uint8_t c)
+{
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static size_t text_poll_request(const cat_parser_t *parser, uint8_t *buf, size_t size)
+{
+    const cat_text_table_t *table = parser->protocol->table;
+    size_t len = strlen(table->poll);
+    if(len > size) {
+        return 0;
+    }
+    memcpy(buf, table->poll, len);
+    return len;
+}
+
+/**
+ * Match the end of the frame against the known layouts. Anything in front of a
+ * layout's prefix is line noise and is skipped.
+ */
+static bool text_parse_frame(const cat_parser_t *parser, const uint8_t *frame, size_t len, cat_event_t *event)
+{
+    const cat_text_table_t *table = parser->protocol->table;
+    for(size_t i = 0; i < table->frame_count; i++) {
+        const cat_text_frame_t *layout = &table->frames[i];
+        if(len < layout->length) {
+            continue;
+        }
+        const uint8_t *start = frame + len - layout->length;
+        size_t prefix_len = strlen(layout->prefix);
+        if(memcmp(start, layout->prefix, prefix_len) != 0) {
+            continue;
+        }
+
+        uint32_t frequency = 0;
+        bool valid = true;
+        for(uint8_t d = 0; d < layout->freq_digits; d++) {
+            uint8_t c = start[layout->freq_offset + d];
+            if(c < '0' || c > '9') {
+                valid = false;
+                break;
+            }
+            frequency = frequency * 10 + (c - '0');
+        }
+        if(!valid) {
+            return false;
+        }
+        event->frequency = frequency;
+
+        if(layout->tx_offset >= 0) {
+            event->tx = start[layout->tx_offset] != '0';
+        } else {
+            event->tx = layout->tx_fixed;
+        }
+        if(layout->mode_offset >= 0) {
+            int mode = hex_digit(start[layout->mode_offset]);
+            event->mode = mode >= 0 ? table->mode_map[mode] : CAT_MODE_UNKNOWN;
+        }
+        if(layout->vfo_offset >= 0) {
+            event->vfo = hex_digit(start[layout->vfo_offset]);
+        }
+        if(layout->split_offset >= 0) {
+            event->split = start[layout->split_offset] != '0';
+        }
+        return true;
+    }
+    return false;
+}
+
+const cat_protocol_t cat_protocol_kenwood = { "kenwood", ';', 57600, text_poll_request, text_parse_frame, &kenwood_table };
+const cat_protocol_t cat_protocol_elecraft = { "elecraft", ';', 38400, text_poll_request, text_parse_frame, &elecraft_table };
+const cat_protocol_t cat_protocol_yaesu = { "yaesu", ';', 38400, text_poll_request, text_parse_frame, &yaesu_table };
+const cat_protocol_t cat_protocol_flex = { "flex", ';', 115200, text_poll_request, text_parse_frame, &flex_table };
+
+static const cat_protocol_t* const protocols[] = {
+    &cat_protocol_kenwood,
+    &cat_protocol_elecraft,
+    &cat_protocol_yaesu,
+    &cat_protocol_flex,
+    &cat_protocol_icom,
+};
+
+/**
+ * Look up a backend by name, NULL if it does not exist
+ */
+const cat_protocol_t* cat_protocol_find(const char *name)
+{
+    for(size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+        if(strcasecmp(protocols[i]->name, name) == 0) {
+            return protocols[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Prepare the framing state for a link. The address is only used by
+ * addressed protocols like CI-V.
+ */
+void cat_parser_init(cat_parser_t *parser, const cat_protocol_t *protocol, uint8_t address)
+{
+    memset(parser, 0, sizeof(cat_parser_t));
+    parser->protocol = protocol;
+    parser->address = address;
+}
+
+/**
+ * Drop the partial frame and ignore everything up to the next terminator. At a
+ * frame boundary nothing is dropped, the next frame is complete.
+ */
+void cat_parser_resync(cat_parser_t *parser)
+{
+    if(parser->len == 0) {
+        return;
+    }
+    parser->len = 0;
+    parser->discarding = true;
+    parser->resyncs++;
+}
+
+size_t cat_parser_poll_request(const cat_parser_t *parser, uint8_t *buf, size_t size)
+{
+    return parser->protocol->poll_request(parser, buf, size);
+}
+
+/**
+ * Feed one received byte. Returns true when it completed a valid frame, the
+ * radio state it carried is then in event.
+ */
+bool cat_parser_feed(cat_parser_t *parser, uint8_t byte, cat_event_t *event)
+{
+    if(byte == parser->protocol->terminator) {
+        size_t len = parser->len;
+        bool discarding = parser->discarding;
+        parser->len = 0;
+        parser->discarding = false;
+        if(discarding || len == 0) {
+            return false;
+        }
+        event->frequency = 0;
+        event->tx = -1;
+        event->mode = CAT_MODE_UNKNOWN;
+        event->vfo = -1;
+        event->split = -1;
+        return parser->protocol->parse_frame(parser, parser->frame, len, event);
+    }
+
+    if(parser->discarding) {
+        return false;
+    }
+    if(parser->len >= CAT_FRAME_MAX - 1) {
+        cat_parser_resync(parser);
+        return false;
+    }
+    parser->frame[parser->len++] = byte;
+    return false;
+}
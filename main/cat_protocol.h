@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Protocol independent operating modes
+ */
+typedef enum {
+    CAT_MODE_UNKNOWN = -1,
+    CAT_MODE_LSB,
+    CAT_MODE_USB,
+    CAT_MODE_CW,
+    CAT_MODE_CW_R,
+    CAT_MODE_FM,
+    CAT_MODE_AM,
+    CAT_MODE_RTTY,
+    CAT_MODE_RTTY_R,
+    CAT_MODE_DATA,
+} cat_mode_t;
+
+/**
+ * Radio state reported by a single CAT frame. Fields the frame does not carry
+ * are 0 for the frequency and -1 for the others.
+ */
+typedef struct {
+    uint32_t frequency;
+    int8_t tx;
+    int8_t mode;
+    int8_t vfo;
+    int8_t split;
+} cat_event_t;
+
+/* Longest frame a backend accepts, including the terminator */
+#define CAT_FRAME_MAX 48
+
+/* Longest poll request a backend builds */
+#define CAT_POLL_MAX 16
+
+struct cat_protocol;
+
+/**
+ * Framing state of one CAT link. Owned by the caller, the backends keep no state.
+ */
+typedef struct {
+    const struct cat_protocol *protocol;
+    uint8_t address;
+    uint8_t len;
+    bool discarding;
+    uint32_t resyncs;
+    uint8_t frame[CAT_FRAME_MAX];
+} cat_parser_t;
+
+/**
+ * A CAT protocol backend
+ */
+typedef struct cat_protocol {
+    const char *name;
+    uint8_t terminator;
+    int default_baud_rate;
+    size_t (*poll_request)(const cat_parser_t *parser, uint8_t *buf, size_t size);
+    bool (*parse_frame)(const cat_parser_t *parser, const uint8_t *frame, size_t len, cat_event_t *event);
+    const void *table;
+} cat_protocol_t;
+
+extern const cat_protocol_t cat_protocol_kenwood;
+extern const cat_protocol_t cat_protocol_elecraft;
+extern const cat_protocol_t cat_protocol_yaesu;
+extern const cat_protocol_t cat_protocol_flex;
+extern const cat_protocol_t cat_protocol_icom;
+
+const cat_protocol_t* cat_protocol_find(const char *name);
+void cat_parser_init(cat_parser_t *parser, const cat_protocol_t *protocol, uint8_t address);
+void cat_parser_resync(cat_parser_t *parser);
+size_t cat_parser_poll_request(const cat_parser_t *parser, uint8_t *buf, size_t size);
+bool cat_parser_feed(cat_parser_t *parser, uint8_t byte, cat_event_t *event);
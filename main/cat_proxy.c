@@ -0,0 +1,537 @@
+#include "cat_proxy.h"
+#include <string.h>
+#include "esp_log.h"
+
+#if CONFIG_CAT_PROXY
+
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "heap_guard.h"
+
+static const char *TAG = "cat_proxy";
+
+/* The logger shares radio 1 */
+#define PROXY_RADIO 0
+
+#define RX_BUF_SIZE (512)
+#define TX_BUF_SIZE (512)
+#define OUT_BUF_SIZE (128)
+#define MAX_POLL_REPLIES 4
+
+#define IDLE_GAP_US ((int64_t)CONFIG_CAT_PROXY_IDLE_GAP_MS * 1000)
+#define REPLY_TIMEOUT_US ((int64_t)CONFIG_CAT_PROXY_REPLY_TIMEOUT_MS * 1000)
+#define CACHE_AGE_US ((int64_t)CONFIG_CAT_PROXY_CACHE_MS * 1000)
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+/**
+ * The radio's last answer to a query loggers repeat all the time
+ */
+typedef struct {
+    const char *query;
+    const char *answer;     /* prefix of the answer frame */
+    uint8_t frame[CAT_FRAME_MAX];
+    size_t len;             /* including the terminator, 0 when there is none */
+    int64_t received_at;
+} cache_entry_t;
+
+static cache_entry_t cache[] = {
+    { .query = "IF;", .answer = "IF" },
+    { .query = "FA;", .answer = "FA" },
+};
+#define CACHE_COUNT (sizeof(cache) / sizeof(cache[0]))
+
+/**
+ * Bytes on their way to one port, written out in as few calls as possible
+ */
+typedef struct {
+    uart_port_t uart_num;
+    size_t len;
+    uint32_t written;
+    uint8_t data[OUT_BUF_SIZE];
+} out_buffer_t;
+
+static bool active;
+static band_decoder_config_t radio_config;
+static uint8_t terminator;
+static QueueHandle_t logger_queue;
+static cat_proxy_stats_t proxy_stats;
+static portMUX_TYPE proxy_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Held while writing to the radio, so the client's polls go out between the logger's commands */
+static SemaphoreHandle_t radio_write_lock;
+static StaticSemaphore_t radio_write_lock_buffer;
+/* Held while writing to the logger, so cached answers go out between the radio's frames */
+static SemaphoreHandle_t logger_write_lock;
+static StaticSemaphore_t logger_write_lock_buffer;
+
+/* Only used by the logger task */
+static uint8_t logger_buf[RX_BUF_SIZE];
+static StaticTask_t logger_tcb;
+static StackType_t logger_stack[3072];
+
+/* Answer prefixes of the client's poll, in the order the radio sends them */
+static char poll_replies[MAX_POLL_REPLIES][CAT_POLL_MAX];
+static int poll_reply_count;
+
+/* Shared between the tasks, under proxy_lock */
+static int replies_pending;     /* answers to the client's poll still to come */
+static int next_reply;
+static int64_t poll_sent_at;
+static int64_t state_at;        /* last answer to the poll's query the logger caused or the radio sent by itself */
+static bool logger_waiting;
+static int64_t logger_query_at;
+static int64_t logger_byte_at;
+
+/* Logger to radio, under radio_write_lock */
+static uint8_t command[CAT_FRAME_MAX];
+static size_t command_len;
+static bool command_streaming;  /* not a cached query, passed on as it arrives */
+static bool command_sets;       /* carries parameters and may change the radio's state */
+static out_buffer_t radio_out;
+
+/* Radio to logger, under logger_write_lock */
+static uint8_t frame[CAT_FRAME_MAX];
+static size_t frame_len;
+static bool frame_held;         /* may answer the client's poll, passed on at the terminator if it does not */
+static bool frame_overlong;
+static out_buffer_t logger_out;
+
+static void out_flush(out_buffer_t *out)
+{
+    if(out->len > 0) {
+        uart_write_bytes(out->uart_num, out->data, out->len);
+        out->written += out->len;
+        out->len = 0;
+    }
+}
+
+static void out_append(out_buffer_t *out, const uint8_t *data, size_t len)
+{
+    if(out->len + len > sizeof(out->data)) {
+        out_flush(out);
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+static void record_latency(uint32_t *count, int64_t *max, int64_t *total, int64_t latency)
+{
+    (*count)++;
+    *total += latency;
+    if(latency > *max) {
+        *max = latency;
+    }
+}
+
+static bool frame_starts_with(const char *prefix)
+{
+    const size_t prefix_len = strlen(prefix);
+    return !frame_overlong && frame_len > prefix_len && memcmp(frame, prefix, prefix_len) == 0;
+}
+
+/**
+ * Whether the client's poll still has answers coming, they are given up after the reply timeout
+ */
+static bool poll_reply_expected_locked(int64_t now)
+{
+    if(replies_pending > 0 && now - poll_sent_at > REPLY_TIMEOUT_US) {
+        replies_pending = 0;
+    }
+    return replies_pending > 0;
+}
+
+/**
+ * A complete frame from the radio. Returns true when it answers the client's poll,
+ * those are kept from the logger.
+ */
+static bool radio_frame_done(int64_t now)
+{
+    bool hide = false;
+    portENTER_CRITICAL(&proxy_lock);
+    for(size_t i = 0; i < CACHE_COUNT; i++) {
+        if(frame_starts_with(cache[i].answer)) {
+            memcpy(cache[i].frame, frame, frame_len);
+            cache[i].len = frame_len;
+            cache[i].received_at = now;
+        }
+    }
+    if(frame_held && poll_reply_expected_locked(now) && frame_starts_with(poll_replies[next_reply])) {
+        next_reply++;
+        replies_pending--;
+        proxy_stats.replies_hidden++;
+        hide = true;
+    } else {
+        logger_waiting = false;
+        if(frame_starts_with(poll_replies[0])) {
+            state_at = now;
+        }
+    }
+    portEXIT_CRITICAL(&proxy_lock);
+    return hide;
+}
+
+/**
+ * Pass what the radio sent on to the logger, called by the band decoder with every
+ * chunk it reads. Bytes go out as they arrive, only frames that may answer the
+ * client's poll are held until their terminator.
+ */
+void cat_proxy_radio_data(const uint8_t *data, size_t len, int64_t received_at)
+{
+    xSemaphoreTake(logger_write_lock, portMAX_DELAY);
+    logger_out.written = 0;
+    for(size_t i = 0; i < len; i++) {
+        const uint8_t byte = data[i];
+        if(frame_len == 0 && !frame_overlong) {
+            portENTER_CRITICAL(&proxy_lock);
+            frame_held = poll_reply_expected_locked(received_at);
+            portEXIT_CRITICAL(&proxy_lock);
+        }
+
+        if(frame_len < CAT_FRAME_MAX) {
+            frame[frame_len++] = byte;
+        } else if(!frame_overlong) {
+            // Too long for an answer to the poll
+            frame_overlong = true;
+            if(frame_held) {
+                out_append(&logger_out, frame, frame_len);
+                frame_held = false;
+            }
+        }
+        if(!frame_held) {
+            out_append(&logger_out, &byte, 1);
+        }
+
+        if(byte == terminator) {
+            if(!radio_frame_done(received_at) && frame_held) {
+                out_append(&logger_out, frame, frame_len);
+            }
+            frame_len = 0;
+            frame_held = false;
+            frame_overlong = false;
+        }
+    }
+    out_flush(&logger_out);
+    const uint32_t written = logger_out.written;
+    xSemaphoreGive(logger_write_lock);
+
+    if(written > 0) {
+        portENTER_CRITICAL(&proxy_lock);
+        proxy_stats.radio_bytes += written;
+        record_latency(&proxy_stats.radio_latency_count, &proxy_stats.radio_latency_max_us,
+                       &proxy_stats.radio_latency_total_us, esp_timer_get_time() - received_at);
+        portEXIT_CRITICAL(&proxy_lock);
+    }
+}
+
+/**
+ * Answer a query of the logger from the cache. Only done between the radio's frames
+ * and while the answer is younger than CAT_PROXY_CACHE_MS.
+ */
+static bool answer_from_cache(cache_entry_t *entry, int64_t now)
+{
+    uint8_t answer[CAT_FRAME_MAX];
+    size_t len = 0;
+
+    xSemaphoreTake(logger_write_lock, portMAX_DELAY);
+    portENTER_CRITICAL(&proxy_lock);
+    if(frame_len == 0 && !frame_overlong && entry->len > 0 && now - entry->received_at <= CACHE_AGE_US) {
+        len = entry->len;
+        memcpy(answer, entry->frame, len);
+        proxy_stats.cache_hits++;
+    } else {
+        proxy_stats.cache_misses++;
+    }
+    portEXIT_CRITICAL(&proxy_lock);
+    if(len > 0) {
+        uart_write_bytes(logger_out.uart_num, answer, len);
+    }
+    xSemaphoreGive(logger_write_lock);
+    return len > 0;
+}
+
+/**
+ * The cache entry of the query the logger's command is so far, NULL when it will not be one
+ */
+static cache_entry_t* cached_query()
+{
+    if(CACHE_AGE_US == 0) {
+        return NULL;
+    }
+    for(size_t i = 0; i < CACHE_COUNT; i++) {
+        if(command_len <= strlen(cache[i].query) && memcmp(command, cache[i].query, command_len) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * A command of the logger went to the radio. Queries keep the client from polling
+ * until they are answered, anything with parameters empties the cache.
+ */
+static void command_done(bool sets, int64_t now)
+{
+    portENTER_CRITICAL(&proxy_lock);
+    if(sets) {
+        for(size_t i = 0; i < CACHE_COUNT; i++) {
+            cache[i].len = 0;
+        }
+    } else {
+        logger_waiting = true;
+        logger_query_at = now;
+    }
+    portEXIT_CRITICAL(&proxy_lock);
+}
+
+static void logger_data(const uint8_t *data, size_t len, int64_t received_at)
+{
+    xSemaphoreTake(radio_write_lock, portMAX_DELAY);
+    radio_out.written = 0;
+    for(size_t i = 0; i < len; i++) {
+        const uint8_t byte = data[i];
+        if(!command_streaming) {
+            command[command_len++] = byte;
+            cache_entry_t *entry = cached_query();
+            if(entry != NULL) {
+                if(byte == terminator) {
+                    if(!answer_from_cache(entry, received_at)) {
+                        out_append(&radio_out, command, command_len);
+                        command_done(false, received_at);
+                    }
+                    command_len = 0;
+                }
+                continue;
+            }
+            // Not a cached query, what was held back goes out and the rest as it arrives
+            out_append(&radio_out, command, command_len - 1);
+            command_streaming = true;
+            command_sets = false;
+        }
+
+        out_append(&radio_out, &byte, 1);
+        if(byte == terminator) {
+            command_done(command_sets, received_at);
+            command_streaming = false;
+            command_len = 0;
+        } else if(byte < 'A' || byte > 'Z') {
+            command_sets = true;
+        }
+    }
+    out_flush(&radio_out);
+    const uint32_t written = radio_out.written;
+
+    portENTER_CRITICAL(&proxy_lock);
+    logger_byte_at = received_at;
+    if(written > 0) {
+        proxy_stats.logger_bytes += written;
+        record_latency(&proxy_stats.logger_latency_count, &proxy_stats.logger_latency_max_us,
+                       &proxy_stats.logger_latency_total_us, esp_timer_get_time() - received_at);
+    }
+    portEXIT_CRITICAL(&proxy_lock);
+    xSemaphoreGive(radio_write_lock);
+}
+
+/**
+ * Send the client's poll in a gap of the logger's traffic. The poll is skipped when the
+ * logger's own queries keep the radio state fresh and deferred when there is no gap
+ * within half a poll interval.
+ */
+void cat_proxy_send_poll(const uint8_t *poll, size_t len)
+{
+    const TickType_t start = xTaskGetTickCount();
+    const TickType_t max_wait = pdMS_TO_TICKS(radio_config.poll_interval_ms) / 2;
+    for(;;) {
+        const int64_t now = esp_timer_get_time();
+        xSemaphoreTake(radio_write_lock, portMAX_DELAY);
+        portENTER_CRITICAL(&proxy_lock);
+        const bool fresh = state_at != 0 && now - state_at < (int64_t)radio_config.poll_interval_ms * 1000;
+        const bool idle = !command_streaming && command_len == 0 && now - logger_byte_at >= IDLE_GAP_US
+                          && !(logger_waiting && now - logger_query_at < REPLY_TIMEOUT_US)
+                          && !poll_reply_expected_locked(now);
+        if(fresh) {
+            proxy_stats.polls_skipped++;
+        } else if(idle) {
+            replies_pending = poll_reply_count;
+            next_reply = 0;
+            poll_sent_at = now;
+            proxy_stats.polls_sent++;
+        }
+        portEXIT_CRITICAL(&proxy_lock);
+        if(!fresh && idle) {
+            uart_write_bytes(radio_config.uart_num, poll, len);
+        }
+        xSemaphoreGive(radio_write_lock);
+
+        if(fresh || idle) {
+            return;
+        }
+        if(xTaskGetTickCount() - start >= max_wait) {
+            portENTER_CRITICAL(&proxy_lock);
+            proxy_stats.polls_deferred++;
+            portEXIT_CRITICAL(&proxy_lock);
+            return;
+        }
+        vTaskDelay(1);
+    }
+}
+
+static void read_logger(uint8_t *dtmp, int64_t received_at)
+{
+    const uart_port_t uart_num = CONFIG_CAT_PROXY_UART_NUM;
+    size_t buffered_size;
+
+    uart_get_buffered_data_len(uart_num, &buffered_size);
+    while(buffered_size > 0) {
+        int len = uart_read_bytes(uart_num, dtmp, buffered_size < RX_BUF_SIZE ? buffered_size : RX_BUF_SIZE, 0);
+        if(len <= 0) {
+            break;
+        }
+        buffered_size -= len;
+        logger_data(dtmp, len, received_at);
+    }
+    while(uart_pattern_pop_pos(uart_num) != -1) {
+    }
+}
+
+static void report_stats()
+{
+    cat_proxy_stats_t stats;
+    cat_proxy_get_stats(&stats);
+    ESP_LOGI(TAG, "logger->radio %" PRIu32 " bytes, avg %" PRId64 "us max %" PRId64 "us; radio->logger %" PRIu32 " bytes, avg %" PRId64 "us max %" PRId64 "us",
+             stats.logger_bytes, stats.logger_latency_count ? stats.logger_latency_total_us / stats.logger_latency_count : 0, stats.logger_latency_max_us,
+             stats.radio_bytes, stats.radio_latency_count ? stats.radio_latency_total_us / stats.radio_latency_count : 0, stats.radio_latency_max_us);
+    ESP_LOGI(TAG, "cache %" PRIu32 " hits %" PRIu32 " misses; polls %" PRIu32 " sent %" PRIu32 " skipped %" PRIu32 " deferred",
+             stats.cache_hits, stats.cache_misses, stats.polls_sent, stats.polls_skipped, stats.polls_deferred);
+}
+
+static void logger_task(void *arg)
+{
+    uart_event_t event;
+    uint8_t* dtmp = logger_buf;
+    int64_t reported_at = esp_timer_get_time();
+    for(;;) {
+        if(xQueueReceive(logger_queue, (void *)&event, pdMS_TO_TICKS(REPORT_INTERVAL_US / 1000))) {
+            switch(event.type) {
+            case UART_DATA:
+            case UART_PATTERN_DET:
+                read_logger(dtmp, esp_timer_get_time());
+                break;
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                // Bytes from the logger are lost, pass on what is left, the radio drops the broken command
+                read_logger(dtmp, esp_timer_get_time());
+                ESP_LOGW(TAG, "logger uart overflow (event %d)", event.type);
+                break;
+            default:
+                break;
+            }
+        }
+        if(esp_timer_get_time() - reported_at >= REPORT_INTERVAL_US) {
+            reported_at = esp_timer_get_time();
+            report_stats();
+        }
+    }
+}
+
+/**
+ * Open the logger port in front of radio 1. Only text protocols are proxied, their
+ * answers can be told apart by prefix.
+ */
+void init_cat_proxy(const band_decoder_config_t *radio)
+{
+    if(radio->radio != PROXY_RADIO) {
+        return;
+    }
+    if(radio->protocol->terminator != ';') {
+        ESP_LOGE(TAG, "The CAT proxy does not support the %s protocol", radio->protocol->name);
+        return;
+    }
+    radio_config = *radio;
+    terminator = radio->protocol->terminator;
+
+    // The answers to the client's poll start with the commands of the poll
+    cat_parser_t parser;
+    uint8_t poll[CAT_POLL_MAX];
+    cat_parser_init(&parser, radio->protocol, radio->address);
+    const size_t poll_len = cat_parser_poll_request(&parser, poll, sizeof(poll));
+    size_t start = 0;
+    for(size_t i = 0; i < poll_len && poll_reply_count < MAX_POLL_REPLIES; i++) {
+        if(poll[i] == terminator) {
+            memcpy(poll_replies[poll_reply_count], poll + start, i - start);
+            poll_replies[poll_reply_count][i - start] = '\0';
+            poll_reply_count++;
+            start = i + 1;
+        }
+    }
+
+    const uart_port_t uart_num = CONFIG_CAT_PROXY_UART_NUM;
+    if(uart_is_driver_installed(uart_num)) {
+        ESP_LOGE(TAG, "UART %d is already in use, CAT_PROXY_UART_NUM must be a spare UART", uart_num);
+        return;
+    }
+
+    radio_write_lock = xSemaphoreCreateMutexStatic(&radio_write_lock_buffer);
+    logger_write_lock = xSemaphoreCreateMutexStatic(&logger_write_lock_buffer);
+    radio_out.uart_num = radio->uart_num;
+    logger_out.uart_num = uart_num;
+
+    const uart_config_t uart_config = {
+        .baud_rate = radio->baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    esp_err_t err = uart_driver_install(uart_num, RX_BUF_SIZE * 2, TX_BUF_SIZE, 20, &logger_queue, 0);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not install the driver for UART %d: (%s)", uart_num, esp_err_to_name(err));
+        return;
+    }
+    err = uart_param_config(uart_num, &uart_config);
+    if(err == ESP_OK) {
+        err = uart_set_pin(uart_num, CONFIG_CAT_PROXY_TX_PIN, CONFIG_CAT_PROXY_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    }
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not set up UART %d: (%s)", uart_num, esp_err_to_name(err));
+        uart_driver_delete(uart_num);
+        return;
+    }
+
+    // Hand over bytes after two quiet characters already, and whole commands at their terminator
+    uart_set_rx_timeout(uart_num, 2);
+    uart_enable_pattern_det_baud_intr(uart_num, terminator, 1, 20, 0, 0);
+    uart_pattern_queue_reset(uart_num, 5);
+
+    heap_guard_watch(xTaskCreateStatic(logger_task, "cat_proxy_task", sizeof(logger_stack), NULL, 12,
+                                       logger_stack, &logger_tcb));
+    active = true;
+    ESP_LOGI(TAG, "Logger on UART %d shares radio %u at %d baud", uart_num, radio->radio + 1, radio->baud_rate);
+}
+
+bool cat_proxy_active(uint8_t radio)
+{
+    return active && radio == PROXY_RADIO;
+}
+
+void cat_proxy_get_stats(cat_proxy_stats_t *stats)
+{
+    portENTER_CRITICAL(&proxy_lock);
+    *stats = proxy_stats;
+    portEXIT_CRITICAL(&proxy_lock);
+}
+
+#else
+
+void init_cat_proxy(const band_decoder_config_t *radio) {}
+bool cat_proxy_active(uint8_t radio) { return false; }
+void cat_proxy_send_poll(const uint8_t *poll, size_t len) {}
+void cat_proxy_radio_data(const uint8_t *data, size_t len, int64_t received_at) {}
+void cat_proxy_get_stats(cat_proxy_stats_t *stats) { memset(stats, 0, sizeof(cat_proxy_stats_t)); }
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "band_decoder.h"
+
+/**
+ * Counters of the CAT proxy. Latencies are from the UART event to the bytes
+ * being queued on the other port, in microseconds.
+ */
+typedef struct {
+    uint32_t logger_bytes;          /* logger to radio */
+    uint32_t radio_bytes;           /* radio to logger */
+    uint32_t cache_hits;            /* logger queries answered from the cache */
+    uint32_t cache_misses;
+    uint32_t polls_sent;
+    uint32_t polls_skipped;         /* the logger's own polls kept the state fresh */
+    uint32_t polls_deferred;        /* no gap in the logger's traffic for a whole interval */
+    uint32_t replies_hidden;        /* answers to the client's polls kept from the logger */
+    uint32_t logger_latency_count;
+    int64_t logger_latency_max_us;
+    int64_t logger_latency_total_us;
+    uint32_t radio_latency_count;
+    int64_t radio_latency_max_us;
+    int64_t radio_latency_total_us;
+} cat_proxy_stats_t;
+
+void init_cat_proxy(const band_decoder_config_t *radio);
+bool cat_proxy_active(uint8_t radio);
+void cat_proxy_send_poll(const uint8_t *poll, size_t len);
+void cat_proxy_radio_data(const uint8_t *data, size_t len, int64_t received_at);
+void cat_proxy_get_stats(cat_proxy_stats_t *stats);
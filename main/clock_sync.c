@@ -0,0 +1,346 @@
+#include "clock_sync.h"
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+
+#if CONFIG_CLOCK_SYNC
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "websocket_client.h"
+
+static const char *TAG = "clock_sync";
+
+/*
+ * NTP style exchange over the WebSocket:
+ *   client: "time_req:<t1>:<estimate>"   t1 local send time, estimate the client's idea of the
+ *                                        server time at t1 (0 while not synced), for checking
+ *   server: "time:<t1>:<t2>:<t3>"        t2 receive and t3 send time on the server clock
+ * The client takes t4 on receipt. All times are microseconds, server times since the Unix epoch.
+ */
+static const char *time_request_prefix = "time_req:";
+static const char *time_reply_prefix = "time:";
+
+/* Offset candidates, the one with the shortest round trip is used */
+#define SAMPLE_WINDOW 8
+/* Chosen offsets the drift is fitted over */
+#define DRIFT_HISTORY 16
+/* Shortest span of the drift history before a drift is estimated */
+#define DRIFT_MIN_SPAN_US (30LL * 1000 * 1000)
+#define MAX_DRIFT_PPB 500000LL
+/* Exchanges right after connecting, to get a good offset quickly */
+#define BURST_COUNT 8
+#define BURST_INTERVAL_MS 250
+/* Replies to requests older than this are ignored */
+#define MAX_ROUND_TRIP_US (5LL * 1000 * 1000)
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+typedef struct {
+    int64_t local_us;
+    int64_t offset_us;
+    int64_t delay_us;
+} sync_sample_t;
+
+static sync_sample_t window[SAMPLE_WINDOW];
+static int window_count;
+static int window_next;
+static sync_sample_t history[DRIFT_HISTORY];
+static int history_count;
+static int history_next;
+
+/* The estimate: server time = local + offset + drift * (local - ref_local) */
+static int64_t ref_local_us;
+static int64_t sntp_offset_us;
+static clock_sync_stats_t sync_stats;
+static portMUX_TYPE sync_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t sync_task_handle = NULL;
+static StaticTask_t sync_task_tcb;
+static StackType_t sync_task_stack[3072];
+static esp_timer_handle_t report_timer;
+static volatile int burst_remaining;
+static bool burst_reported;
+
+static int64_t estimate_locked(int64_t local_us)
+{
+    if(sync_stats.synced) {
+        return local_us + sync_stats.offset_us + sync_stats.drift_ppb * (local_us - ref_local_us) / 1000000000LL;
+    }
+    return local_us + sntp_offset_us;
+}
+
+/**
+ * Server time of a local esp_timer timestamp. Returns false while there is no
+ * estimate from the server or SNTP yet.
+ */
+bool clock_sync_time(int64_t local_us, int64_t *epoch_us)
+{
+    portENTER_CRITICAL(&sync_lock);
+    const bool valid = sync_stats.synced || sync_stats.sntp_synced;
+    if(valid) {
+        *epoch_us = estimate_locked(local_us);
+    }
+    portEXIT_CRITICAL(&sync_lock);
+    return valid;
+}
+
+/**
+ * Least squares slope of the chosen offsets over local time
+ */
+static int64_t fit_drift_ppb()
+{
+    if(history_count < 3) {
+        return 0;
+    }
+    const sync_sample_t *first = &history[(history_next + DRIFT_HISTORY - history_count) % DRIFT_HISTORY];
+    const sync_sample_t *last = &history[(history_next + DRIFT_HISTORY - 1) % DRIFT_HISTORY];
+    if(last->local_us - first->local_us < DRIFT_MIN_SPAN_US) {
+        return 0;
+    }
+
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for(int i = 0; i < history_count; i++) {
+        const double x = (double)(history[i].local_us - first->local_us);
+        const double y = (double)(history[i].offset_us - first->offset_us);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    const double n = history_count;
+    const double denominator = n * sxx - sx * sx;
+    if(denominator <= 0) {
+        return 0;
+    }
+    int64_t drift = (int64_t)((n * sxy - sx * sy) / denominator * 1e9);
+    if(drift > MAX_DRIFT_PPB) {
+        drift = MAX_DRIFT_PPB;
+    } else if(drift < -MAX_DRIFT_PPB) {
+        drift = -MAX_DRIFT_PPB;
+    }
+    return drift;
+}
+
+static void add_sample(int64_t local_us, int64_t offset_us, int64_t delay_us)
+{
+    portENTER_CRITICAL(&sync_lock);
+    window[window_next] = (sync_sample_t){ local_us, offset_us, delay_us };
+    window_next = (window_next + 1) % SAMPLE_WINDOW;
+    if(window_count < SAMPLE_WINDOW) {
+        window_count++;
+    }
+
+    const sync_sample_t *best = &window[0];
+    for(int i = 1; i < window_count; i++) {
+        if(window[i].delay_us < best->delay_us) {
+            best = &window[i];
+        }
+    }
+
+    const sync_sample_t *newest = history_count > 0 ? &history[(history_next + DRIFT_HISTORY - 1) % DRIFT_HISTORY] : NULL;
+    if(newest == NULL || newest->local_us != best->local_us) {
+        history[history_next] = *best;
+        history_next = (history_next + 1) % DRIFT_HISTORY;
+        if(history_count < DRIFT_HISTORY) {
+            history_count++;
+        }
+        sync_stats.drift_ppb = fit_drift_ppb();
+    }
+
+    ref_local_us = best->local_us;
+    sync_stats.offset_us = best->offset_us;
+    sync_stats.delay_us = best->delay_us;
+    sync_stats.samples++;
+    sync_stats.synced = true;
+    portEXIT_CRITICAL(&sync_lock);
+}
+
+/**
+ * Handle "time:<t1>:<t2>:<t3>". Returns false for other messages.
+ */
+bool clock_sync_handle_reply(const char *data, int len)
+{
+    const int64_t t4 = esp_timer_get_time();
+    char buf[80];
+    const size_t prefix_len = strlen(time_reply_prefix);
+    if(len <= prefix_len || len >= sizeof(buf) || strncmp(data, time_reply_prefix, prefix_len) != 0) {
+        return false;
+    }
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    char *end;
+    const int64_t t1 = strtoll(buf + prefix_len, &end, 10);
+    if(*end != ':') {
+        return true;
+    }
+    const int64_t t2 = strtoll(end + 1, &end, 10);
+    if(*end != ':') {
+        return true;
+    }
+    const int64_t t3 = strtoll(end + 1, &end, 10);
+
+    const int64_t delay = (t4 - t1) - (t3 - t2);
+    if(t1 <= 0 || t4 - t1 > MAX_ROUND_TRIP_US || delay < 0) {
+        ESP_LOGW(TAG, "Ignoring time reply %s", buf);
+        return true;
+    }
+    const int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+    add_sample(t4, offset, delay);
+    ESP_LOGD(TAG, "offset %" PRId64 "us delay %" PRId64 "us", offset, delay);
+
+    if(burst_remaining == 0 && !burst_reported) {
+        burst_reported = true;
+        clock_sync_stats_t stats;
+        clock_sync_get_stats(&stats);
+        ESP_LOGI(TAG, "Offset to server %" PRId64 "us, round trip %" PRId64 "us, drift %" PRId64 "ppb",
+                 stats.offset_us, stats.delay_us, stats.drift_ppb);
+    }
+    return true;
+}
+
+/**
+ * One-way latencies of an acked antenna command: sent_local_us is the local send time,
+ * server_rx_us and relay_us are stamped by the server, relay_us 0 when there is no relay.
+ */
+void clock_sync_record_ack(int64_t sent_local_us, int64_t server_rx_us, int64_t relay_us)
+{
+    portENTER_CRITICAL(&sync_lock);
+    if(!sync_stats.synced) {
+        portEXIT_CRITICAL(&sync_lock);
+        return;
+    }
+    const int64_t uplink = server_rx_us - estimate_locked(sent_local_us);
+    sync_stats.uplink_count++;
+    sync_stats.uplink_total_us += uplink;
+    if(sync_stats.uplink_count == 1 || uplink < sync_stats.uplink_min_us) {
+        sync_stats.uplink_min_us = uplink;
+    }
+    if(sync_stats.uplink_count == 1 || uplink > sync_stats.uplink_max_us) {
+        sync_stats.uplink_max_us = uplink;
+    }
+    if(relay_us != 0) {
+        const int64_t relay = relay_us - server_rx_us;
+        sync_stats.relay_count++;
+        sync_stats.relay_total_us += relay;
+        if(sync_stats.relay_count == 1 || relay < sync_stats.relay_min_us) {
+            sync_stats.relay_min_us = relay;
+        }
+        if(sync_stats.relay_count == 1 || relay > sync_stats.relay_max_us) {
+            sync_stats.relay_max_us = relay;
+        }
+    }
+    portEXIT_CRITICAL(&sync_lock);
+    ESP_LOGD(TAG, "client->server %" PRId64 "us server->relay %" PRId64 "us", uplink, relay_us != 0 ? relay_us - server_rx_us : 0);
+}
+
+void clock_sync_get_stats(clock_sync_stats_t *stats)
+{
+    portENTER_CRITICAL(&sync_lock);
+    *stats = sync_stats;
+    portEXIT_CRITICAL(&sync_lock);
+}
+
+/**
+ * The one-way latencies since boot, skipped until the clock is synced
+ */
+static void report_stats(void *arg)
+{
+    clock_sync_stats_t stats;
+    clock_sync_get_stats(&stats);
+    if(!stats.synced) {
+        return;
+    }
+    ESP_LOGI(TAG, "client->server %" PRIu32 " acks, min %" PRId64 "us avg %" PRId64 "us max %" PRId64 "us; server->relay %" PRIu32 " acks, min %" PRId64 "us avg %" PRId64 "us max %" PRId64 "us; offset %" PRId64 "us, drift %" PRId64 "ppb",
+             stats.uplink_count, stats.uplink_min_us, stats.uplink_count ? stats.uplink_total_us / stats.uplink_count : 0, stats.uplink_max_us,
+             stats.relay_count, stats.relay_min_us, stats.relay_count ? stats.relay_total_us / stats.relay_count : 0, stats.relay_max_us,
+             stats.offset_us, stats.drift_ppb);
+}
+
+/**
+ * Start a burst of exchanges, called when the server connection is up
+ */
+void clock_sync_start()
+{
+    burst_reported = false;
+    burst_remaining = BURST_COUNT;
+    if(sync_task_handle != NULL) {
+        xTaskNotifyGive(sync_task_handle);
+    }
+}
+
+static void send_time_request()
+{
+    const int64_t t1 = esp_timer_get_time();
+    int64_t estimate = 0;
+    clock_sync_time(t1, &estimate);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s%" PRId64 ":%" PRId64, time_request_prefix, t1, estimate);
+    websocket_send_text(buf);
+}
+
+static void clock_sync_task()
+{
+    for(;;) {
+        const TickType_t wait = burst_remaining > 0 ? pdMS_TO_TICKS(BURST_INTERVAL_MS) : pdMS_TO_TICKS(CONFIG_CLOCK_SYNC_INTERVAL_S * 1000);
+        ulTaskNotifyTake(pdTRUE, wait);
+        if(!websocket_client_connected()) {
+            continue;
+        }
+        if(burst_remaining > 0) {
+            burst_remaining--;
+        }
+        send_time_request();
+    }
+}
+
+#if CONFIG_CLOCK_SYNC_SNTP
+#include "esp_sntp.h"
+
+static void sntp_synced_cb(struct timeval *tv)
+{
+    const int64_t local = esp_timer_get_time();
+    portENTER_CRITICAL(&sync_lock);
+    sntp_offset_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec - local;
+    sync_stats.sntp_synced = true;
+    portEXIT_CRITICAL(&sync_lock);
+    ESP_LOGI(TAG, "Wall clock set by SNTP from %s", CONFIG_CLOCK_SYNC_SNTP_SERVER);
+}
+
+static void init_sntp()
+{
+    esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    esp_sntp_setservername(0, CONFIG_CLOCK_SYNC_SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(sntp_synced_cb);
+    esp_sntp_init();
+}
+#endif
+
+void init_clock_sync()
+{
+#if CONFIG_CLOCK_SYNC_SNTP
+    init_sntp();
+#endif
+    sync_task_handle = xTaskCreateStatic(clock_sync_task, "clock_sync_task", sizeof(sync_task_stack), NULL, 5,
+                                         sync_task_stack, &sync_task_tcb);
+    const esp_timer_create_args_t report_args = {
+        .callback = report_stats,
+        .name = "clock_report",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &report_timer));
+    esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+}
+
+#else
+
+void init_clock_sync() {}
+void clock_sync_start() {}
+bool clock_sync_handle_reply(const char *data, int len) { return false; }
+bool clock_sync_time(int64_t local_us, int64_t *epoch_us) { return false; }
+void clock_sync_record_ack(int64_t sent_local_us, int64_t server_rx_us, int64_t relay_us) {}
+void clock_sync_get_stats(clock_sync_stats_t *stats) { memset(stats, 0, sizeof(clock_sync_stats_t)); }
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * State of the clock estimate and the one-way latencies measured with it.
+ * Times are in microseconds, drift in parts per billion of the local clock.
+ */
+typedef struct {
+    bool synced;                /* offset from the server's clock exchange */
+    bool sntp_synced;           /* wall clock from SNTP, used until the server answers */
+    uint32_t samples;
+    int64_t offset_us;
+    int64_t delay_us;           /* round trip of the sample the offset comes from */
+    int64_t drift_ppb;
+    uint32_t uplink_count;      /* client to server */
+    int64_t uplink_min_us;
+    int64_t uplink_max_us;
+    int64_t uplink_total_us;
+    uint32_t relay_count;       /* server to relay */
+    int64_t relay_min_us;
+    int64_t relay_max_us;
+    int64_t relay_total_us;
+} clock_sync_stats_t;
+
+void init_clock_sync();
+void clock_sync_start();
+bool clock_sync_handle_reply(const char *data, int len);
+bool clock_sync_time(int64_t local_us, int64_t *epoch_us);
+void clock_sync_record_ack(int64_t sent_local_us, int64_t server_rx_us, int64_t relay_us);
+void clock_sync_get_stats(clock_sync_stats_t *stats);
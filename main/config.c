@@ -6,6 +6,14 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <esp_log.h>
+#include "soc/soc_caps.h"
+#if CONFIG_ANTENNA_OUTPUT_GPIO
+#include "driver/gpio.h"
+#endif
+
+/* Antenna outputs are bit positions in a 64 bit mask, buttons are read on ADC1 */
+#define MAX_OUTPUT_CHANNEL 63
+#define ADC_CHANNEL_COUNT SOC_ADC_CHANNEL_NUM(0)
 
 static const char *TAG = "config";
 
@@ -19,6 +27,170 @@ static bool is_valid_ip_address(const char *address)
     return result != 0;
 }
 
+/**
+ * Parse the optional per radio CAT settings: "radios": [{"protocol": "icom", "baud": 19200, "address": 148}]
+ * Radios that are not listed keep their Kconfig defaults.
+*/
+static bool parse_radios(const cJSON *radios, Config* config)
+{
+    if(!cJSON_IsArray(radios) || cJSON_GetArraySize(radios) > CONFIG_RADIO_COUNT) {
+        ESP_LOGE(TAG, "radios must be an array of at most %d entries", CONFIG_RADIO_COUNT);
+        return false;
+    }
+
+    for(int i = 0; i < cJSON_GetArraySize(radios); i++) {
+        const cJSON *radio = cJSON_GetArrayItem(radios, i);
+        band_decoder_config_t *radio_config = &config->radios[i];
+
+        const cJSON *protocol = cJSON_GetObjectItem(radio, "protocol");
+        if(protocol) {
+            if(!cJSON_IsString(protocol) || !(radio_config->protocol = cat_protocol_find(protocol->valuestring))) {
+                ESP_LOGE(TAG, "Radio %d protocol is not valid", i + 1);
+                return false;
+            }
+            radio_config->baud_rate = radio_config->protocol->default_baud_rate;
+        }
+
+        const cJSON *baud = cJSON_GetObjectItem(radio, "baud");
+        if(baud) {
+            if(!cJSON_IsNumber(baud) || baud->valueint <= 0) {
+                ESP_LOGE(TAG, "Radio %d baud rate is not valid", i + 1);
+                return false;
+            }
+            radio_config->baud_rate = baud->valueint;
+        }
+
+        const cJSON *address = cJSON_GetObjectItem(radio, "address");
+        if(address) {
+            if(!cJSON_IsNumber(address) || address->valueint < 0 || address->valueint > 0xFF) {
+                ESP_LOGE(TAG, "Radio %d address is not valid", i + 1);
+                return false;
+            }
+            radio_config->address = address->valueint;
+        }
+
+        ESP_LOGI(TAG, "Radio %d: %s at %d baud", i + 1, radio_config->protocol->name, radio_config->baud_rate);
+    }
+    return true;
+}
+
+static bool is_int_in_range(const cJSON *item, int min, int max)
+{
+    return cJSON_IsNumber(item) && item->valuedouble >= min && item->valuedouble <= max;
+}
+
+/**
+ * Parse the optional antenna table, replacing the Kconfig defaults:
+ * "antennas": [{"led": 27, "adc_channel": 0, "adc_min": 700, "adc_max": 2000}, ...]
+ * Antennas without adc_channel have no button.
+*/
+static bool parse_antennas(const cJSON *antennas, Config* config)
+{
+    if(!cJSON_IsArray(antennas) || cJSON_GetArraySize(antennas) < 1 || cJSON_GetArraySize(antennas) > MAX_ANTENNAS) {
+        ESP_LOGE(TAG, "antennas must be an array of 1 to %d entries", MAX_ANTENNAS);
+        return false;
+    }
+
+    antenna_table_t *table = &config->antennas;
+    table->count = 0;
+    const cJSON *antenna;
+    cJSON_ArrayForEach(antenna, antennas) {
+        antenna_def_t *def = &table->antennas[table->count];
+        const cJSON *led = cJSON_GetObjectItem(antenna, "led");
+        if(!is_int_in_range(led, 0, MAX_OUTPUT_CHANNEL)) {
+            ESP_LOGE(TAG, "Antenna %u led must be 0 to %d", table->count + 1, MAX_OUTPUT_CHANNEL);
+            return false;
+        }
+#if CONFIG_ANTENNA_OUTPUT_GPIO
+        if(!GPIO_IS_VALID_OUTPUT_GPIO(led->valueint)) {
+            ESP_LOGE(TAG, "Antenna %u led GPIO %d cannot drive an output", table->count + 1, led->valueint);
+            return false;
+        }
+#endif
+        def->led = led->valueint;
+
+        const cJSON *adc_channel = cJSON_GetObjectItem(antenna, "adc_channel");
+        const cJSON *adc_min = cJSON_GetObjectItem(antenna, "adc_min");
+        const cJSON *adc_max = cJSON_GetObjectItem(antenna, "adc_max");
+        def->adc_channel = -1;
+        if(adc_channel) {
+            if(!cJSON_IsNumber(adc_channel) || !cJSON_IsNumber(adc_min) || !cJSON_IsNumber(adc_max)) {
+                ESP_LOGE(TAG, "Antenna %u button needs adc_channel, adc_min and adc_max", table->count + 1);
+                return false;
+            }
+            if(!is_int_in_range(adc_channel, 0, ADC_CHANNEL_COUNT - 1)) {
+                ESP_LOGE(TAG, "Antenna %u adc_channel must be 0 to %d", table->count + 1, ADC_CHANNEL_COUNT - 1);
+                return false;
+            }
+            if(!is_int_in_range(adc_min, 0, UINT16_MAX) || !is_int_in_range(adc_max, adc_min->valueint, UINT16_MAX)) {
+                ESP_LOGE(TAG, "Antenna %u needs 0 <= adc_min <= adc_max <= %d", table->count + 1, UINT16_MAX);
+                return false;
+            }
+            def->adc_channel = adc_channel->valueint;
+            def->adc_min = adc_min->valueint;
+            def->adc_max = adc_max->valueint;
+        }
+        table->count++;
+    }
+    return true;
+}
+
+/**
+ * Parse the optional fixed address of an interface: "ip", "netmask", "gateway" and "dns".
+ * Without "ip" the interface uses DHCP.
+*/
+static bool parse_ip_config(const cJSON *object, const char *name, network_ip_config_t *ip_config)
+{
+    const cJSON *ip = cJSON_GetObjectItem(object, "ip");
+    if(!ip) {
+        ip_config->static_ip = false;
+        return true;
+    }
+
+    const cJSON *netmask = cJSON_GetObjectItem(object, "netmask");
+    const cJSON *gateway = cJSON_GetObjectItem(object, "gateway");
+    const cJSON *dns = cJSON_GetObjectItem(object, "dns");
+    if(!cJSON_IsString(ip) || !cJSON_IsString(netmask) || !cJSON_IsString(gateway)
+        || esp_netif_str_to_ip4(ip->valuestring, &ip_config->ip_info.ip) != ESP_OK
+        || esp_netif_str_to_ip4(netmask->valuestring, &ip_config->ip_info.netmask) != ESP_OK
+        || esp_netif_str_to_ip4(gateway->valuestring, &ip_config->ip_info.gw) != ESP_OK) {
+        ESP_LOGE(TAG, "%s static address needs a valid ip, netmask and gateway", name);
+        return false;
+    }
+    ip_config->dns.addr = 0;
+    if(dns && (!cJSON_IsString(dns) || esp_netif_str_to_ip4(dns->valuestring, &ip_config->dns) != ESP_OK)) {
+        ESP_LOGE(TAG, "%s dns is not valid", name);
+        return false;
+    }
+    ip_config->static_ip = true;
+    return true;
+}
+
+/**
+ * Parse the Wi-Fi settings: "wifi": {"ssid": "shack", "password": "secret", "primary": false}
+ * plus the optional static address.
+*/
+static bool parse_wifi(const cJSON *wifi, Config* config)
+{
+    wifi_settings_t *settings = &config->wifi;
+    const cJSON *ssid = cJSON_GetObjectItem(wifi, "ssid");
+    const cJSON *password = cJSON_GetObjectItem(wifi, "password");
+    const cJSON *primary = cJSON_GetObjectItem(wifi, "primary");
+    if(!cJSON_IsString(ssid) || strlen(ssid->valuestring) == 0 || strlen(ssid->valuestring) >= sizeof(settings->ssid)) {
+        ESP_LOGE(TAG, "Wi-Fi ssid is not valid");
+        return false;
+    }
+    if(password && (!cJSON_IsString(password) || strlen(password->valuestring) >= sizeof(settings->password))) {
+        ESP_LOGE(TAG, "Wi-Fi password is not valid");
+        return false;
+    }
+
+    strcpy(settings->ssid, ssid->valuestring);
+    strcpy(settings->password, password ? password->valuestring : "");
+    settings->primary = cJSON_IsTrue(primary);
+    return parse_ip_config(wifi, "Wi-Fi", &settings->ip);
+}
+
 /**
  * Parse JSON configuration
 */
@@ -31,13 +203,15 @@ bool parse_config(const char* config_str, Config* config)
     }
 
     cJSON *server_address = cJSON_GetObjectItem(root,"server_address");
-    if(!server_address) {
+    if(!cJSON_IsString(server_address)) {
         ESP_LOGE(TAG, "Server address not found");
+        cJSON_Delete(root);
         return false;
     }
 
     if(!is_valid_ip_address(server_address->valuestring)) {
         ESP_LOGE(TAG, "Server address is not valid");
+        cJSON_Delete(root);
         return false;
     }
 
@@ -45,14 +219,40 @@ bool parse_config(const char* config_str, Config* config)
     cJSON *use_wifi = cJSON_GetObjectItem(root, "use_wifi");
     if(!use_wifi) {
         ESP_LOGE(TAG, "use_wifi not found");
+        cJSON_Delete(root);
         return false;
     }
 
     if(cJSON_IsTrue(use_wifi) == 1) {
         ESP_LOGI(TAG, "use_wifi set to true");
         config->use_wifi = true;
-    } 
+        cJSON *wifi = cJSON_GetObjectItem(root, "wifi");
+        if(!wifi || !parse_wifi(wifi, config)) {
+            ESP_LOGE(TAG, "use_wifi needs valid wifi settings");
+            cJSON_Delete(root);
+            return false;
+        }
+    }
+
+    cJSON *ethernet = cJSON_GetObjectItem(root, "ethernet");
+    if(ethernet && !parse_ip_config(ethernet, "Ethernet", &config->ethernet)) {
+        cJSON_Delete(root);
+        return false;
+    }
+
+    cJSON *radios = cJSON_GetObjectItem(root, "radios");
+    if(radios && !parse_radios(radios, config)) {
+        cJSON_Delete(root);
+        return false;
+    }
+
+    cJSON *antennas = cJSON_GetObjectItem(root, "antennas");
+    if(antennas && !parse_antennas(antennas, config)) {
+        cJSON_Delete(root);
+        return false;
+    }
 
+    cJSON_Delete(root);
     ESP_LOGI(TAG, "Parsed configuration file successfully");
     return true;
 }
\ No newline at end of file
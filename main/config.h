@@ -2,11 +2,19 @@
 
 #include <stdbool.h>
 #include <cJSON.h>
+#include "sdkconfig.h"
+#include "band_decoder.h"
+#include "antenna_control.h"
+#include "wifi.h"
 
 typedef struct Config
 {
     char server_ip[60];
+    network_ip_config_t ethernet;
     bool use_wifi;
+    wifi_settings_t wifi;
+    band_decoder_config_t radios[CONFIG_RADIO_COUNT];
+    antenna_table_t antennas;
 } Config;
 
 bool parse_config(const char* config_str, Config* config);
\ No newline at end of file
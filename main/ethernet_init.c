@@ -67,8 +67,13 @@ static esp_err_t spi_bus_init(void)
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
     };
-    ESP_GOTO_ON_ERROR(spi_bus_initialize(CONFIG_ETHERNET_SPI_HOST, &buscfg, SPI_DMA_CH_AUTO),
-                        err, TAG, "SPI host #%d init failed", CONFIG_ETHERNET_SPI_HOST);
+    ret = spi_bus_initialize(CONFIG_ETHERNET_SPI_HOST, &buscfg, SPI_DMA_CH_AUTO);
+    if (ret == ESP_ERR_INVALID_STATE) {
+        // The SD card keeps the bus when the event journal is enabled
+        ESP_LOGW(TAG, "SPI host #%d already initialized, sharing it", CONFIG_ETHERNET_SPI_HOST);
+        ret = ESP_OK;
+    }
+    ESP_GOTO_ON_ERROR(ret, err, TAG, "SPI host #%d init failed", CONFIG_ETHERNET_SPI_HOST);
 
 err:
     return ret;
@@ -144,14 +149,12 @@ err:
 
 static esp_err_t ethernet_w5500_init(esp_eth_handle_t *eth_handles_out[], uint8_t *eth_cnt_out)
 {
+    static esp_eth_handle_t eth_handles[SPI_ETHERNETS_NUM];
     esp_err_t ret = ESP_OK;
-    esp_eth_handle_t *eth_handles = NULL;
     uint8_t eth_cnt = 0;
 
     ESP_GOTO_ON_FALSE(eth_handles_out != NULL && eth_cnt_out != NULL, ESP_ERR_INVALID_ARG,
                         err, TAG, "invalid arguments: initialized handles array or number of interfaces");
-    eth_handles = calloc(SPI_ETHERNETS_NUM, sizeof(esp_eth_handle_t));
-    ESP_GOTO_ON_FALSE(eth_handles != NULL, ESP_ERR_NO_MEM, err, TAG, "no memory");
 
     ESP_GOTO_ON_ERROR(spi_bus_init(), err, TAG, "SPI bus init failed");
     
@@ -178,7 +181,6 @@ static esp_err_t ethernet_w5500_init(esp_eth_handle_t *eth_handles_out[], uint8_
 
     return ret;
 err:
-    free(eth_handles);
     return ret;
 }
 
@@ -226,11 +228,14 @@ static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
     ESP_LOGI(TAG, "~~~~~~~~~~~");
 }
 
-void ethernet_init()
+esp_netif_t* ethernet_init()
 {
     uint8_t eth_port_cnt = 0;
     esp_eth_handle_t *eth_handles;
-    ethernet_w5500_init(&eth_handles, &eth_port_cnt);
+    if(ethernet_w5500_init(&eth_handles, &eth_port_cnt) != ESP_OK) {
+        ESP_LOGE(TAG, "No W5500 found, Ethernet is not available");
+        return NULL;
+    }
 
     esp_netif_config_t cfg = ESP_NETIF_DEFAULT_ETH();
     esp_netif_t *eth_netif = esp_netif_new(&cfg);
@@ -246,4 +251,5 @@ void ethernet_init()
     for (int i = 0; i < eth_port_cnt; i++) {
         ESP_ERROR_CHECK(esp_eth_start(eth_handles[i]));
     }
-}
\ No newline at end of file
+    return eth_netif;
+}
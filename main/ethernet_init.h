@@ -5,4 +5,6 @@
  */
 #pragma once
 
-void ethernet_init();
+#include "esp_netif.h"
+
+esp_netif_t* ethernet_init();
@@ -0,0 +1,157 @@
+#include "event_journal.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#if CONFIG_EVENT_JOURNAL
+
+#include <stdio.h>
+#include <unistd.h>
+#include "sd_log.h"
+#include "antenna_control.h"
+#include "network.h"
+#include "clock_sync.h"
+
+static const char *TAG = "event_journal";
+
+#define RING_SIZE CONFIG_EVENT_JOURNAL_RING_SIZE
+
+/* Appends are at least this large unless a flush has less, a few sectors at once */
+#define WRITE_BUFFER_SIZE 4096
+
+static const char *journal_header = "time_s,utc_s,event,radio,value\n";
+
+static const char* const JournalEventStr[] =
+{
+    "boot",
+    "switch",
+    "band",
+    "automode",
+    "connected",
+    "disconnected",
+    "uplink",
+    "error"
+};
+
+static const char* const UplinkNameStr[] = {"ethernet", "wifi", "none"};
+
+/**
+ * An event as it sits in the ring, 16 bytes. Formatting to CSV is left to the flush task.
+ */
+typedef struct {
+    int64_t time_us;
+    int32_t value;
+    uint8_t event;
+    uint8_t radio;
+} journal_entry_t;
+
+static journal_entry_t ring[RING_SIZE];
+static char write_buffer[WRITE_BUFFER_SIZE];
+
+static int start_journal(int fd, const uint8_t *first)
+{
+    return write(fd, journal_header, strlen(journal_header));
+}
+
+static size_t format_entry(const uint8_t *record, char *line, size_t len)
+{
+    const journal_entry_t *entry = (const journal_entry_t *)record;
+    char radio[4] = "";
+    if(entry->radio != JOURNAL_NO_RADIO) {
+        snprintf(radio, sizeof(radio), "%u", entry->radio + 1);
+    }
+
+    char value[12];
+    if(entry->event == JOURNAL_BAND) {
+        snprintf(value, sizeof(value), "%s", amateur_band_str(entry->value));
+    } else if(entry->event == JOURNAL_UPLINK && entry->value >= 0 && entry->value <= UPLINK_NONE) {
+        snprintf(value, sizeof(value), "%s", UplinkNameStr[entry->value]);
+    } else {
+        snprintf(value, sizeof(value), "%" PRId32, entry->value);
+    }
+
+    /* Server time when the clock is synchronised, empty otherwise */
+    char utc[24] = "";
+    int64_t epoch_us;
+    if(clock_sync_time(entry->time_us, &epoch_us)) {
+        snprintf(utc, sizeof(utc), "%" PRId64 ".%06" PRId64, epoch_us / 1000000, epoch_us % 1000000);
+    }
+
+    return snprintf(line, len, "%" PRId64 ".%06" PRId64 ",%s,%s,%s,%s\n", entry->time_us / 1000000, entry->time_us % 1000000, utc,
+                    entry->event < JOURNAL_EVENT_COUNT ? JournalEventStr[entry->event] : "?", radio, value);
+}
+
+static void report_stats()
+{
+    event_journal_stats_t stats;
+    event_journal_get_stats(&stats);
+    ESP_LOGI(TAG, "%" PRIu32 " events logged, %" PRIu32 " dropped, log max %" PRIu32 " cycles; %" PRIu32 " flushes, max %" PRId64 "us, %" PRIu32 " bytes, %" PRIu32 " write errors",
+             stats.logged, stats.dropped, stats.log_max_cycles, stats.flushes, stats.flush_max_us, stats.bytes_written, stats.write_errors);
+}
+
+static sd_log_t journal_log = {
+    .name = "journal",
+    .ext = "csv",
+    .ring = (uint8_t *)ring,
+    .ring_size = sizeof(ring),
+    .max_file_bytes = (int32_t)CONFIG_EVENT_JOURNAL_MAX_FILE_KB * 1024,
+    .files = CONFIG_EVENT_JOURNAL_FILES,
+    .flush_interval_ms = CONFIG_EVENT_JOURNAL_FLUSH_INTERVAL_MS,
+    .start_file = start_journal,
+    .format = format_entry,
+    .record_size = sizeof(journal_entry_t),
+    .write_buffer = write_buffer,
+    .write_buffer_size = sizeof(write_buffer),
+    .report = report_stats,
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+/**
+ * Queue an event. Takes a fixed, small number of cycles: a timestamp and a 16 byte
+ * copy under a spinlock. Events are dropped and counted when the ring is full.
+ */
+void event_journal_log(journal_event_t event, uint8_t radio, int32_t value)
+{
+    const journal_entry_t entry = {
+        .time_us = esp_timer_get_time(),
+        .value = value,
+        .event = event,
+        .radio = radio,
+    };
+    sd_log_queue(&journal_log, &entry, sizeof(entry), NULL, 0);
+}
+
+void event_journal_get_stats(event_journal_stats_t *stats)
+{
+    sd_log_stats_t log_stats;
+    sd_log_get_stats(&journal_log, &log_stats);
+    stats->logged = log_stats.records;
+    stats->dropped = log_stats.dropped;
+    stats->flushes = log_stats.flushes;
+    stats->bytes_written = log_stats.bytes_written;
+    stats->rotations = log_stats.rotations;
+    stats->write_errors = log_stats.write_errors;
+    stats->log_max_cycles = log_stats.queue_max_cycles;
+    stats->flush_max_us = log_stats.flush_max_us;
+}
+
+/**
+ * Start journaling to the mounted SD card, which then stays mounted
+ */
+bool init_event_journal()
+{
+    if(!sd_log_start(&journal_log, "journal_task")) {
+        return false;
+    }
+    event_journal_log(JOURNAL_BOOT, JOURNAL_NO_RADIO, 0);
+    ESP_LOGI(TAG, "Journal on the SD card, flushed every %d ms", CONFIG_EVENT_JOURNAL_FLUSH_INTERVAL_MS);
+    return true;
+}
+
+#else
+
+bool init_event_journal() { return false; }
+void event_journal_log(journal_event_t event, uint8_t radio, int32_t value) {}
+void event_journal_get_stats(event_journal_stats_t *stats) { memset(stats, 0, sizeof(event_journal_stats_t)); }
+
+#endif
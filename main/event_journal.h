@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    JOURNAL_BOOT,
+    JOURNAL_SWITCH,             /* value: antenna */
+    JOURNAL_BAND,               /* value: enum AmateurBand */
+    JOURNAL_AUTOMODE,           /* value: 1 on, 0 off */
+    JOURNAL_SERVER_CONNECTED,
+    JOURNAL_SERVER_DISCONNECTED,
+    JOURNAL_UPLINK,             /* value: uplink_t, UPLINK_NONE when none is left */
+    JOURNAL_ERROR,              /* value: esp_err_t or errno */
+    JOURNAL_EVENT_COUNT
+} journal_event_t;
+
+/** Radio number for events that do not belong to a radio */
+#define JOURNAL_NO_RADIO 0xFF
+
+/**
+ * Counters of the journal. log_max_cycles is the most CPU cycles one
+ * event_journal_log() call took, the cost on the switching path.
+ */
+typedef struct {
+    uint32_t logged;
+    uint32_t dropped;           /* ring full, the flush task did not keep up */
+    uint32_t flushes;
+    uint32_t bytes_written;
+    uint32_t rotations;
+    uint32_t write_errors;
+    uint32_t log_max_cycles;
+    int64_t flush_max_us;
+} event_journal_stats_t;
+
+bool init_event_journal();
+void event_journal_log(journal_event_t event, uint8_t radio, int32_t value);
+void event_journal_get_stats(event_journal_stats_t *stats);
@@ -0,0 +1,108 @@
+#include "heap_guard.h"
+#include <string.h>
+#include "esp_log.h"
+
+#if CONFIG_HEAP_GUARD
+
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static const char *TAG = "heap_guard";
+
+#define MAX_WATCHED 16
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+static TaskHandle_t watched[MAX_WATCHED];
+static volatile uint32_t watched_count;
+static volatile bool armed;
+static heap_guard_stats_t guard_stats;
+static portMUX_TYPE guard_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t report_timer;
+static uint32_t reported;
+
+/**
+ * Called by the heap on every allocation once HEAP_USE_HOOKS is enabled. Must not
+ * allocate or block, it may run with interrupts disabled.
+ */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if(!armed || xPortInIsrContext()) {
+        return;
+    }
+    const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for(uint32_t i = 0; i < watched_count; i++) {
+        if(watched[i] != task) {
+            continue;
+        }
+#if CONFIG_HEAP_GUARD_ABORT
+        esp_system_abort("Heap allocation on the switching path after init");
+#endif
+        portENTER_CRITICAL_SAFE(&guard_lock);
+        guard_stats.allocations++;
+        guard_stats.last_size = size;
+        guard_stats.last_task = task;
+        portEXIT_CRITICAL_SAFE(&guard_lock);
+        return;
+    }
+}
+
+/**
+ * Count heap allocations made by a task once the guard is armed. For the tasks on
+ * the switching path, which only use their static buffers.
+ */
+void heap_guard_watch(TaskHandle_t task)
+{
+    if(task == NULL || watched_count == MAX_WATCHED) {
+        ESP_LOGE(TAG, "Cannot watch task %p", task);
+        return;
+    }
+    watched[watched_count] = task;
+    watched_count++;
+}
+
+void heap_guard_get_stats(heap_guard_stats_t *stats)
+{
+    portENTER_CRITICAL(&guard_lock);
+    *stats = guard_stats;
+    portEXIT_CRITICAL(&guard_lock);
+    stats->free_min = esp_get_minimum_free_heap_size();
+}
+
+static void report_cb(void *arg)
+{
+    heap_guard_stats_t stats;
+    heap_guard_get_stats(&stats);
+    if(stats.allocations != reported) {
+        ESP_LOGW(TAG, "%" PRIu32 " heap allocations on the switching path, the last %" PRIu32 " bytes by %s",
+                 stats.allocations, stats.last_size, pcTaskGetName(stats.last_task));
+        reported = stats.allocations;
+    }
+    ESP_LOGI(TAG, "Free heap %" PRIu32 " bytes, %" PRIu32 " after init, lowest %" PRIu32,
+             esp_get_free_heap_size(), stats.free_at_arm, stats.free_min);
+}
+
+/**
+ * End of the init phase, from now on the watched tasks must not allocate
+ */
+void heap_guard_arm()
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = report_cb,
+        .name = "heap_report",
+    };
+    esp_timer_create(&timer_args, &report_timer);
+    esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+
+    guard_stats.free_at_arm = esp_get_free_heap_size();
+    armed = true;
+    ESP_LOGI(TAG, "Watching %" PRIu32 " tasks, %" PRIu32 " bytes of heap free after init", watched_count, guard_stats.free_at_arm);
+}
+
+#else
+
+void heap_guard_watch(TaskHandle_t task) {}
+void heap_guard_arm() {}
+void heap_guard_get_stats(heap_guard_stats_t *stats) { memset(stats, 0, sizeof(heap_guard_stats_t)); }
+
+#endif
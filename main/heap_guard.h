@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * Heap allocations made by the watched tasks after init. free_min is the lowest
+ * free heap seen since boot, in bytes.
+ */
+typedef struct {
+    uint32_t allocations;
+    uint32_t last_size;
+    TaskHandle_t last_task;
+    uint32_t free_at_arm;
+    uint32_t free_min;
+} heap_guard_stats_t;
+
+void heap_guard_watch(TaskHandle_t task);
+void heap_guard_arm();
+void heap_guard_get_stats(heap_guard_stats_t *stats);
@@ -1,3 +0,0 @@
-#pragma once
-
-void init_band_decoder();
\ No newline at end of file
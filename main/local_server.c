@@ -0,0 +1,259 @@
+#include "local_server.h"
+#include <stdio.h>
+#include <string.h>
+#include <cJSON.h>
+#include "esp_log.h"
+#include "antenna_control.h"
+#include "websocket_client.h"
+
+#if CONFIG_LOCAL_SERVER
+
+#include "esp_http_server.h"
+
+static const char *TAG = "local_server";
+
+/* Longest command accepted over REST or the WebSocket */
+#define MAX_COMMAND_LEN 128
+#define MAX_TOKEN_LEN 64
+#define MAX_STATE_LEN (96 + CONFIG_RADIO_COUNT * 48)
+
+static httpd_handle_t server = NULL;
+static volatile bool push_queued = false;
+
+/* Only used by the server task, which handles one request at a time */
+static char state_buf[MAX_STATE_LEN];
+
+/**
+ * {"automode":true,"server":true,"antennas":6,"radios":[{"radio":1,"band":"20M","antenna":3}]}
+ * Radios count from 1, antenna 0 means none is selected yet.
+ */
+static const char* state_json()
+{
+    int len = snprintf(state_buf, sizeof(state_buf), "{\"automode\":%s,\"server\":%s,\"antennas\":%u,\"radios\":[",
+                       automode_is_enabled() ? "true" : "false", websocket_client_connected() ? "true" : "false",
+                       get_antenna_count());
+    for(uint8_t r = 0; r < CONFIG_RADIO_COUNT && len < (int)sizeof(state_buf); r++) {
+        len += snprintf(state_buf + len, sizeof(state_buf) - len, "%s{\"radio\":%d,\"band\":\"%s\",\"antenna\":%u}",
+                        r > 0 ? "," : "", r + 1, get_radio_band(r), get_radio_antenna(r));
+    }
+    if(len < (int)sizeof(state_buf)) {
+        len += snprintf(state_buf + len, sizeof(state_buf) - len, "]}");
+    }
+    return len < (int)sizeof(state_buf) ? state_buf : NULL;
+}
+
+/**
+ * Apply {"radio":1,"antenna":3} and/or {"automode":false}. The radio defaults to 1.
+ * Antenna changes take the same path as the antenna buttons.
+ */
+static bool apply_command(const char *data, size_t len)
+{
+    cJSON *root = cJSON_ParseWithLength(data, len);
+    if(root == NULL) {
+        return false;
+    }
+
+    bool valid = false;
+    const cJSON *automode = cJSON_GetObjectItem(root, "automode");
+    if(cJSON_IsBool(automode)) {
+        set_automode(cJSON_IsTrue(automode));
+        valid = true;
+    }
+
+    const cJSON *antenna = cJSON_GetObjectItem(root, "antenna");
+    const cJSON *radio = cJSON_GetObjectItem(root, "radio");
+    if(cJSON_IsNumber(antenna)) {
+        int radio_number = cJSON_IsNumber(radio) ? (int)cJSON_GetNumberValue(radio) : 1;
+        int antenna_number = (int)cJSON_GetNumberValue(antenna);
+        if(radio_number >= 1 && radio_number <= CONFIG_RADIO_COUNT && antenna_number >= 1 && antenna_number <= get_antenna_count() &&
+           antenna_selection_allowed(radio_number - 1, antenna_number)) {
+            request_manual_antenna(radio_number - 1, antenna_number);
+            valid = true;
+        } else {
+            valid = false;
+        }
+    }
+
+    cJSON_Delete(root);
+    return valid;
+}
+
+/**
+ * Compare in constant time, the time taken does not tell how much of the token was right
+ */
+static bool token_matches(const char *token)
+{
+    const char *expected = CONFIG_LOCAL_SERVER_TOKEN;
+    const size_t len = strlen(expected);
+    uint8_t diff = strlen(token) != len;
+    for(size_t i = 0; i < len; i++) {
+        diff |= (uint8_t)token[i] ^ (uint8_t)expected[i];
+        if(token[i] == '\0') {
+            break;
+        }
+    }
+    return diff == 0;
+}
+
+/**
+ * Commands need LOCAL_SERVER_TOKEN in an X-Auth-Token header or a token query parameter,
+ * browsers cannot set headers on a WebSocket
+ */
+static bool authorized(httpd_req_t *req)
+{
+    char token[MAX_TOKEN_LEN + 1];
+    if(httpd_req_get_hdr_value_str(req, "X-Auth-Token", token, sizeof(token)) == ESP_OK && token_matches(token)) {
+        return true;
+    }
+    char query[MAX_TOKEN_LEN + 16];
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+       httpd_query_key_value(query, "token", token, sizeof(token)) == ESP_OK && token_matches(token)) {
+        return true;
+    }
+    ESP_LOGW(TAG, "Rejected a request without a valid token");
+    return false;
+}
+
+static esp_err_t send_state(httpd_req_t *req)
+{
+    const char *json = state_json();
+    if(json == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t state_get_handler(httpd_req_t *req)
+{
+    return send_state(req);
+}
+
+static esp_err_t command_post_handler(httpd_req_t *req)
+{
+    if(!authorized(req)) {
+        return httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Bad token");
+    }
+
+    char buf[MAX_COMMAND_LEN];
+    if(req->content_len == 0 || req->content_len >= sizeof(buf)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad length");
+    }
+
+    size_t received = 0;
+    while(received < req->content_len) {
+        int ret = httpd_req_recv(req, buf + received, req->content_len - received);
+        if(ret <= 0) {
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+
+    if(!apply_command(buf, received)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad command");
+    }
+    return send_state(req);
+}
+
+/**
+ * Subscribers get the state on connect and after every change, they can send
+ * the same commands as the REST API. The token is checked on the handshake,
+ * failing it closes the connection before any frame is read.
+ */
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    if(req->method == HTTP_GET) {
+        if(!authorized(req)) {
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "Subscriber connected");
+        local_server_notify();
+        return ESP_OK;
+    }
+
+    uint8_t buf[MAX_COMMAND_LEN];
+    httpd_ws_frame_t frame = {
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = buf,
+    };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, sizeof(buf));
+    if(err != ESP_OK) {
+        return err;
+    }
+    if(frame.type == HTTPD_WS_TYPE_TEXT && !apply_command((const char *)buf, frame.len)) {
+        ESP_LOGW(TAG, "Bad command: %.*s", (int)frame.len, (const char *)buf);
+    }
+    return ESP_OK;
+}
+
+static void push_state_work(void *arg)
+{
+    int fds[CONFIG_LWIP_MAX_SOCKETS];
+    size_t count = sizeof(fds) / sizeof(fds[0]);
+
+    push_queued = false;
+    const char *json = state_json();
+    if(json == NULL || httpd_get_client_list(server, &count, fds) != ESP_OK) {
+        return;
+    }
+
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)json,
+        .len = strlen(json),
+    };
+    for(size_t i = 0; i < count; i++) {
+        if(httpd_ws_get_fd_info(server, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET) {
+            httpd_ws_send_frame_async(server, fds[i], &frame);
+        }
+    }
+}
+
+/**
+ * Push the state to the WebSocket subscribers. Changes that come in before the
+ * push runs are sent together.
+ */
+void local_server_notify()
+{
+    if(server == NULL || push_queued) {
+        return;
+    }
+    push_queued = true;
+    if(httpd_queue_work(server, push_state_work, NULL) != ESP_OK) {
+        push_queued = false;
+    }
+}
+
+void init_local_server()
+{
+    if(strlen(CONFIG_LOCAL_SERVER_TOKEN) == 0) {
+        ESP_LOGE(TAG, "LOCAL_SERVER_TOKEN is empty, local control stays off");
+        return;
+    }
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_LOCAL_SERVER_PORT;
+
+    if(httpd_start(&server, &config) != ESP_OK) {
+        ESP_LOGE(TAG, "Could not start the local server");
+        server = NULL;
+        return;
+    }
+
+    const httpd_uri_t uris[] = {
+        { .uri = "/api/state", .method = HTTP_GET, .handler = state_get_handler },
+        { .uri = "/api/command", .method = HTTP_POST, .handler = command_post_handler },
+        { .uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .is_websocket = true },
+    };
+    for(size_t i = 0; i < sizeof(uris) / sizeof(uris[0]); i++) {
+        httpd_register_uri_handler(server, &uris[i]);
+    }
+    ESP_LOGI(TAG, "Local control on port %d", CONFIG_LOCAL_SERVER_PORT);
+}
+
+#else
+
+void init_local_server() {}
+void local_server_notify() {}
+
+#endif
@@ -0,0 +1,4 @@
+#pragma once
+
+void init_local_server();
+void local_server_notify();
@@ -14,6 +14,7 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "esp_wifi.h"
 #include "esp_system.h"
@@ -32,12 +33,25 @@
 #include "config.h"
 #include "websocket_client.h"
 #include "ethernet_init.h"
+#include "wifi.h"
+#include "network.h"
+#include "event_journal.h"
+#include "clock_sync.h"
+#include "system_state.h"
+#include "telemetry.h"
 #include "antenna_control.h"
-#include "kenwood_band_decoder.h"
+#include "band_decoder.h"
+#include "cat_proxy.h"
+#include "cat_capture.h"
+#include "power_save.h"
+#include "switch_trace.h"
+#include "local_server.h"
+#include "heap_guard.h"
 
 static const char *TAG = "antenna_switch_client";
 
 #define CONFIG_FILE "config.json"
+#define MAX_CONFIG_SIZE (16 * 1024)
 
 /**
  * Task that blinks a led to indicate something went wrong parsing the config file
@@ -45,6 +59,7 @@ static const char *TAG = "antenna_switch_client";
 static void error_task()
 {
     bool level = true;
+    gpio_set_direction(CONFIG_AUTOMODE_PIN_LED, GPIO_MODE_OUTPUT);
     while(true) {
         gpio_set_level(CONFIG_AUTOMODE_PIN_LED, level);
         level = !level;
@@ -52,6 +67,13 @@ static void error_task()
     }
 }
 
+static void start_error_task()
+{
+    static StaticTask_t error_tcb;
+    static StackType_t error_stack[1024 * 2];
+    xTaskCreateStatic(error_task, "error_task", sizeof(error_stack), NULL, configMAX_PRIORITIES, error_stack, &error_tcb);
+}
+
 void app_main(void)
 {
     ESP_LOGI(TAG, "[APP] Startup..");
@@ -74,48 +96,69 @@ void app_main(void)
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    init_antenna_control();
+    init_switch_trace();
 
     if(init_sd_card() != ESP_OK) {
-        xTaskCreate(error_task, "error_task", 1024 * 2, NULL, configMAX_PRIORITIES, NULL);
+        start_error_task();
         return;
     }
 
-    char config_buf[1024];
-    if(read_file(CONFIG_FILE, config_buf) != ESP_OK) {
+    // Only needed until the configuration is parsed
+    const long config_size = sd_card_file_size(CONFIG_FILE);
+    char *config_buf = config_size >= 0 && config_size <= MAX_CONFIG_SIZE ? malloc(config_size + 1) : NULL;
+    if(config_buf == NULL || read_file(CONFIG_FILE, config_buf, config_size + 1) != ESP_OK) {
+        ESP_LOGE(TAG, "%s missing or larger than %d bytes", CONFIG_FILE, MAX_CONFIG_SIZE);
+        free(config_buf);
         deinit_sd_card();
-        xTaskCreate(error_task, "error_task", 1024 * 2, NULL, configMAX_PRIORITIES, NULL);
+        start_error_task();
         return;
     }
-    
+
     Config myconfig = { .server_ip = {}, .use_wifi = false };
-    if(!parse_config(config_buf, &myconfig)) {
+    for(uint8_t radio = 0; radio < CONFIG_RADIO_COUNT; radio++) {
+        band_decoder_default_config(radio, &myconfig.radios[radio]);
+    }
+    antenna_table_default(&myconfig.antennas);
+    const bool config_valid = parse_config(config_buf, &myconfig);
+    free(config_buf);
+    if(!config_valid) {
         deinit_sd_card();
-        xTaskCreate(error_task, "error_task", 1024 * 2, NULL, configMAX_PRIORITIES, NULL);
+        start_error_task();
         return;
     }
 
-    deinit_sd_card();
-
-    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
-     * Read "Establishing Wi-Fi or Ethernet Connection" section in
-     * examples/protocols/README.md for more information about this function.
-     */
-    // ESP_ERROR_CHECK(example_connect());
-
-    // if(myconfig.use_wifi) {
-    //     // connect_wifi();
-    // } else {
-        // ESP_LOGI(TAG, "Ethernet connection not yet supported");
+    /* The card stays mounted for the journal and the CAT capture */
+    const bool journal = init_event_journal();
+    const bool capture = init_cat_capture();
+    if(!journal && !capture) {
+        deinit_sd_card();
+    }
 
-    ethernet_init();
-    
-    // // Create default event loop that running in background
-    // ESP_ERROR_CHECK(esp_event_loop_create_default());
+    if(init_antenna_control(&myconfig.antennas) != ESP_OK) {
+        start_error_task();
+        return;
+    }
 
-    // }
+    /* Ethernet and Wi-Fi both stay up when Wi-Fi is used, the standby takes over the
+     * server session when the primary link drops */
+    init_network(myconfig.use_wifi && myconfig.wifi.primary ? UPLINK_WIFI : UPLINK_ETHERNET);
+    network_add_uplink(UPLINK_ETHERNET, ethernet_init(), &myconfig.ethernet);
+    if(myconfig.use_wifi) {
+        network_add_uplink(UPLINK_WIFI, wifi_init(&myconfig.wifi), &myconfig.wifi.ip);
+    }
 
-    init_band_decoder();
+    for(uint8_t radio = 0; radio < CONFIG_RADIO_COUNT; radio++) {
+        init_band_decoder(&myconfig.radios[radio]);
+    }
+    init_cat_proxy(&myconfig.radios[0]);
+    init_power_save();
 
+    init_local_server();
+    init_clock_sync();
+    init_system_state();
+    init_telemetry();
     websocket_client_connect(myconfig.server_ip);
+
+    /* Everything the switching path needs is allocated now */
+    heap_guard_arm();
 }
\ No newline at end of file
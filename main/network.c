@@ -0,0 +1,493 @@
+#include "network.h"
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_eth.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "lwip/etharp.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "websocket_client.h"
+#include "event_journal.h"
+
+static const char *TAG = "network";
+
+static const char* const UplinkStr[] = {"Ethernet", "Wi-Fi"};
+
+#define FAILBACK_HOLD_US ((int64_t)CONFIG_NETWORK_FAILBACK_HOLD_MS * 1000)
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+typedef enum {
+    ADDRESS_DHCP,
+    ADDRESS_STATIC,
+    ADDRESS_CACHED_LEASE,   /* the last DHCP lease, used until the gateway check fails or the link drops */
+} address_mode_t;
+
+static const char* const AddressModeStr[] = {"DHCP", "static address", "cached lease"};
+
+static esp_netif_t *uplink_netif[UPLINK_COUNT];
+static bool uplink_up[UPLINK_COUNT];
+static int64_t uplink_up_since[UPLINK_COUNT];
+static int64_t link_up_at[UPLINK_COUNT];
+static address_mode_t address_mode[UPLINK_COUNT];
+static uplink_t primary_uplink = UPLINK_ETHERNET;
+static uplink_t active_uplink = UPLINK_NONE;
+static bool restart_session = false;
+static int64_t uplink_lost_at;      /* 0 when the server session is not waiting for a new uplink */
+static network_stats_t network_stats;
+static portMUX_TYPE network_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t uplink_task_handle = NULL;
+static StaticTask_t uplink_task_tcb;
+static StackType_t uplink_task_stack[3072];
+static esp_timer_handle_t report_timer;
+
+static void set_uplink_state(uplink_t uplink, bool up)
+{
+    portENTER_CRITICAL(&network_lock);
+    if(uplink_up[uplink] != up) {
+        uplink_up[uplink] = up;
+        uplink_up_since[uplink] = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&network_lock);
+    xTaskNotifyGive(uplink_task_handle);
+}
+
+/**
+ * Replace DHCP with a fixed address
+ */
+static void apply_ip_config(esp_netif_t *netif, const network_ip_config_t *config)
+{
+    esp_netif_dhcpc_stop(netif);
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(netif, &config->ip_info));
+    if(config->dns.addr != 0) {
+        esp_netif_dns_info_t dns = {
+            .ip.type = ESP_IPADDR_TYPE_V4,
+            .ip.u_addr.ip4 = config->dns,
+        };
+        esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+}
+
+#if CONFIG_NETWORK_LEASE_CACHE
+
+#define LEASE_VERSION 2
+#define LEASE_CHECK_INTERVAL_US (100 * 1000)
+#define LEASE_CHECK_TRIES ((CONFIG_NETWORK_LEASE_CHECK_MS + 99) / 100)
+
+static const char *nvs_namespace = "network";
+static const char* const LeaseKey[] = {"eth_lease", "wifi_lease"};
+
+/**
+ * The last DHCP lease of an uplink
+ */
+typedef struct {
+    uint8_t version;
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} cached_lease_t;
+
+typedef struct {
+    esp_netif_t *netif;
+    esp_ip4_addr_t gateway;
+    bool answered;
+} gateway_probe_t;
+
+static cached_lease_t cached_lease[UPLINK_COUNT];
+static esp_timer_handle_t lease_check_timer[UPLINK_COUNT];
+static int lease_check_tries[UPLINK_COUNT];
+
+static bool load_lease(uplink_t uplink, cached_lease_t *lease)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof(*lease);
+    if(nvs_open(nvs_namespace, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(nvs, LeaseKey[uplink], lease, &size);
+    nvs_close(nvs);
+    return err == ESP_OK && size == sizeof(*lease) && lease->version == LEASE_VERSION && lease->ip_info.ip.addr != 0;
+}
+
+static void store_lease(uplink_t uplink, const cached_lease_t *lease)
+{
+    nvs_handle_t nvs;
+    if(nvs_open(nvs_namespace, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = lease == NULL ? nvs_erase_key(nvs, LeaseKey[uplink]) : nvs_set_blob(nvs, LeaseKey[uplink], lease, sizeof(*lease));
+    if(err == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+/**
+ * Remember a lease handed out by DHCP, flash is only written when it changed
+ */
+static void cache_dhcp_lease(uplink_t uplink, const esp_netif_ip_info_t *ip_info)
+{
+    cached_lease_t lease = {
+        .version = LEASE_VERSION,
+        .ip_info = *ip_info,
+    };
+    esp_netif_dns_info_t dns;
+    if(esp_netif_get_dns_info(uplink_netif[uplink], ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        lease.dns = dns.ip.u_addr.ip4;
+    }
+    if(memcmp(&lease, &cached_lease[uplink], sizeof(lease)) != 0) {
+        cached_lease[uplink] = lease;
+        store_lease(uplink, &lease);
+    }
+}
+
+/**
+ * Runs in the TCP/IP task. Looks the gateway up in the ARP table and asks for it
+ * when it is not there yet.
+ */
+static esp_err_t probe_gateway(void *ctx)
+{
+    gateway_probe_t *probe = (gateway_probe_t *)ctx;
+    struct netif *netif = esp_netif_get_netif_impl(probe->netif);
+    const ip4_addr_t *gateway = (const ip4_addr_t *)&probe->gateway;
+    struct eth_addr *eth_ret;
+    const ip4_addr_t *ip_ret;
+
+    probe->answered = etharp_find_addr(netif, gateway, &eth_ret, &ip_ret) >= 0;
+    if(!probe->answered) {
+        etharp_request(netif, gateway);
+    }
+    return ESP_OK;
+}
+
+/**
+ * Background check of a cached lease: when the gateway does not answer ARP we are
+ * on another network, the lease is dropped and DHCP takes over. When it answers
+ * the lease stays in use until the link drops. DHCP is not started next to it,
+ * esp_netif clears the address when it starts the client.
+ */
+static void lease_check_cb(void *arg)
+{
+    const uplink_t uplink = (uplink_t)(intptr_t)arg;
+    gateway_probe_t probe = {
+        .netif = uplink_netif[uplink],
+        .gateway = cached_lease[uplink].ip_info.gw,
+    };
+    esp_netif_tcpip_exec(probe_gateway, &probe);
+
+    if(probe.answered) {
+        ESP_LOGI(TAG, "%s gateway answered, keeping the cached lease", UplinkStr[uplink]);
+    } else if(++lease_check_tries[uplink] < LEASE_CHECK_TRIES) {
+        esp_timer_start_once(lease_check_timer[uplink], LEASE_CHECK_INTERVAL_US);
+    } else {
+        ESP_LOGW(TAG, "%s gateway " IPSTR " did not answer, using DHCP", UplinkStr[uplink], IP2STR(&probe.gateway));
+        address_mode[uplink] = ADDRESS_DHCP;
+        memset(&cached_lease[uplink], 0, sizeof(cached_lease[uplink]));
+        store_lease(uplink, NULL);
+        set_uplink_state(uplink, false);
+        esp_netif_dhcpc_start(uplink_netif[uplink]);
+    }
+}
+
+static void start_lease_check(uplink_t uplink)
+{
+    lease_check_tries[uplink] = 0;
+    esp_timer_stop(lease_check_timer[uplink]);
+    esp_timer_start_once(lease_check_timer[uplink], 0);
+}
+
+/**
+ * The link of an uplink on its cached lease dropped: the address is of no use until
+ * the link is back, so DHCP is started now and renews the lease on the next link up.
+ * lwIP asks for the last address right away (INIT-REBOOT), which saves the discover.
+ */
+static void renew_on_link_up(uplink_t uplink)
+{
+    if(lease_check_timer[uplink] != NULL) {
+        esp_timer_stop(lease_check_timer[uplink]);
+    }
+    if(address_mode[uplink] == ADDRESS_CACHED_LEASE) {
+        address_mode[uplink] = ADDRESS_DHCP;
+        esp_netif_dhcpc_start(uplink_netif[uplink]);
+    }
+}
+
+/**
+ * Configure the last DHCP lease as a fixed address so the uplink is usable as
+ * soon as its link is up
+ */
+static bool use_cached_lease(uplink_t uplink)
+{
+    cached_lease_t lease;
+    if(!load_lease(uplink, &lease)) {
+        return false;
+    }
+    cached_lease[uplink] = lease;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = lease_check_cb,
+        .arg = (void *)(intptr_t)uplink,
+        .name = "lease_check",
+    };
+    if(lease_check_timer[uplink] == NULL && esp_timer_create(&timer_args, &lease_check_timer[uplink]) != ESP_OK) {
+        return false;
+    }
+
+    const network_ip_config_t config = {
+        .static_ip = true,
+        .ip_info = lease.ip_info,
+        .dns = lease.dns,
+    };
+    apply_ip_config(uplink_netif[uplink], &config);
+    ESP_LOGI(TAG, "%s uses its cached lease " IPSTR, UplinkStr[uplink], IP2STR(&lease.ip_info.ip));
+    return true;
+}
+
+#else
+
+static void cache_dhcp_lease(uplink_t uplink, const esp_netif_ip_info_t *ip_info) {}
+static void start_lease_check(uplink_t uplink) {}
+static void renew_on_link_up(uplink_t uplink) {}
+static bool use_cached_lease(uplink_t uplink) { return false; }
+
+#endif
+
+static void link_up(uplink_t uplink)
+{
+    link_up_at[uplink] = esp_timer_get_time();
+}
+
+static void link_down(uplink_t uplink)
+{
+    renew_on_link_up(uplink);
+    set_uplink_state(uplink, false);
+}
+
+/**
+ * Logs the time from link up to a usable address, keeps new DHCP leases and starts
+ * the gateway check of a cached one
+ */
+static void got_ip(uplink_t uplink, const ip_event_got_ip_t *event)
+{
+    const int64_t ready = esp_timer_get_time() - link_up_at[uplink];
+    portENTER_CRITICAL(&network_lock);
+    network_stats.ip_ready_us[uplink] = ready;
+    if(event->ip_changed && uplink == active_uplink) {
+        restart_session = true;
+    }
+    portEXIT_CRITICAL(&network_lock);
+    ESP_LOGI(TAG, "%s address " IPSTR " from %s, %" PRId64 "ms after link up", UplinkStr[uplink],
+             IP2STR(&event->ip_info.ip), AddressModeStr[address_mode[uplink]], ready / 1000);
+
+    if(address_mode[uplink] == ADDRESS_DHCP) {
+        cache_dhcp_lease(uplink, &event->ip_info);
+    } else if(address_mode[uplink] == ADDRESS_CACHED_LEASE) {
+        start_lease_check(uplink);
+    }
+    set_uplink_state(uplink, true);
+}
+
+/**
+ * An uplink is up once it has an address and down as soon as its link drops,
+ * the IP lost events alone come far too late for a failover.
+ */
+static void network_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if(event_base == ETH_EVENT) {
+        if(event_id == ETHERNET_EVENT_CONNECTED) {
+            link_up(UPLINK_ETHERNET);
+        } else if(event_id == ETHERNET_EVENT_DISCONNECTED) {
+            link_down(UPLINK_ETHERNET);
+        }
+    } else if(event_base == WIFI_EVENT) {
+        if(event_id == WIFI_EVENT_STA_CONNECTED) {
+            link_up(UPLINK_WIFI);
+        } else if(event_id == WIFI_EVENT_STA_DISCONNECTED) {
+            link_down(UPLINK_WIFI);
+        }
+    } else if(event_base == IP_EVENT) {
+        switch(event_id) {
+        case IP_EVENT_ETH_GOT_IP:
+            got_ip(UPLINK_ETHERNET, (ip_event_got_ip_t *)event_data);
+            break;
+        case IP_EVENT_ETH_LOST_IP:
+            set_uplink_state(UPLINK_ETHERNET, false);
+            break;
+        case IP_EVENT_STA_GOT_IP:
+            got_ip(UPLINK_WIFI, (ip_event_got_ip_t *)event_data);
+            break;
+        case IP_EVENT_STA_LOST_IP:
+            set_uplink_state(UPLINK_WIFI, false);
+            break;
+        }
+    }
+}
+
+/**
+ * Pick the uplink to use: the primary once it has been up for the failback hold
+ * time or when nothing else is up, otherwise the standby. Returns how long to wait
+ * before the primary may be picked.
+ */
+static uplink_t pick_uplink(int64_t now, TickType_t *wait)
+{
+    const uplink_t standby = primary_uplink == UPLINK_ETHERNET ? UPLINK_WIFI : UPLINK_ETHERNET;
+    uplink_t pick = UPLINK_NONE;
+    *wait = portMAX_DELAY;
+
+    portENTER_CRITICAL(&network_lock);
+    const bool standby_up = uplink_netif[standby] != NULL && uplink_up[standby];
+    if(uplink_netif[primary_uplink] != NULL && uplink_up[primary_uplink]) {
+        const int64_t up_for = now - uplink_up_since[primary_uplink];
+        if(!standby_up || active_uplink != standby || up_for >= FAILBACK_HOLD_US) {
+            pick = primary_uplink;
+        } else {
+            *wait = pdMS_TO_TICKS((FAILBACK_HOLD_US - up_for) / 1000) + 1;
+        }
+    }
+    if(pick == UPLINK_NONE && standby_up) {
+        pick = standby;
+    }
+    portEXIT_CRITICAL(&network_lock);
+    return pick;
+}
+
+/**
+ * Moves the default route and the server session to the best uplink that is up.
+ * The WebSocket is restarted right away instead of waiting for its socket on the
+ * dead interface to time out.
+ */
+static void uplink_task()
+{
+    TickType_t wait = portMAX_DELAY;
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        const int64_t now = esp_timer_get_time();
+        const uplink_t pick = pick_uplink(now, &wait);
+        if(pick == active_uplink) {
+            portENTER_CRITICAL(&network_lock);
+            const bool restart = restart_session;
+            restart_session = false;
+            portEXIT_CRITICAL(&network_lock);
+            if(restart && pick != UPLINK_NONE) {
+                ESP_LOGW(TAG, "%s address changed", UplinkStr[pick]);
+                websocket_client_restart();
+            }
+            continue;
+        }
+
+        const uplink_t previous = active_uplink;
+        portENTER_CRITICAL(&network_lock);
+        if(previous != UPLINK_NONE && !uplink_up[previous] && uplink_lost_at == 0) {
+            uplink_lost_at = now;
+        }
+        if(previous != UPLINK_NONE && pick != UPLINK_NONE) {
+            network_stats.failovers++;
+        }
+        active_uplink = pick;
+        restart_session = false;
+        portEXIT_CRITICAL(&network_lock);
+        event_journal_log(JOURNAL_UPLINK, JOURNAL_NO_RADIO, pick);
+
+        if(pick == UPLINK_NONE) {
+            ESP_LOGW(TAG, "%s is down, no uplink left", UplinkStr[previous]);
+            continue;
+        }
+        if(previous == UPLINK_NONE) {
+            ESP_LOGI(TAG, "Using %s", UplinkStr[pick]);
+        } else {
+            ESP_LOGW(TAG, "Switching from %s to %s", UplinkStr[previous], UplinkStr[pick]);
+        }
+        esp_netif_set_default_netif(uplink_netif[pick]);
+        websocket_client_restart();
+    }
+}
+
+/**
+ * Called when the server session is up. Reports the recovery time when the
+ * session had been lost with its uplink.
+ */
+void network_session_restored()
+{
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&network_lock);
+    const int64_t lost_at = uplink_lost_at;
+    const uplink_t uplink = active_uplink;
+    int64_t recovery = 0;
+    if(lost_at != 0) {
+        recovery = now - lost_at;
+        uplink_lost_at = 0;
+        network_stats.recoveries++;
+        network_stats.last_recovery_us = recovery;
+        if(recovery > network_stats.max_recovery_us) {
+            network_stats.max_recovery_us = recovery;
+        }
+    }
+    portEXIT_CRITICAL(&network_lock);
+
+    if(lost_at != 0 && uplink != UPLINK_NONE) {
+        ESP_LOGW(TAG, "Server session back over %s %" PRId64 "ms after link loss", UplinkStr[uplink], recovery / 1000);
+    }
+}
+
+void network_get_stats(network_stats_t *stats)
+{
+    portENTER_CRITICAL(&network_lock);
+    *stats = network_stats;
+    portEXIT_CRITICAL(&network_lock);
+}
+
+static void report_stats(void *arg)
+{
+    network_stats_t stats;
+    network_get_stats(&stats);
+    ESP_LOGI(TAG, "%" PRIu32 " failovers, %" PRIu32 " recoveries, last %" PRId64 "ms max %" PRId64 "ms; address ready %" PRId64 "ms after link up on Ethernet, %" PRId64 "ms on Wi-Fi",
+             stats.failovers, stats.recoveries, stats.last_recovery_us / 1000, stats.max_recovery_us / 1000,
+             stats.ip_ready_us[UPLINK_ETHERNET] / 1000, stats.ip_ready_us[UPLINK_WIFI] / 1000);
+}
+
+/**
+ * Hand an interface to the failover logic. Its address comes from the configuration,
+ * from the cached DHCP lease or from DHCP, in that order.
+ */
+void network_add_uplink(uplink_t uplink, esp_netif_t *netif, const network_ip_config_t *config)
+{
+    if(uplink >= UPLINK_COUNT || netif == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&network_lock);
+    uplink_netif[uplink] = netif;
+    portEXIT_CRITICAL(&network_lock);
+
+    if(config != NULL && config->static_ip) {
+        address_mode[uplink] = ADDRESS_STATIC;
+        apply_ip_config(netif, config);
+        ESP_LOGI(TAG, "%s static address " IPSTR, UplinkStr[uplink], IP2STR(&config->ip_info.ip));
+    } else if(use_cached_lease(uplink)) {
+        address_mode[uplink] = ADDRESS_CACHED_LEASE;
+    } else {
+        address_mode[uplink] = ADDRESS_DHCP;
+    }
+    xTaskNotifyGive(uplink_task_handle);
+}
+
+/**
+ * Call before the interfaces are started so no link event is missed
+ */
+void init_network(uplink_t primary)
+{
+    primary_uplink = primary == UPLINK_WIFI ? UPLINK_WIFI : UPLINK_ETHERNET;
+    uplink_task_handle = xTaskCreateStatic(uplink_task, "uplink_task", sizeof(uplink_task_stack), NULL, 10,
+                                           uplink_task_stack, &uplink_task_tcb);
+
+    ESP_ERROR_CHECK(esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID, &network_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &network_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &network_event_handler, NULL));
+    const esp_timer_create_args_t report_args = {
+        .callback = report_stats,
+        .name = "network_report",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &report_timer));
+    esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+    ESP_LOGI(TAG, "%s is the primary uplink", UplinkStr[primary_uplink]);
+}
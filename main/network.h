@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_netif.h"
+
+typedef enum {
+    UPLINK_ETHERNET,
+    UPLINK_WIFI,
+    UPLINK_COUNT,
+    UPLINK_NONE = UPLINK_COUNT,
+} uplink_t;
+
+/**
+ * Fixed address of an interface, DHCP is used when static_ip is false
+ */
+typedef struct {
+    bool static_ip;
+    esp_netif_ip_info_t ip_info;
+    esp_ip4_addr_t dns;
+} network_ip_config_t;
+
+/**
+ * Uplink switches and the time from losing the active uplink until the
+ * server session was up again, in microseconds. ip_ready_us is the time
+ * from the last link up to a usable address per uplink.
+ */
+typedef struct {
+    uint32_t failovers;
+    uint32_t recoveries;
+    int64_t last_recovery_us;
+    int64_t max_recovery_us;
+    int64_t ip_ready_us[UPLINK_COUNT];
+} network_stats_t;
+
+void init_network(uplink_t primary);
+void network_add_uplink(uplink_t uplink, esp_netif_t *netif, const network_ip_config_t *config);
+void network_session_restored();
+void network_get_stats(network_stats_t *stats);
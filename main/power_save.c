@@ -0,0 +1,171 @@
+#include "power_save.h"
+#include <string.h>
+#include "esp_log.h"
+
+#if CONFIG_POWER_SAVE
+
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
+
+static const char *TAG = "power_save";
+
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+/* The crystal of the ESP32 modules, the CPU runs from it when nothing holds a lock */
+#define MIN_FREQ_MHZ 40
+
+static esp_pm_lock_handle_t awake_lock;
+static power_save_stats_t power_stats;
+static portMUX_TYPE power_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t planned_sleep_us;
+static int64_t early_wake_at;       /* 0 when the last early wake has been handled */
+static esp_timer_handle_t report_timer;
+
+static esp_err_t IRAM_ATTR sleep_enter_cb(int64_t sleep_time_us, void *arg)
+{
+    planned_sleep_us = sleep_time_us;
+    return ESP_OK;
+}
+
+static esp_err_t IRAM_ATTR sleep_exit_cb(int64_t sleep_time_us, void *arg)
+{
+    portENTER_CRITICAL_ISR(&power_lock);
+    power_stats.sleeps++;
+    power_stats.asleep_us += sleep_time_us;
+    if(sleep_time_us < planned_sleep_us) {
+        power_stats.early_wakes++;
+        early_wake_at = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL_ISR(&power_lock);
+    return ESP_OK;
+}
+
+/**
+ * Called with the time a UART event was picked up, the first after an early wake
+ * gives the wake latency
+ */
+void power_save_wake_handled(int64_t handled_at)
+{
+    portENTER_CRITICAL(&power_lock);
+    if(early_wake_at != 0) {
+        const int64_t latency = handled_at - early_wake_at;
+        if(latency > power_stats.wake_latency_max_us) {
+            power_stats.wake_latency_max_us = latency;
+        }
+        early_wake_at = 0;
+    }
+    portEXIT_CRITICAL(&power_lock);
+}
+
+/**
+ * Keep the CPU out of light sleep, counted: every true needs a false
+ */
+void power_save_stay_awake(bool awake)
+{
+    if(awake_lock == NULL) {
+        return;
+    }
+    if(awake) {
+        esp_pm_lock_acquire(awake_lock);
+    } else {
+        esp_pm_lock_release(awake_lock);
+    }
+}
+
+/**
+ * Time the CAT poll keeps the CPU awake for the answer. A UART loses the bytes
+ * that wake the CPU, answers to polls must not be one of those.
+ */
+TickType_t power_save_reply_window()
+{
+    return pdMS_TO_TICKS(CONFIG_POWER_SAVE_REPLY_WINDOW_MS);
+}
+
+void power_save_get_stats(power_save_stats_t *stats)
+{
+    portENTER_CRITICAL(&power_lock);
+    *stats = power_stats;
+    portEXIT_CRITICAL(&power_lock);
+}
+
+static void report_cb(void *arg)
+{
+    power_save_stats_t stats;
+    power_save_get_stats(&stats);
+    const int64_t uptime = esp_timer_get_time();
+    ESP_LOGI(TAG, "Asleep %" PRId64 ".%" PRId64 "%% of %" PRId64 " s, %" PRIu32 " sleeps, %" PRIu32 " early wakes, longest wake latency %" PRId64 "us",
+             stats.asleep_us * 100 / uptime, stats.asleep_us * 1000 / uptime % 10, uptime / 1000000,
+             stats.sleeps, stats.early_wakes, stats.wake_latency_max_us);
+}
+
+static void enable_uart_wakeup(int uart_num)
+{
+    uart_set_wakeup_threshold(uart_num, 3);
+    if(esp_sleep_enable_uart_wakeup(uart_num) != ESP_OK) {
+        ESP_LOGW(TAG, "UART %d cannot wake the CPU, it is only read after other wakes", uart_num);
+    }
+}
+
+/**
+ * Switch to automatic light sleep. Wakes come from the CAT UARTs, the button GPIOs,
+ * the W5500 interrupt and the timers of the tasks.
+ */
+void init_power_save()
+{
+    const esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = MIN_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot enable light sleep (%s)", esp_err_to_name(err));
+        return;
+    }
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "cat_reply", &awake_lock);
+
+    esp_pm_sleep_cbs_register_config_t cbs = {
+        .enter_cb = sleep_enter_cb,
+        .exit_cb = sleep_exit_cb,
+    };
+    esp_pm_light_sleep_register_cbs(&cbs);
+
+    enable_uart_wakeup(CONFIG_RADIO1_UART_NUM);
+#if CONFIG_RADIO_COUNT > 1
+    enable_uart_wakeup(CONFIG_RADIO2_UART_NUM);
+#endif
+#if CONFIG_CAT_PROXY
+    enable_uart_wakeup(CONFIG_CAT_PROXY_UART_NUM);
+#endif
+
+    // The automode button wakes through the button component, the W5500 interrupt through
+    // the RTC domain so its GPIO interrupt stays edge triggered for the driver
+    esp_sleep_enable_gpio_wakeup();
+    if(rtc_gpio_is_valid_gpio(CONFIG_ETHERNET_SPI_INTERRUPT)) {
+        esp_sleep_enable_ext0_wakeup(CONFIG_ETHERNET_SPI_INTERRUPT, 0);
+    } else {
+        ESP_LOGW(TAG, "W5500 interrupt GPIO %d cannot wake the CPU, staying out of light sleep", CONFIG_ETHERNET_SPI_INTERRUPT);
+        esp_pm_lock_acquire(awake_lock);
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = report_cb,
+        .name = "power_report",
+    };
+    esp_timer_create(&timer_args, &report_timer);
+    esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+    ESP_LOGI(TAG, "Light sleep enabled, band changes are seen within %d ms", CONFIG_POWER_SAVE_MAX_LATENCY_MS);
+}
+
+#else
+
+void init_power_save() {}
+void power_save_stay_awake(bool awake) {}
+TickType_t power_save_reply_window() { return 0; }
+void power_save_wake_handled(int64_t handled_at) {}
+void power_save_get_stats(power_save_stats_t *stats) { memset(stats, 0, sizeof(power_save_stats_t)); }
+
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Light sleep counters. A wake is early when something other than a timer ended
+ * the sleep, wake latency is from then to the first UART event handled.
+ */
+typedef struct {
+    uint32_t sleeps;
+    uint32_t early_wakes;
+    int64_t asleep_us;
+    int64_t wake_latency_max_us;
+} power_save_stats_t;
+
+void init_power_save();
+void power_save_stay_awake(bool awake);
+TickType_t power_save_reply_window();
+void power_save_wake_handled(int64_t handled_at);
+void power_save_get_stats(power_save_stats_t *stats);
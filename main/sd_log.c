@@ -0,0 +1,274 @@
+#include "sd_log.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "sdcard.h"
+
+static const char *TAG = "sd_log";
+
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+static void ring_put(sd_log_t *log, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    const size_t first = len < log->ring_size - log->ring_head ? len : log->ring_size - log->ring_head;
+    memcpy(&log->ring[log->ring_head], bytes, first);
+    memcpy(log->ring, bytes + first, len - first);
+    log->ring_head = (log->ring_head + len) % log->ring_size;
+    log->ring_count += len;
+}
+
+static void ring_copy(const sd_log_t *log, uint32_t offset, uint8_t *out, size_t len)
+{
+    for(size_t i = 0; i < len; i++) {
+        out[i] = log->ring[(offset + i) % log->ring_size];
+    }
+}
+
+/**
+ * Queue a record of a header and optional data. Takes a fixed, small number of
+ * cycles plus the copy, under a spinlock. Records are dropped and counted when
+ * the ring is full.
+ */
+bool sd_log_queue(sd_log_t *log, const void *header, size_t header_len, const void *data, size_t len)
+{
+    const uint32_t start = esp_cpu_get_cycle_count();
+    bool queued = false;
+    bool wake = false;
+
+    portENTER_CRITICAL(&log->lock);
+    if(log->ring_count + header_len + len <= log->ring_size) {
+        const bool below = log->ring_count < log->ring_size * 3 / 4;
+        ring_put(log, header, header_len);
+        if(len > 0) {
+            ring_put(log, data, len);
+        }
+        log->stats.records++;
+        log->stats.bytes_queued += header_len + len;
+        wake = below && log->ring_count >= log->ring_size * 3 / 4;
+        queued = true;
+    } else {
+        log->stats.dropped++;
+    }
+    const uint32_t cycles = esp_cpu_get_cycle_count() - start;
+    if(cycles > log->stats.queue_max_cycles) {
+        log->stats.queue_max_cycles = cycles;
+    }
+    portEXIT_CRITICAL(&log->lock);
+
+    if(wake && log->task != NULL) {
+        xTaskNotifyGive(log->task);
+    }
+    return queued;
+}
+
+void sd_log_get_stats(sd_log_t *log, sd_log_stats_t *stats)
+{
+    portENTER_CRITICAL(&log->lock);
+    *stats = log->stats;
+    portEXIT_CRITICAL(&log->lock);
+}
+
+static void log_path(const sd_log_t *log, int index, char *path, size_t len)
+{
+    char name[24];
+    if(index == 0) {
+        snprintf(name, sizeof(name), "%s.%s", log->name, log->ext);
+    } else {
+        snprintf(name, sizeof(name), "%s%d.%s", log->name, index, log->ext);
+    }
+    sd_card_path(name, path, len);
+}
+
+static bool open_file(sd_log_t *log, const uint8_t *first)
+{
+    char path[60];
+    log_path(log, 0, path, sizeof(path));
+    log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(log->fd < 0) {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return false;
+    }
+    struct stat st;
+    log->file_size = fstat(log->fd, &st) == 0 ? st.st_size : 0;
+    if(log->file_size == 0) {
+        log->file_size = log->start_file(log->fd, first);
+        if(log->file_size < 0) {
+            close(log->fd);
+            log->fd = -1;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * The current file becomes file 1 and so on, the oldest file is removed. With a
+ * single file kept the current one is removed and started over.
+ */
+static bool rotate(sd_log_t *log, const uint8_t *first)
+{
+    char from[60];
+    char to[60];
+
+    close(log->fd);
+    log->fd = -1;
+    for(int i = log->files - 1; i >= 1; i--) {
+        log_path(log, i, to, sizeof(to));
+        log_path(log, i - 1, from, sizeof(from));
+        unlink(to);
+        rename(from, to);
+    }
+    log_path(log, 0, from, sizeof(from));
+    unlink(from);
+
+    portENTER_CRITICAL(&log->lock);
+    log->stats.rotations++;
+    portEXIT_CRITICAL(&log->lock);
+    return open_file(log, first);
+}
+
+/**
+ * Append to the current file, rotating first when the bytes do not fit
+ */
+static bool append(sd_log_t *log, const void *data, size_t len, const uint8_t *first)
+{
+    if(log->file_size + (int32_t)len > log->max_file_bytes && !rotate(log, first)) {
+        return false;
+    }
+    if(write(log->fd, data, len) != (ssize_t)len) {
+        return false;
+    }
+    log->file_size += len;
+    return true;
+}
+
+/**
+ * Records as queued, in at most two appends straight from the ring. The producers
+ * only write behind the head, so the queued bytes stay put until they are released.
+ */
+static bool write_raw(sd_log_t *log, uint32_t tail, uint32_t count, const uint8_t *first)
+{
+    if(log->file_size + (int32_t)count > log->max_file_bytes && !rotate(log, first)) {
+        return false;
+    }
+    const uint32_t part = count < log->ring_size - tail ? count : log->ring_size - tail;
+    if(write(log->fd, &log->ring[tail], part) != (ssize_t)part ||
+       (count > part && write(log->fd, log->ring, count - part) != (ssize_t)(count - part))) {
+        return false;
+    }
+    log->file_size += count;
+    return true;
+}
+
+/**
+ * Records turned into lines, appended a write buffer at a time
+ */
+static bool write_formatted(sd_log_t *log, uint32_t tail, uint32_t count, const uint8_t *first, uint32_t *written)
+{
+    uint8_t record[SD_LOG_RECORD_MAX];
+    size_t len = 0;
+    for(uint32_t offset = 0; offset + log->record_size <= count; offset += log->record_size) {
+        if(len + SD_LOG_LINE_MAX > log->write_buffer_size) {
+            if(!append(log, log->write_buffer, len, first)) {
+                return false;
+            }
+            *written += len;
+            len = 0;
+        }
+        ring_copy(log, (tail + offset) % log->ring_size, record, log->record_size);
+        const size_t line = log->format(record, log->write_buffer + len, SD_LOG_LINE_MAX);
+        len += line < SD_LOG_LINE_MAX ? line : SD_LOG_LINE_MAX - 1;
+    }
+    if(len > 0 && !append(log, log->write_buffer, len, first)) {
+        return false;
+    }
+    *written += len;
+    return true;
+}
+
+/**
+ * Move everything queued to the card and sync, so a power loss costs at most the
+ * records of one flush interval
+ */
+static void flush(sd_log_t *log)
+{
+    portENTER_CRITICAL(&log->lock);
+    const uint32_t count = log->ring_count;
+    const uint32_t tail = (log->ring_head + log->ring_size - count) % log->ring_size;
+    portEXIT_CRITICAL(&log->lock);
+
+    if(count == 0) {
+        return;
+    }
+
+    const int64_t start = esp_timer_get_time();
+    uint8_t first[SD_LOG_RECORD_MAX];
+    ring_copy(log, tail, first, count < sizeof(first) ? count : sizeof(first));
+    uint32_t written = 0;
+    bool ok = log->fd >= 0 || open_file(log, first);
+    if(ok && log->format != NULL) {
+        ok = write_formatted(log, tail, count, first, &written);
+    } else if(ok) {
+        ok = write_raw(log, tail, count, first);
+        written = ok ? count : 0;
+    }
+    if(ok) {
+        ok = fsync(log->fd) == 0;
+    }
+    if(!ok && log->fd >= 0) {
+        close(log->fd);
+        log->fd = -1;
+    }
+    const int64_t duration = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&log->lock);
+    log->ring_count -= count;
+    log->stats.flushes++;
+    log->stats.bytes_written += written;
+    if(!ok) {
+        log->stats.write_errors++;
+    }
+    if(duration > log->stats.flush_max_us) {
+        log->stats.flush_max_us = duration;
+    }
+    portEXIT_CRITICAL(&log->lock);
+
+    if(!ok) {
+        ESP_LOGW(TAG, "Writing %" PRIu32 " bytes to %s.%s failed", count, log->name, log->ext);
+    }
+    ESP_LOGD(TAG, "Flushed %" PRIu32 " bytes to %s.%s, %" PRIu32 " written in %" PRId64 "us", count, log->name, log->ext, written, duration);
+}
+
+static void flush_task(void *arg)
+{
+    sd_log_t *log = (sd_log_t *)arg;
+    int64_t reported_at = esp_timer_get_time();
+    for(;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(log->flush_interval_ms));
+        flush(log);
+        if(log->report != NULL && esp_timer_get_time() - reported_at >= REPORT_INTERVAL_US) {
+            reported_at = esp_timer_get_time();
+            log->report();
+        }
+    }
+}
+
+/**
+ * Open the file on the mounted SD card, which then stays mounted, and start the flush task
+ */
+bool sd_log_start(sd_log_t *log, const char *task_name)
+{
+    log->fd = -1;
+    if(!open_file(log, NULL)) {
+        return false;
+    }
+    log->task = xTaskCreateStatic(flush_task, task_name, sizeof(log->task_stack), log, tskIDLE_PRIORITY + 1,
+                                  log->task_stack, &log->task_tcb);
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Longest record format() is given and longest line it may return */
+#define SD_LOG_RECORD_MAX 32
+#define SD_LOG_LINE_MAX 96
+
+/**
+ * Counters of one log. queue_max_cycles is the most CPU cycles one sd_log_queue()
+ * call took, the cost for the task that logs.
+ */
+typedef struct {
+    uint32_t records;
+    uint32_t bytes_queued;
+    uint32_t dropped;           /* ring full, the flush task did not keep up */
+    uint32_t flushes;
+    uint32_t bytes_written;
+    uint32_t rotations;
+    uint32_t write_errors;
+    uint32_t queue_max_cycles;
+    int64_t flush_max_us;
+} sd_log_stats_t;
+
+typedef struct sd_log sd_log_t;
+
+/**
+ * A file on the SD card fed through a RAM ring. Any task queues records, a low
+ * priority task writes them every flush interval in a few large appends and syncs.
+ * At max_file_bytes <name>.<ext> becomes <name>1.<ext> and so on, the oldest of
+ * the files kept is removed and with a single file it is started over. Files are
+ * only cut between records.
+ *
+ * Owned by the caller, which fills in the part up to the state, the state starts
+ * zeroed apart from the lock (portMUX_INITIALIZER_UNLOCKED).
+ */
+struct sd_log {
+    const char *name;
+    const char *ext;
+    uint8_t *ring;
+    uint32_t ring_size;
+    int32_t max_file_bytes;
+    int files;
+    uint32_t flush_interval_ms;
+    /* Writes the start of a new file and returns its length, -1 on error. first is
+       the oldest record that goes into the file, NULL when nothing is queued. */
+    int (*start_file)(int fd, const uint8_t *first);
+    /* Records of record_size bytes are written as the lines format() makes of them,
+       without format() they are written as queued */
+    size_t (*format)(const uint8_t *record, char *line, size_t len);
+    uint32_t record_size;
+    char *write_buffer;         /* for format(), appends are at most this large */
+    size_t write_buffer_size;
+    /* Called from the flush task every minute */
+    void (*report)();
+
+    /* State */
+    portMUX_TYPE lock;
+    uint32_t ring_head;         /* next byte to write */
+    uint32_t ring_count;
+    sd_log_stats_t stats;
+    TaskHandle_t task;
+    StaticTask_t task_tcb;
+    StackType_t task_stack[4096];
+    int fd;                     /* only used by the flush task */
+    int32_t file_size;
+};
+
+bool sd_log_start(sd_log_t *log, const char *task_name);
+bool sd_log_queue(sd_log_t *log, const void *header, size_t header_len, const void *data, size_t len);
+void sd_log_get_stats(sd_log_t *log, sd_log_stats_t *stats);
@@ -90,28 +90,51 @@ esp_err_t deinit_sd_card()
     return ESP_OK;
 }
 
-esp_err_t read_file(const char *file_name, char *buf)
+/**
+ * Full path of a file on the card
+*/
+void sd_card_path(const char *file_name, char *path, size_t len)
 {
-    char full_path[60] = {};
-    strcat(full_path, mount_point);
-    strcat(full_path, "/");
-    strcat(full_path, file_name);
+    snprintf(path, len, "%s/%s", mount_point, file_name);
+}
+
+/**
+ * Size of a file on the card in bytes, -1 when it does not exist
+*/
+long sd_card_file_size(const char *file_name)
+{
+    char path[60];
+    struct stat st;
+    sd_card_path(file_name, path, sizeof(path));
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+/**
+ * Read a whole file into buf as a NUL terminated string. Fails when the file
+ * does not fit in size - 1 bytes.
+*/
+esp_err_t read_file(const char *file_name, char *buf, size_t size)
+{
+    char full_path[60];
+    sd_card_path(file_name, full_path, sizeof(full_path));
     ESP_LOGI(TAG, "Reading file %s", full_path);
 
+    if(size == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
     FILE *f = fopen(full_path, "r");
     if (f == NULL) {
         ESP_LOGE(TAG, "Failed to open file for reading");
         return ESP_FAIL;
     }
 
-    size_t chunksize;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        chunksize = fread(buf, 1, 1024, f);
-
-        /* Keep looping till the whole file is sent */
-    } while (chunksize != 0);
+    const size_t len = fread(buf, 1, size - 1, f);
+    const bool complete = !ferror(f) && fgetc(f) == EOF;
     fclose(f);
-
+    buf[len] = '\0';
+    if(!complete) {
+        ESP_LOGE(TAG, "%s is larger than %u bytes or could not be read", full_path, (unsigned)(size - 1));
+        return ESP_ERR_INVALID_SIZE;
+    }
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stddef.h>
 #include <esp_err.h>
 
 esp_err_t init_sd_card();
 esp_err_t deinit_sd_card();
-esp_err_t read_file(const char *file_name, char *buf);
\ No newline at end of file
+void sd_card_path(const char *file_name, char *path, size_t len);
+long sd_card_file_size(const char *file_name);
+esp_err_t read_file(const char *file_name, char *buf, size_t size);
\ No newline at end of file
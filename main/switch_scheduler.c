@@ -0,0 +1,355 @@
+#include "switch_scheduler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "websocket_client.h"
+#include "udp_fast_path.h"
+#include "switch_trace.h"
+#include "heap_guard.h"
+
+static const char *TAG = "switch_scheduler";
+
+#define SETTLE_US ((int64_t)CONFIG_SWITCH_SETTLE_MS * 1000)
+#define MIN_INTERVAL_US ((int64_t)CONFIG_SWITCH_MIN_INTERVAL_MS * 1000)
+#define TX_RELEASE_US ((int64_t)CONFIG_SWITCH_TX_RELEASE_MS * 1000)
+#define TX_TIMEOUT_US ((int64_t)CONFIG_SWITCH_TX_TIMEOUT_MS * 1000)
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+#if CONFIG_PTT_SENSE_ACTIVE_LOW
+#define PTT_ACTIVE_LEVEL 0
+#else
+#define PTT_ACTIVE_LEVEL 1
+#endif
+
+/**
+ * Pending command of one radio. target is 0 when nothing is pending.
+ * A CAT transmit report holds until cat_tx_until, so a radio that stops
+ * answering while transmitting does not block switching forever.
+ */
+typedef struct {
+    unsigned int target;
+    uint32_t trace_id;
+    bool immediate;
+    int64_t requested_at;
+    int64_t sent_at;
+    bool rate_limited;
+    uint32_t suppressed;    /* commands dropped since the last one sent */
+    int64_t cat_tx_until;
+    int ptt_gpio;
+    bool transmitting;
+    int64_t rx_since;       /* when transmitting last ended */
+    int64_t deferred_since; /* 0 when the pending command is not held by transmit */
+} scheduled_radio_t;
+
+static scheduled_radio_t radios[CONFIG_RADIO_COUNT];
+static switch_scheduler_stats_t scheduler_stats;
+static portMUX_TYPE scheduler_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t scheduler_task;
+static StaticTask_t scheduler_tcb;
+static StackType_t scheduler_stack[3072];
+static esp_timer_handle_t report_timer;
+
+static void IRAM_ATTR ptt_isr_handler(void *arg)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(scheduler_task, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+static bool ptt_active(const scheduled_radio_t *radio)
+{
+    if(radio->ptt_gpio < 0) {
+        return false;
+    }
+    return gpio_get_level(radio->ptt_gpio) == PTT_ACTIVE_LEVEL;
+}
+
+static int64_t earliest(int64_t a, int64_t b)
+{
+    return a < b ? a : b;
+}
+
+static int64_t latest(int64_t a, int64_t b)
+{
+    return a > b ? a : b;
+}
+
+/**
+ * Send every target that has been stable for the settle time, as long as the last
+ * command to the same radio is at least the minimum interval ago and the radio is
+ * not transmitting. After transmit ends the command waits SWITCH_TX_RELEASE_MS.
+ * Returns when the next pending target is due, INT64_MAX if there is none.
+ */
+static int64_t send_due_targets(int64_t now)
+{
+    int64_t next = INT64_MAX;
+    for(uint8_t r = 0; r < CONFIG_RADIO_COUNT; r++) {
+        scheduled_radio_t *radio = &radios[r];
+        bool ptt = ptt_active(radio);
+
+        portENTER_CRITICAL(&scheduler_lock);
+        bool transmitting = ptt || radio->cat_tx_until > now;
+        if(radio->transmitting && !transmitting) {
+            radio->rx_since = now;
+        }
+        radio->transmitting = transmitting;
+        if(radio->cat_tx_until > now) {
+            next = earliest(next, radio->cat_tx_until);
+        }
+
+        if(radio->target == 0) {
+            portEXIT_CRITICAL(&scheduler_lock);
+            continue;
+        }
+        int64_t settled_at = radio->immediate ? now : radio->requested_at + SETTLE_US;
+        int64_t allowed_at = radio->immediate ? now : radio->sent_at + MIN_INTERVAL_US;
+        int64_t due = latest(settled_at, allowed_at);
+        if(due > now) {
+            if(allowed_at > settled_at && !radio->rate_limited) {
+                radio->rate_limited = true;
+                scheduler_stats.rate_limited++;
+            }
+            next = earliest(next, due);
+            portEXIT_CRITICAL(&scheduler_lock);
+            continue;
+        }
+        if(transmitting || radio->rx_since + TX_RELEASE_US > now) {
+            if(radio->deferred_since == 0) {
+                radio->deferred_since = now;
+                scheduler_stats.tx_deferred++;
+            }
+            if(!transmitting) {
+                next = earliest(next, radio->rx_since + TX_RELEASE_US);
+            }
+            portEXIT_CRITICAL(&scheduler_lock);
+            continue;
+        }
+
+        unsigned int antenna = radio->target;
+        uint32_t trace_id = radio->trace_id;
+        uint32_t suppressed = radio->suppressed;
+        int64_t deferral = radio->deferred_since != 0 ? now - radio->deferred_since : 0;
+        radio->target = 0;
+        radio->sent_at = now;
+        radio->suppressed = 0;
+        radio->deferred_since = 0;
+        scheduler_stats.sent++;
+        scheduler_stats.max_tx_deferral_us = latest(scheduler_stats.max_tx_deferral_us, deferral);
+        portEXIT_CRITICAL(&scheduler_lock);
+
+        if(suppressed > 0) {
+            ESP_LOGI(TAG, "Radio %u: antenna %u, %" PRIu32 " commands suppressed while settling", r + 1, antenna, suppressed);
+        }
+        if(deferral > 0) {
+            ESP_LOGI(TAG, "Radio %u: antenna %u deferred %" PRId64 "us by transmit", r + 1, antenna, deferral);
+        }
+        send_current_antenna(r, antenna, trace_id);
+    }
+    return next;
+}
+
+/**
+ * UDP commands that ran out of retries go out over the WebSocket from here, not
+ * from the esp_timer task where a blocked send would stall every timer
+ */
+static void send_udp_fallbacks()
+{
+    for(uint8_t r = 0; r < CONFIG_RADIO_COUNT; r++) {
+        unsigned int antenna;
+        if(udp_fast_path_take_fallback(r, &antenna)) {
+            websocket_send_antenna(r, antenna);
+        }
+    }
+}
+
+static void switch_scheduler_task()
+{
+    for(;;) {
+        send_udp_fallbacks();
+        int64_t now = esp_timer_get_time();
+        int64_t next = send_due_targets(now);
+        TickType_t wait = portMAX_DELAY;
+        if(next != INT64_MAX) {
+            wait = ((next - now) / 1000 + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+            wait = wait > 0 ? wait : 1;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+static void schedule(uint8_t radio, unsigned int antenna, uint32_t trace_id, bool immediate)
+{
+    uint32_t dropped_trace = SWITCH_TRACE_NONE;
+
+    portENTER_CRITICAL(&scheduler_lock);
+    scheduled_radio_t *scheduled = &radios[radio];
+    scheduler_stats.requests++;
+    if(scheduled->target != 0) {
+        dropped_trace = scheduled->trace_id;
+        scheduled->suppressed++;
+        scheduler_stats.superseded++;
+    }
+    scheduled->target = antenna;
+    scheduled->trace_id = trace_id;
+    scheduled->immediate = immediate;
+    scheduled->requested_at = esp_timer_get_time();
+    scheduled->rate_limited = false;
+    portEXIT_CRITICAL(&scheduler_lock);
+
+    switch_trace_discard(dropped_trace);
+    xTaskNotifyGive(scheduler_task);
+}
+
+/**
+ * Ask for an antenna on a radio. The command is sent once the target has not changed
+ * for SWITCH_SETTLE_MS, a newer target replaces one that is still waiting.
+ */
+void switch_scheduler_request(uint8_t radio, unsigned int antenna, uint32_t trace_id)
+{
+    if(radio >= CONFIG_RADIO_COUNT || antenna == 0) {
+        switch_trace_discard(trace_id);
+        return;
+    }
+    schedule(radio, antenna, trace_id, false);
+}
+
+/**
+ * Ask for an antenna without settle time or rate limit, for manual selections.
+ * It is still held while the radio transmits.
+ */
+void switch_scheduler_request_now(uint8_t radio, unsigned int antenna)
+{
+    if(radio >= CONFIG_RADIO_COUNT || antenna == 0) {
+        return;
+    }
+    schedule(radio, antenna, SWITCH_TRACE_NONE, true);
+}
+
+/**
+ * Drop the pending command of a radio, used when the wanted antenna is already selected
+ */
+void switch_scheduler_cancel(uint8_t radio)
+{
+    uint32_t dropped_trace = SWITCH_TRACE_NONE;
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+
+    portENTER_CRITICAL(&scheduler_lock);
+    scheduled_radio_t *scheduled = &radios[radio];
+    if(scheduled->target != 0) {
+        dropped_trace = scheduled->trace_id;
+        scheduled->target = 0;
+        scheduled->deferred_since = 0;
+        scheduled->suppressed++;
+        scheduler_stats.cancelled++;
+    }
+    portEXIT_CRITICAL(&scheduler_lock);
+
+    switch_trace_discard(dropped_trace);
+}
+
+/**
+ * Transmit state of a radio as reported by CAT
+ */
+void switch_scheduler_set_tx(uint8_t radio, bool transmitting)
+{
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+
+    portENTER_CRITICAL(&scheduler_lock);
+    scheduled_radio_t *scheduled = &radios[radio];
+    bool was_transmitting = scheduled->cat_tx_until > 0;
+    scheduled->cat_tx_until = transmitting ? esp_timer_get_time() + TX_TIMEOUT_US : 0;
+    portEXIT_CRITICAL(&scheduler_lock);
+
+    if(was_transmitting != transmitting) {
+        xTaskNotifyGive(scheduler_task);
+    }
+}
+
+/**
+ * Wake the scheduler task, e.g. for a UDP fallback
+ */
+void switch_scheduler_notify()
+{
+    if(scheduler_task != NULL) {
+        xTaskNotifyGive(scheduler_task);
+    }
+}
+
+void switch_scheduler_get_stats(switch_scheduler_stats_t *stats)
+{
+    portENTER_CRITICAL(&scheduler_lock);
+    *stats = scheduler_stats;
+    portEXIT_CRITICAL(&scheduler_lock);
+}
+
+static void report_stats(void *arg)
+{
+    switch_scheduler_stats_t stats;
+    switch_scheduler_get_stats(&stats);
+    ESP_LOGI(TAG, "%" PRIu32 " requests, %" PRIu32 " sent, %" PRIu32 " superseded, %" PRIu32 " cancelled, %" PRIu32 " rate limited, %" PRIu32 " deferred by transmit, max %" PRId64 "us",
+             stats.requests, stats.sent, stats.superseded, stats.cancelled, stats.rate_limited, stats.tx_deferred, stats.max_tx_deferral_us);
+}
+
+static void init_ptt_sense(scheduled_radio_t *radio, int gpio)
+{
+    radio->ptt_gpio = gpio;
+    if(gpio < 0) {
+        return;
+    }
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << gpio,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = PTT_ACTIVE_LEVEL == 0 ? GPIO_PULLUP_ENABLE : GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    esp_err_t err = gpio_config(&io_conf);
+    if(err == ESP_OK) {
+        err = gpio_install_isr_service(0);
+        if(err == ESP_ERR_INVALID_STATE) {
+            err = ESP_OK;
+        }
+    }
+    if(err == ESP_OK) {
+        err = gpio_isr_handler_add(gpio, ptt_isr_handler, NULL);
+    }
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not set up PTT sense on GPIO %d: (%s)", gpio, esp_err_to_name(err));
+        radio->ptt_gpio = -1;
+    }
+}
+
+void init_switch_scheduler()
+{
+    const int ptt_gpios[] = {
+        CONFIG_RADIO1_PTT_GPIO,
+#if CONFIG_RADIO_COUNT > 1
+        CONFIG_RADIO2_PTT_GPIO,
+#endif
+    };
+
+    for(int r = 0; r < CONFIG_RADIO_COUNT; r++) {
+        radios[r].sent_at = INT64_MIN / 2;
+        radios[r].rx_since = INT64_MIN / 2;
+        radios[r].ptt_gpio = -1;
+    }
+    scheduler_task = xTaskCreateStatic(switch_scheduler_task, "switch_scheduler", sizeof(scheduler_stack), NULL, 12,
+                                       scheduler_stack, &scheduler_tcb);
+    heap_guard_watch(scheduler_task);
+    const esp_timer_create_args_t report_args = {
+        .callback = report_stats,
+        .name = "scheduler_report",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &report_timer));
+    esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+    for(int r = 0; r < CONFIG_RADIO_COUNT; r++) {
+        init_ptt_sense(&radios[r], ptt_gpios[r]);
+    }
+}
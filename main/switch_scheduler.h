@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Counters of antenna commands
+ */
+typedef struct {
+    uint32_t requests;
+    uint32_t sent;
+    uint32_t superseded;    /* replaced by a newer target before it was sent */
+    uint32_t cancelled;     /* dropped because the radio went back to the selected antenna */
+    uint32_t rate_limited;  /* held back by the minimum interval between commands */
+    uint32_t tx_deferred;   /* held back because the radio was transmitting */
+    int64_t max_tx_deferral_us;
+} switch_scheduler_stats_t;
+
+void init_switch_scheduler();
+void switch_scheduler_request(uint8_t radio, unsigned int antenna, uint32_t trace_id);
+void switch_scheduler_request_now(uint8_t radio, unsigned int antenna);
+void switch_scheduler_cancel(uint8_t radio);
+void switch_scheduler_set_tx(uint8_t radio, bool transmitting);
+void switch_scheduler_notify();
+void switch_scheduler_get_stats(switch_scheduler_stats_t *stats);
@@ -0,0 +1,266 @@
+#include "switch_trace.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "switch_trace";
+
+#ifdef CONFIG_SWITCH_TRACE_ENABLE
+
+/* Number of traces that can be in flight at the same time. A slot is reused
+ * when the trace id wraps around, an unfinished trace in it counts as lost. */
+#define TRACE_SLOTS 8
+
+/* Bucket b holds latencies in [2^(b-1), 2^b) us, the last bucket everything above */
+#define HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    uint32_t id;
+    int64_t stamp[TRACE_STAGE_COUNT];
+} switch_trace_t;
+
+static const char* const TraceStageStr[] =
+{
+    "uart_pattern",
+    "frame_parsed",
+    "band_resolved",
+    "map_lookup",
+    "ws_send",
+    "server_ack",
+    "led_update"
+};
+
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t next_trace_id = SWITCH_TRACE_NONE + 1;
+static switch_trace_t in_flight[TRACE_SLOTS];
+
+/* Histogram per stage of the time since the previous stamped stage, the
+ * first entry holds the end to end latency. */
+static uint32_t histogram[TRACE_STAGE_COUNT][HISTOGRAM_BUCKETS];
+static int64_t stage_max_us[TRACE_STAGE_COUNT];
+static uint32_t completed_traces = 0;
+static uint32_t lost_traces = 0;
+
+/* Slowest finished traces, unsorted, slot with the fastest one gets replaced */
+static switch_trace_t slowest[CONFIG_SWITCH_TRACE_SLOWEST_N];
+
+static unsigned int histogram_bucket(int64_t us)
+{
+    if(us <= 0) {
+        return 0;
+    }
+    unsigned int bucket = 64 - __builtin_clzll((uint64_t)us);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+static int64_t trace_total_us(const switch_trace_t *trace)
+{
+    int64_t last = 0;
+    for(int i = TRACE_STAGE_COUNT - 1; i >= 0 && last == 0; i--) {
+        last = trace->stamp[i];
+    }
+    return last - trace->stamp[TRACE_STAGE_UART_PATTERN];
+}
+
+static switch_trace_t* find_trace(uint32_t trace_id)
+{
+    switch_trace_t *trace = &in_flight[trace_id % TRACE_SLOTS];
+    return trace->id == trace_id ? trace : NULL;
+}
+
+/**
+ * Start a new trace, detected_at is the time the UART reported the frame
+ */
+uint32_t switch_trace_begin(int64_t detected_at)
+{
+    portENTER_CRITICAL(&trace_lock);
+    uint32_t trace_id = next_trace_id++;
+    if(next_trace_id == SWITCH_TRACE_NONE) {
+        next_trace_id++;
+    }
+    switch_trace_t *trace = &in_flight[trace_id % TRACE_SLOTS];
+    if(trace->id != SWITCH_TRACE_NONE && trace->stamp[TRACE_STAGE_WS_SEND] != 0) {
+        lost_traces++;
+    }
+    memset(trace, 0, sizeof(switch_trace_t));
+    trace->id = trace_id;
+    trace->stamp[TRACE_STAGE_UART_PATTERN] = detected_at;
+    portEXIT_CRITICAL(&trace_lock);
+    return trace_id;
+}
+
+void switch_trace_mark(uint32_t trace_id, trace_stage_t stage)
+{
+    if(trace_id == SWITCH_TRACE_NONE || stage >= TRACE_STAGE_COUNT) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&trace_lock);
+    switch_trace_t *trace = find_trace(trace_id);
+    if(trace != NULL) {
+        trace->stamp[stage] = now;
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+/**
+ * Drop a trace that did not lead to a band change decision
+ */
+void switch_trace_discard(uint32_t trace_id)
+{
+    if(trace_id == SWITCH_TRACE_NONE) {
+        return;
+    }
+    portENTER_CRITICAL(&trace_lock);
+    switch_trace_t *trace = find_trace(trace_id);
+    if(trace != NULL) {
+        trace->id = SWITCH_TRACE_NONE;
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+/**
+ * Close a trace and add its stage latencies to the histograms
+ */
+void switch_trace_finish(uint32_t trace_id)
+{
+    if(trace_id == SWITCH_TRACE_NONE) {
+        return;
+    }
+    portENTER_CRITICAL(&trace_lock);
+    switch_trace_t *trace = find_trace(trace_id);
+    if(trace != NULL) {
+        int64_t previous = trace->stamp[TRACE_STAGE_UART_PATTERN];
+        for(int i = 1; i < TRACE_STAGE_COUNT; i++) {
+            if(trace->stamp[i] == 0) {
+                continue;
+            }
+            int64_t delta = trace->stamp[i] - previous;
+            histogram[i][histogram_bucket(delta)]++;
+            if(delta > stage_max_us[i]) {
+                stage_max_us[i] = delta;
+            }
+            previous = trace->stamp[i];
+        }
+
+        int64_t total = trace_total_us(trace);
+        histogram[0][histogram_bucket(total)]++;
+        if(total > stage_max_us[0]) {
+            stage_max_us[0] = total;
+        }
+
+        unsigned int fastest = 0;
+        for(unsigned int i = 1; i < CONFIG_SWITCH_TRACE_SLOWEST_N; i++) {
+            if(slowest[i].id == SWITCH_TRACE_NONE ||
+               (slowest[fastest].id != SWITCH_TRACE_NONE && trace_total_us(&slowest[i]) < trace_total_us(&slowest[fastest]))) {
+                fastest = i;
+            }
+        }
+        if(slowest[fastest].id == SWITCH_TRACE_NONE || trace_total_us(&slowest[fastest]) < total) {
+            slowest[fastest] = *trace;
+        }
+
+        completed_traces++;
+        trace->id = SWITCH_TRACE_NONE;
+    }
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+static void log_histogram(const char *name, const uint32_t *buckets, int64_t max_us)
+{
+    char line[160];
+    int len = 0;
+    uint32_t count = 0;
+    for(unsigned int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if(buckets[b] == 0) {
+            continue;
+        }
+        count += buckets[b];
+        if(len < sizeof(line)) {
+            len += snprintf(line + len, sizeof(line) - len, " <%lluus:%" PRIu32, 1ULL << b, buckets[b]);
+        }
+    }
+    if(count != 0) {
+        ESP_LOGI(TAG, "%-13s n=%" PRIu32 " max=%" PRId64 "us%s", name, count, max_us, line);
+    }
+}
+
+/**
+ * Log the per stage histograms and the slowest traces seen so far
+ */
+void switch_trace_report()
+{
+    static uint32_t histogram_copy[TRACE_STAGE_COUNT][HISTOGRAM_BUCKETS];
+    static int64_t max_copy[TRACE_STAGE_COUNT];
+    static switch_trace_t slowest_copy[CONFIG_SWITCH_TRACE_SLOWEST_N];
+
+    portENTER_CRITICAL(&trace_lock);
+    memcpy(histogram_copy, histogram, sizeof(histogram));
+    memcpy(max_copy, stage_max_us, sizeof(stage_max_us));
+    memcpy(slowest_copy, slowest, sizeof(slowest));
+    uint32_t completed = completed_traces;
+    uint32_t lost = lost_traces;
+    portEXIT_CRITICAL(&trace_lock);
+
+    ESP_LOGI(TAG, "Switch traces completed: %" PRIu32 ", lost: %" PRIu32, completed, lost);
+    log_histogram("total", histogram_copy[0], max_copy[0]);
+    for(int i = 1; i < TRACE_STAGE_COUNT; i++) {
+        log_histogram(TraceStageStr[i], histogram_copy[i], max_copy[i]);
+    }
+
+    for(unsigned int i = 0; i < CONFIG_SWITCH_TRACE_SLOWEST_N; i++) {
+        const switch_trace_t *trace = &slowest_copy[i];
+        if(trace->id == SWITCH_TRACE_NONE) {
+            continue;
+        }
+        char line[160];
+        int len = 0;
+        int64_t previous = trace->stamp[TRACE_STAGE_UART_PATTERN];
+        for(int s = 1; s < TRACE_STAGE_COUNT && len < sizeof(line); s++) {
+            if(trace->stamp[s] == 0) {
+                continue;
+            }
+            len += snprintf(line + len, sizeof(line) - len, " %s=+%" PRId64, TraceStageStr[s], trace->stamp[s] - previous);
+            previous = trace->stamp[s];
+        }
+        ESP_LOGI(TAG, "slow trace %" PRIu32 ": %" PRId64 "us%s", trace->id, trace_total_us(trace), line);
+    }
+}
+
+#if CONFIG_SWITCH_TRACE_REPORT_INTERVAL > 0
+static StaticTask_t report_tcb;
+static StackType_t report_stack[3072];
+
+static void trace_report_task()
+{
+    uint32_t reported_traces = 0;
+    for(;;) {
+        vTaskDelay(CONFIG_SWITCH_TRACE_REPORT_INTERVAL * 1000 / portTICK_PERIOD_MS);
+        if(completed_traces != reported_traces) {
+            reported_traces = completed_traces;
+            switch_trace_report();
+        }
+    }
+}
+#endif
+
+void init_switch_trace()
+{
+#if CONFIG_SWITCH_TRACE_REPORT_INTERVAL > 0
+    xTaskCreateStatic(trace_report_task, "trace_report_task", sizeof(report_stack), NULL, 1, report_stack, &report_tcb);
+#endif
+}
+
+#else
+
+uint32_t switch_trace_begin(int64_t detected_at) { return SWITCH_TRACE_NONE; }
+void switch_trace_mark(uint32_t trace_id, trace_stage_t stage) {}
+void switch_trace_discard(uint32_t trace_id) {}
+void switch_trace_finish(uint32_t trace_id) {}
+void switch_trace_report() { ESP_LOGI(TAG, "Switch tracing is disabled"); }
+void init_switch_trace() {}
+
+#endif
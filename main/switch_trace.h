@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Stages of a band change decision, in pipeline order. Every stage is
+ * timestamped with esp_timer_get_time() when it is reached.
+ */
+typedef enum {
+    TRACE_STAGE_UART_PATTERN,
+    TRACE_STAGE_FRAME_PARSED,
+    TRACE_STAGE_BAND_RESOLVED,
+    TRACE_STAGE_MAP_LOOKUP,
+    TRACE_STAGE_WS_SEND,
+    TRACE_STAGE_SERVER_ACK,
+    TRACE_STAGE_LED_UPDATE,
+    TRACE_STAGE_COUNT
+} trace_stage_t;
+
+/** Trace id that is never handed out, used for "not traced" */
+#define SWITCH_TRACE_NONE 0
+
+void init_switch_trace();
+uint32_t switch_trace_begin(int64_t detected_at);
+void switch_trace_mark(uint32_t trace_id, trace_stage_t stage);
+void switch_trace_discard(uint32_t trace_id);
+void switch_trace_finish(uint32_t trace_id);
+void switch_trace_report();
@@ -0,0 +1,315 @@
+#include "system_state.h"
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+
+#if CONFIG_SYSTEM_STATE
+
+#include "freertos/FreeRTOS.h"
+#include "websocket_client.h"
+
+static const char *TAG = "system_state";
+
+/*
+ * The server's view of the antenna system, pushed over the WebSocket:
+ *   client: "state_sub"                       asks for a snapshot and the deltas after it
+ *   server: "state:<version>:<entries>"       every antenna
+ *           "delta:<version>:<entries>"       the antennas that changed, version is the previous + 1
+ * An entry is "<antenna>=<status>/<bands>", status "f" free, "u<position>" in use by another
+ * operating position, "l" locked out. bands is a hex mask of the bands the antenna is
+ * available on, bit 0 is 160M in the order of enum AmateurBand.
+ */
+static const char *subscribe_command = "state_sub";
+static const char *snapshot_prefix = "state:";
+static const char *delta_prefix = "delta:";
+
+#define MAX_MESSAGE_LEN 320
+#define ALL_BANDS ((1U << AMATEUR_BAND_COUNT) - 1)
+
+typedef enum {
+    STATUS_FREE,
+    STATUS_IN_USE,
+    STATUS_LOCKED,
+} antenna_status_t;
+
+typedef struct {
+    uint8_t status;
+    uint8_t position;       /* operating position using the antenna, 0 if not known */
+    uint16_t bands;
+} antenna_entry_t;
+
+static antenna_entry_t entries[MAX_ANTENNAS];
+/* False until the first snapshot and after a gap, everything is allowed then and the server decides */
+static bool valid;
+static system_state_stats_t state_stats;
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void reset_entries(antenna_entry_t *table)
+{
+    for(int i = 0; i < MAX_ANTENNAS; i++) {
+        table[i] = (antenna_entry_t){ STATUS_FREE, 0, ALL_BANDS };
+    }
+}
+
+/**
+ * Ask for a fresh snapshot, the cache is not used until it arrives
+ */
+void system_state_subscribe()
+{
+    portENTER_CRITICAL(&state_lock);
+    valid = false;
+    portEXIT_CRITICAL(&state_lock);
+    websocket_send_text(subscribe_command);
+}
+
+void system_state_disconnected()
+{
+    portENTER_CRITICAL(&state_lock);
+    valid = false;
+    portEXIT_CRITICAL(&state_lock);
+    antenna_control_refresh_leds();
+}
+
+/**
+ * Parse "<antenna>=<status>/<bands>" entries separated by commas into a copy of the table
+ */
+static bool parse_entries(char *text, antenna_entry_t *table)
+{
+    char *save = NULL;
+    for(char *item = strtok_r(text, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *end;
+        const long antenna = strtol(item, &end, 10);
+        if(*end != '=' || antenna < 1 || antenna > MAX_ANTENNAS) {
+            return false;
+        }
+        antenna_entry_t *entry = &table[antenna - 1];
+        const char *status = end + 1;
+        entry->position = 0;
+        switch(*status) {
+        case 'f':
+            entry->status = STATUS_FREE;
+            break;
+        case 'u':
+            entry->status = STATUS_IN_USE;
+            entry->position = strtoul(status + 1, NULL, 10);
+            break;
+        case 'l':
+            entry->status = STATUS_LOCKED;
+            break;
+        default:
+            return false;
+        }
+        const char *bands = strchr(status, '/');
+        entry->bands = bands != NULL ? strtoul(bands + 1, NULL, 16) & ALL_BANDS : ALL_BANDS;
+    }
+    return true;
+}
+
+/**
+ * Apply a snapshot or delta. A delta that does not follow the version the cache is at
+ * means one was lost, the cache is dropped and a new snapshot requested.
+ */
+bool system_state_handle_message(const char *data, int len)
+{
+    bool snapshot;
+    if(len > strlen(snapshot_prefix) && strncmp(data, snapshot_prefix, strlen(snapshot_prefix)) == 0) {
+        snapshot = true;
+    } else if(len > strlen(delta_prefix) && strncmp(data, delta_prefix, strlen(delta_prefix)) == 0) {
+        snapshot = false;
+    } else {
+        return false;
+    }
+    if(len >= MAX_MESSAGE_LEN) {
+        ESP_LOGE(TAG, "State message of %d bytes dropped", len);
+        return true;
+    }
+    char buf[MAX_MESSAGE_LEN];
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    char *end;
+    const uint32_t version = strtoul(strchr(buf, ':') + 1, &end, 10);
+    if(*end != ':') {
+        ESP_LOGE(TAG, "Bad state message: %s", buf);
+        return true;
+    }
+
+    antenna_entry_t table[MAX_ANTENNAS];
+    portENTER_CRITICAL(&state_lock);
+    const bool in_sequence = valid && version == state_stats.version + 1;
+    memcpy(table, entries, sizeof(table));
+    portEXIT_CRITICAL(&state_lock);
+
+    if(!snapshot && !in_sequence) {
+        ESP_LOGW(TAG, "Delta %" PRIu32 " out of sequence, requesting a snapshot", version);
+        portENTER_CRITICAL(&state_lock);
+        state_stats.resyncs++;
+        portEXIT_CRITICAL(&state_lock);
+        system_state_subscribe();
+        antenna_control_refresh_leds();
+        return true;
+    }
+    if(snapshot) {
+        reset_entries(table);
+    }
+    if(!parse_entries(end + 1, table)) {
+        ESP_LOGE(TAG, "Bad state entries, requesting a snapshot");
+        system_state_subscribe();
+        antenna_control_refresh_leds();
+        return true;
+    }
+
+    portENTER_CRITICAL(&state_lock);
+    memcpy(entries, table, sizeof(entries));
+    valid = true;
+    state_stats.version = version;
+    if(snapshot) {
+        state_stats.snapshots++;
+    } else {
+        state_stats.deltas++;
+    }
+    portEXIT_CRITICAL(&state_lock);
+
+    ESP_LOGI(TAG, "%s %" PRIu32 ", in use elsewhere 0x%" PRIx32, snapshot ? "Snapshot" : "Delta", version, system_state_in_use_mask());
+    antenna_control_refresh_leds();
+    return true;
+}
+
+static antenna_availability_t check_locked(enum AmateurBand band, unsigned int antenna)
+{
+    if(!valid || antenna < 1 || antenna > MAX_ANTENNAS) {
+        return ANTENNA_AVAILABLE;
+    }
+    const antenna_entry_t *entry = &entries[antenna - 1];
+    if(entry->status == STATUS_LOCKED) {
+        return ANTENNA_LOCKED;
+    }
+    if(entry->status == STATUS_IN_USE) {
+        return ANTENNA_IN_USE;
+    }
+    if(band != UNKNOWN && !(entry->bands & (1U << band))) {
+        return ANTENNA_NOT_FOR_BAND;
+    }
+    return ANTENNA_AVAILABLE;
+}
+
+/**
+ * Whether the server would accept an antenna for a band. Without a current snapshot
+ * every antenna is available and the server decides.
+ */
+antenna_availability_t system_state_check(enum AmateurBand band, unsigned int antenna)
+{
+    portENTER_CRITICAL(&state_lock);
+    const antenna_availability_t availability = check_locked(band, antenna);
+    portEXIT_CRITICAL(&state_lock);
+    return availability;
+}
+
+static const char* availability_str(antenna_availability_t availability)
+{
+    switch(availability) {
+    case ANTENNA_IN_USE:
+        return "in use elsewhere";
+    case ANTENNA_LOCKED:
+        return "locked out";
+    case ANTENNA_NOT_FOR_BAND:
+        return "not available on this band";
+    default:
+        return "available";
+    }
+}
+
+/**
+ * Manual selection: true if the antenna may be requested, counted and logged when not
+ */
+bool system_state_allow(enum AmateurBand band, unsigned int antenna)
+{
+    const antenna_availability_t availability = system_state_check(band, antenna);
+    if(availability == ANTENNA_AVAILABLE) {
+        return true;
+    }
+    portENTER_CRITICAL(&state_lock);
+    state_stats.rejected++;
+    portEXIT_CRITICAL(&state_lock);
+    ESP_LOGW(TAG, "ANT%u %s, not requested", antenna, availability_str(availability));
+    return false;
+}
+
+/**
+ * Automode selection: the antenna itself when it is available, otherwise the first
+ * antenna available on the band if redirecting is enabled, otherwise 0
+ */
+unsigned int system_state_resolve(enum AmateurBand band, unsigned int antenna)
+{
+    portENTER_CRITICAL(&state_lock);
+    const antenna_availability_t availability = check_locked(band, antenna);
+    unsigned int resolved = availability == ANTENNA_AVAILABLE ? antenna : 0;
+#if CONFIG_SYSTEM_STATE_REDIRECT
+    const unsigned int count = get_antenna_count();
+    for(unsigned int candidate = 1; resolved == 0 && candidate <= count && band != UNKNOWN; candidate++) {
+        if(check_locked(band, candidate) == ANTENNA_AVAILABLE) {
+            resolved = candidate;
+        }
+    }
+#endif
+    if(resolved == 0) {
+        state_stats.rejected++;
+    } else if(resolved != antenna) {
+        state_stats.redirected++;
+    }
+    portEXIT_CRITICAL(&state_lock);
+
+    if(resolved == 0) {
+        ESP_LOGW(TAG, "ANT%u %s, automode keeps the current antenna", antenna, availability_str(availability));
+    } else if(resolved != antenna) {
+        ESP_LOGI(TAG, "ANT%u %s, automode takes ANT%u", antenna, availability_str(availability), resolved);
+    }
+    return resolved;
+}
+
+/**
+ * Antennas in use by other operating positions, bit 0 is antenna 1. 0 without a current snapshot.
+ */
+uint32_t system_state_in_use_mask()
+{
+    uint32_t mask = 0;
+    portENTER_CRITICAL(&state_lock);
+    for(int i = 0; valid && i < MAX_ANTENNAS; i++) {
+        if(entries[i].status == STATUS_IN_USE) {
+            mask |= 1UL << i;
+        }
+    }
+    portEXIT_CRITICAL(&state_lock);
+    return mask;
+}
+
+void system_state_get_stats(system_state_stats_t *stats)
+{
+    portENTER_CRITICAL(&state_lock);
+    *stats = state_stats;
+    portEXIT_CRITICAL(&state_lock);
+}
+
+void init_system_state()
+{
+    reset_entries(entries);
+#if CONFIG_SYSTEM_STATE_REDIRECT
+    ESP_LOGI(TAG, "Antenna system state from the server, automode redirects conflicts");
+#else
+    ESP_LOGI(TAG, "Antenna system state from the server, automode skips conflicts");
+#endif
+}
+
+#else
+
+void init_system_state() {}
+void system_state_subscribe() {}
+void system_state_disconnected() {}
+bool system_state_handle_message(const char *data, int len) { return false; }
+antenna_availability_t system_state_check(enum AmateurBand band, unsigned int antenna) { return ANTENNA_AVAILABLE; }
+bool system_state_allow(enum AmateurBand band, unsigned int antenna) { return true; }
+unsigned int system_state_resolve(enum AmateurBand band, unsigned int antenna) { return antenna; }
+uint32_t system_state_in_use_mask() { return 0; }
+void system_state_get_stats(system_state_stats_t *stats) { memset(stats, 0, sizeof(system_state_stats_t)); }
+
+#endif
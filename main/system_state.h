@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "antenna_control.h"
+
+/**
+ * What the server's view of the antenna system says about selecting an antenna
+ */
+typedef enum {
+    ANTENNA_AVAILABLE,
+    ANTENNA_IN_USE,         /* selected by another operating position */
+    ANTENNA_LOCKED,         /* locked out by the server */
+    ANTENNA_NOT_FOR_BAND,
+} antenna_availability_t;
+
+/**
+ * Counters of the state cache. Rejected and redirected are selections decided
+ * locally that would otherwise have been refused by the server.
+ */
+typedef struct {
+    uint32_t snapshots;
+    uint32_t deltas;
+    uint32_t resyncs;       /* version gaps that needed a new snapshot */
+    uint32_t version;
+    uint32_t rejected;
+    uint32_t redirected;
+} system_state_stats_t;
+
+void init_system_state();
+void system_state_subscribe();
+void system_state_disconnected();
+bool system_state_handle_message(const char *data, int len);
+antenna_availability_t system_state_check(enum AmateurBand band, unsigned int antenna);
+bool system_state_allow(enum AmateurBand band, unsigned int antenna);
+unsigned int system_state_resolve(enum AmateurBand band, unsigned int antenna);
+uint32_t system_state_in_use_mask();
+void system_state_get_stats(system_state_stats_t *stats);
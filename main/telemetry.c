@@ -0,0 +1,291 @@
+#include "telemetry.h"
+#include <string.h>
+#include "esp_log.h"
+
+#if CONFIG_TELEMETRY
+
+#include <stdio.h>
+#include <limits.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "websocket_client.h"
+
+static const char *TAG = "telemetry";
+
+/*
+ * Radio state for the server, sent over the WebSocket:
+ *   "telemetry:<seq>:<entries>"   key frame, every known field of every radio
+ *   "tdelta:<seq>:<entries>"      the fields that changed since the previous message, seq is the previous + 1
+ * An entry is the radio, counting from 1, followed by its fields: "f<hz>" frequency, "f+<hz>" or
+ * "f-<hz>" the change of the frequency, "m<mode>" in the order of cat_mode_t, "v<vfo>", "t<0|1>" TX
+ * and "s<0|1>" split. Entries are separated by commas, e.g. "tdelta:42:1f+500,2t1".
+ * Key frames follow every connect, a failed send and every TELEMETRY_KEYFRAME_S.
+ */
+static const char *keyframe_prefix = "telemetry:";
+static const char *delta_prefix = "tdelta:";
+
+#define WINDOW_TICKS pdMS_TO_TICKS(CONFIG_TELEMETRY_WINDOW_MS)
+#define KEYFRAME_US ((int64_t)CONFIG_TELEMETRY_KEYFRAME_S * 1000 * 1000)
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+#define MAX_ENTRY_LEN 32
+#define MAX_MESSAGE_LEN (32 + CONFIG_RADIO_COUNT * MAX_ENTRY_LEN)
+
+#define NOTIFY_CHANGE 1
+#define NOTIFY_URGENT 2
+#define NOTIFY_KEYFRAME 4
+
+/* Latest state of every radio, under telemetry_lock */
+static cat_event_t current[CONFIG_RADIO_COUNT];
+static telemetry_stats_t telemetry_stats;
+static portMUX_TYPE telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t telemetry_task_handle = NULL;
+static StaticTask_t telemetry_task_tcb;
+static StackType_t telemetry_task_stack[3072];
+
+/* Only used by the telemetry task */
+static cat_event_t sent[CONFIG_RADIO_COUNT];
+static uint32_t seq;
+static bool keyframe_due = true;
+static int64_t keyframe_at;
+static char message[MAX_MESSAGE_LEN];
+
+static void reset_state(cat_event_t *state)
+{
+    for(int i = 0; i < CONFIG_RADIO_COUNT; i++) {
+        state[i] = (cat_event_t){ .frequency = 0, .tx = -1, .mode = CAT_MODE_UNKNOWN, .vfo = -1, .split = -1 };
+    }
+}
+
+/**
+ * Take in the fields a decoded frame carries. Called by the automode control task,
+ * only copies under a spinlock and wakes the telemetry task. A band or TX change
+ * ends the batching window.
+ */
+void telemetry_update(uint8_t radio, const cat_event_t *event, bool band_changed)
+{
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+    bool changed = false;
+    bool urgent = band_changed;
+
+    portENTER_CRITICAL(&telemetry_lock);
+    cat_event_t *state = &current[radio];
+    if(event->frequency != 0 && event->frequency != state->frequency) {
+        state->frequency = event->frequency;
+        changed = true;
+    }
+    if(event->tx >= 0 && event->tx != state->tx) {
+        state->tx = event->tx;
+        changed = true;
+        urgent = true;
+    }
+    if(event->mode != CAT_MODE_UNKNOWN && event->mode != state->mode) {
+        state->mode = event->mode;
+        changed = true;
+    }
+    if(event->vfo >= 0 && event->vfo != state->vfo) {
+        state->vfo = event->vfo;
+        changed = true;
+    }
+    if(event->split >= 0 && event->split != state->split) {
+        state->split = event->split;
+        changed = true;
+    }
+    if(changed) {
+        telemetry_stats.updates++;
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+
+    if(changed && telemetry_task_handle != NULL) {
+        xTaskNotify(telemetry_task_handle, urgent ? NOTIFY_CHANGE | NOTIFY_URGENT : NOTIFY_CHANGE, eSetBits);
+    }
+}
+
+/**
+ * Send a key frame next, the server has no state for this connection yet
+ */
+void telemetry_connected()
+{
+    if(telemetry_task_handle != NULL) {
+        xTaskNotify(telemetry_task_handle, NOTIFY_KEYFRAME, eSetBits);
+    }
+}
+
+void telemetry_get_stats(telemetry_stats_t *stats)
+{
+    portENTER_CRITICAL(&telemetry_lock);
+    *stats = telemetry_stats;
+    portEXIT_CRITICAL(&telemetry_lock);
+}
+
+/**
+ * Append the fields of a radio that differ from what the server has, nothing if
+ * none does. Unknown fields are never sent.
+ */
+static int append_entry(int len, uint8_t radio, const cat_event_t *now, const cat_event_t *before)
+{
+    char entry[MAX_ENTRY_LEN];
+    int entry_len = 0;
+
+    if(now->frequency != 0 && now->frequency != before->frequency) {
+        if(before->frequency != 0) {
+            entry_len += snprintf(entry + entry_len, sizeof(entry) - entry_len, "f%+" PRId32,
+                                  (int32_t)(now->frequency - before->frequency));
+        } else {
+            entry_len += snprintf(entry + entry_len, sizeof(entry) - entry_len, "f%" PRIu32, now->frequency);
+        }
+    }
+    if(now->mode != CAT_MODE_UNKNOWN && now->mode != before->mode) {
+        entry_len += snprintf(entry + entry_len, sizeof(entry) - entry_len, "m%d", now->mode);
+    }
+    if(now->vfo >= 0 && now->vfo != before->vfo) {
+        entry_len += snprintf(entry + entry_len, sizeof(entry) - entry_len, "v%d", now->vfo);
+    }
+    if(now->tx >= 0 && now->tx != before->tx) {
+        entry_len += snprintf(entry + entry_len, sizeof(entry) - entry_len, "t%d", now->tx ? 1 : 0);
+    }
+    if(now->split >= 0 && now->split != before->split) {
+        entry_len += snprintf(entry + entry_len, sizeof(entry) - entry_len, "s%d", now->split ? 1 : 0);
+    }
+    if(entry_len == 0) {
+        return len;
+    }
+    const bool first = message[len - 1] == ':';
+    return len + snprintf(message + len, sizeof(message) - len, "%s%u%s", first ? "" : ",", radio + 1, entry);
+}
+
+/**
+ * Send what changed since the last message, or everything for a key frame. Nothing
+ * is sent while the server is not connected, the next connect brings a key frame.
+ */
+static void send_telemetry(bool urgent)
+{
+    cat_event_t now[CONFIG_RADIO_COUNT];
+    portENTER_CRITICAL(&telemetry_lock);
+    memcpy(now, current, sizeof(now));
+    portEXIT_CRITICAL(&telemetry_lock);
+
+    if(!websocket_client_connected()) {
+        return;
+    }
+
+    const bool keyframe = keyframe_due;
+    if(keyframe) {
+        reset_state(sent);
+    }
+    const int header_len = snprintf(message, sizeof(message), "%s%" PRIu32 ":", keyframe ? keyframe_prefix : delta_prefix, seq);
+    int len = header_len;
+    for(uint8_t radio = 0; radio < CONFIG_RADIO_COUNT; radio++) {
+        len = append_entry(len, radio, &now[radio], &sent[radio]);
+    }
+    if(len == header_len) {
+        return;
+    }
+
+    const bool ok = websocket_send_text(message);
+    portENTER_CRITICAL(&telemetry_lock);
+    if(ok) {
+        telemetry_stats.messages++;
+        telemetry_stats.bytes += len;
+        if(keyframe) {
+            telemetry_stats.keyframes++;
+        }
+        if(urgent) {
+            telemetry_stats.urgent++;
+        }
+    } else {
+        telemetry_stats.send_errors++;
+    }
+    portEXIT_CRITICAL(&telemetry_lock);
+
+    if(ok) {
+        memcpy(sent, now, sizeof(sent));
+        seq++;
+        if(keyframe) {
+            keyframe_due = false;
+            keyframe_at = esp_timer_get_time();
+        }
+    } else {
+        // The server may have missed part of the message, start over from a key frame
+        keyframe_due = true;
+    }
+}
+
+static void report_stats(const telemetry_stats_t *previous, int64_t interval_us)
+{
+    telemetry_stats_t stats;
+    telemetry_get_stats(&stats);
+    const uint32_t messages = stats.messages - previous->messages;
+    const uint32_t bytes = stats.bytes - previous->bytes;
+    const uint32_t updates = stats.updates - previous->updates;
+    if(updates == 0 && messages == 0) {
+        return;
+    }
+    const uint32_t milli_messages = (uint64_t)messages * 1000 * 1000 * 1000 / interval_us;
+    ESP_LOGI(TAG, "%" PRIu32 " updates in %" PRIu32 " messages, %" PRIu32 ".%03" PRIu32 " messages/s, %" PRIu32 " B/s (%" PRIu32 " urgent, %" PRIu32 " key frames, %" PRIu32 " send errors)",
+             updates, messages, milli_messages / 1000, milli_messages % 1000, (uint32_t)((uint64_t)bytes * 1000 * 1000 / interval_us),
+             stats.urgent - previous->urgent, stats.keyframes - previous->keyframes, stats.send_errors - previous->send_errors);
+}
+
+/**
+ * Collects the changes of one window into a single message. Waits for the first
+ * change, then for the window to end or a band or TX change to cut it short.
+ */
+static void telemetry_task()
+{
+    telemetry_stats_t reported = { 0 };
+    int64_t reported_at = esp_timer_get_time();
+    for(;;) {
+        int64_t now = esp_timer_get_time();
+        int64_t next = reported_at + REPORT_INTERVAL_US;
+        if(KEYFRAME_US > 0 && !keyframe_due && keyframe_at + KEYFRAME_US < next) {
+            next = keyframe_at + KEYFRAME_US;
+        }
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, ULONG_MAX, &bits, next > now ? pdMS_TO_TICKS((next - now) / 1000) + 1 : 0);
+
+        if((bits & NOTIFY_CHANGE) && !(bits & (NOTIFY_URGENT | NOTIFY_KEYFRAME))) {
+            const TickType_t start = xTaskGetTickCount();
+            TickType_t elapsed;
+            while(!(bits & (NOTIFY_URGENT | NOTIFY_KEYFRAME)) && (elapsed = xTaskGetTickCount() - start) < WINDOW_TICKS) {
+                uint32_t more = 0;
+                xTaskNotifyWait(0, ULONG_MAX, &more, WINDOW_TICKS - elapsed);
+                bits |= more;
+            }
+        }
+
+        now = esp_timer_get_time();
+        if((bits & NOTIFY_KEYFRAME) || (KEYFRAME_US > 0 && now - keyframe_at >= KEYFRAME_US)) {
+            keyframe_due = true;
+        }
+        if(bits != 0 || keyframe_due) {
+            send_telemetry((bits & NOTIFY_URGENT) != 0);
+        }
+
+        if(now - reported_at >= REPORT_INTERVAL_US) {
+            report_stats(&reported, now - reported_at);
+            telemetry_get_stats(&reported);
+            reported_at = now;
+        }
+    }
+}
+
+void init_telemetry()
+{
+    reset_state(current);
+    reset_state(sent);
+    telemetry_task_handle = xTaskCreateStatic(telemetry_task, "telemetry_task", sizeof(telemetry_task_stack), NULL, 5,
+                                              telemetry_task_stack, &telemetry_task_tcb);
+    ESP_LOGI(TAG, "Radio telemetry batched over %d ms", CONFIG_TELEMETRY_WINDOW_MS);
+}
+
+#else
+
+void init_telemetry() {}
+void telemetry_connected() {}
+void telemetry_update(uint8_t radio, const cat_event_t *event, bool band_changed) {}
+void telemetry_get_stats(telemetry_stats_t *stats) { memset(stats, 0, sizeof(telemetry_stats_t)); }
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cat_protocol.h"
+
+/**
+ * Counters of the telemetry stream. Updates are decoded frames that changed the
+ * radio state, several of them go out in one message.
+ */
+typedef struct {
+    uint32_t updates;
+    uint32_t messages;
+    uint32_t bytes;
+    uint32_t keyframes;
+    uint32_t urgent;        /* messages sent before the window ended, for band or TX changes */
+    uint32_t send_errors;
+} telemetry_stats_t;
+
+void init_telemetry();
+void telemetry_connected();
+void telemetry_update(uint8_t radio, const cat_event_t *event, bool band_changed);
+void telemetry_get_stats(telemetry_stats_t *stats);
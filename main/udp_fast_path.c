@@ -0,0 +1,358 @@
+#include "udp_fast_path.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "websocket_client.h"
+#include "switch_scheduler.h"
+
+static const char *TAG = "udp_fast_path";
+
+#if CONFIG_UDP_FAST_PATH
+
+#include "lwip/sockets.h"
+#include "mbedtls/md.h"
+#include "heap_guard.h"
+
+/*
+ * Datagrams are 19 bytes, the same layout both ways:
+ * [type][session 4][seq 4][radio][antenna][first 8 bytes of HMAC-SHA256 over the first 11 bytes]
+ * Numbers are big endian, radios count from 0. The server answers a command with an ack
+ * carrying the same session, seq and radio and the antenna it selected.
+ */
+#define DATAGRAM_TYPE_COMMAND 'C'
+#define DATAGRAM_TYPE_ACK 'A'
+#define DATAGRAM_MAC_OFFSET 11
+#define DATAGRAM_MAC_LEN 8
+#define DATAGRAM_LEN (DATAGRAM_MAC_OFFSET + DATAGRAM_MAC_LEN)
+
+#define RETRANSMIT_US ((int64_t)CONFIG_UDP_FAST_PATH_RETRANSMIT_MS * 1000)
+#define REPORT_INTERVAL_US (60LL * 1000 * 1000)
+
+/**
+ * The command of a radio waiting for its ack
+ */
+typedef struct {
+    bool active;
+    bool fallback;          /* out of retries, for the scheduler task to send over the WebSocket */
+    uint32_t seq;
+    int64_t first_sent_at;
+    int64_t sent_at;
+    uint8_t retries;
+    uint8_t datagram[DATAGRAM_LEN];
+} pending_command_t;
+
+static int sock = -1;
+static uint32_t session;    /* 0 when the server has not offered a session */
+static uint32_t next_seq;
+static pending_command_t pending[CONFIG_RADIO_COUNT];
+static udp_fast_path_stats_t udp_stats;
+static portMUX_TYPE udp_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t retransmit_timer;
+static esp_timer_handle_t report_timer;
+static StaticTask_t receive_tcb;
+static StackType_t receive_stack[3072];
+/* Set up with the key once, mbedtls_md_hmac() would allocate a context per datagram */
+static mbedtls_md_context_t mac_context;
+static SemaphoreHandle_t mac_lock;
+static StaticSemaphore_t mac_lock_buffer;
+
+static void put_u32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+/**
+ * Called from the scheduler and the receive task, which share the HMAC context
+ */
+static void datagram_mac(const uint8_t *datagram, uint8_t *mac)
+{
+    uint8_t digest[32];
+    xSemaphoreTake(mac_lock, portMAX_DELAY);
+    mbedtls_md_hmac_reset(&mac_context);
+    mbedtls_md_hmac_update(&mac_context, datagram, DATAGRAM_MAC_OFFSET);
+    mbedtls_md_hmac_finish(&mac_context, digest);
+    xSemaphoreGive(mac_lock);
+    memcpy(mac, digest, DATAGRAM_MAC_LEN);
+}
+
+static bool datagram_valid(const uint8_t *datagram)
+{
+    uint8_t mac[DATAGRAM_MAC_LEN];
+    uint8_t diff = 0;
+    datagram_mac(datagram, mac);
+    for(int i = 0; i < DATAGRAM_MAC_LEN; i++) {
+        diff |= mac[i] ^ datagram[DATAGRAM_MAC_OFFSET + i];
+    }
+    return diff == 0;
+}
+
+/**
+ * Resend commands that have not been acked in time. After the last retry the
+ * command is handed to the scheduler task for the WebSocket, a send there may
+ * block on a bad link and must not hold up the other esp_timer callbacks.
+ */
+static void retransmit_timer_cb(void *arg)
+{
+    const int64_t now = esp_timer_get_time();
+    bool waiting = false;
+    bool fallback = false;
+
+    for(uint8_t r = 0; r < CONFIG_RADIO_COUNT; r++) {
+        uint8_t datagram[DATAGRAM_LEN];
+        bool resend = false;
+
+        portENTER_CRITICAL(&udp_lock);
+        pending_command_t *command = &pending[r];
+        if(command->active && now - command->sent_at >= RETRANSMIT_US * 3 / 4) {
+            if(command->retries < CONFIG_UDP_FAST_PATH_RETRIES) {
+                command->retries++;
+                command->sent_at = now;
+                memcpy(datagram, command->datagram, DATAGRAM_LEN);
+                udp_stats.retransmits++;
+                resend = true;
+                waiting = true;
+            } else {
+                command->active = false;
+                command->fallback = true;
+                udp_stats.fallbacks++;
+                fallback = true;
+            }
+        } else if(command->active) {
+            waiting = true;
+        }
+        portEXIT_CRITICAL(&udp_lock);
+
+        if(resend) {
+            send(sock, datagram, DATAGRAM_LEN, 0);
+        }
+    }
+
+    if(fallback) {
+        switch_scheduler_notify();
+    }
+    if(waiting) {
+        esp_timer_start_once(retransmit_timer, RETRANSMIT_US);
+    }
+}
+
+/**
+ * The antenna of a command that ran out of retries, for the scheduler task to send
+ * over the WebSocket. Returns false when the radio has none.
+ */
+bool udp_fast_path_take_fallback(uint8_t radio, unsigned int *antenna)
+{
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return false;
+    }
+    portENTER_CRITICAL(&udp_lock);
+    const bool fallback = pending[radio].fallback;
+    pending[radio].fallback = false;
+    *antenna = pending[radio].datagram[10];
+    portEXIT_CRITICAL(&udp_lock);
+    if(fallback) {
+        ESP_LOGW(TAG, "No ack for radio %u, sending antenna %u over the WebSocket", radio + 1, *antenna);
+    }
+    return fallback;
+}
+
+static void udp_receive_task()
+{
+    uint8_t datagram[DATAGRAM_LEN + 1];
+    for(;;) {
+        int len = recv(sock, datagram, sizeof(datagram), 0);
+        if(len < 0) {
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+            continue;
+        }
+        if(len != DATAGRAM_LEN || datagram[0] != DATAGRAM_TYPE_ACK || !datagram_valid(datagram)) {
+            portENTER_CRITICAL(&udp_lock);
+            udp_stats.rejected++;
+            portEXIT_CRITICAL(&udp_lock);
+            continue;
+        }
+
+        const uint32_t ack_session = get_u32(&datagram[1]);
+        const uint32_t seq = get_u32(&datagram[5]);
+        const uint8_t radio = datagram[9];
+        const unsigned int antenna = datagram[10];
+        const int64_t now = esp_timer_get_time();
+
+        /* Acks of retransmitted or superseded commands arrive late, they are ignored */
+        portENTER_CRITICAL(&udp_lock);
+        if(ack_session != session || radio >= CONFIG_RADIO_COUNT || !pending[radio].active || pending[radio].seq != seq) {
+            portEXIT_CRITICAL(&udp_lock);
+            continue;
+        }
+        pending[radio].active = false;
+        int64_t rtt = now - pending[radio].first_sent_at;
+        udp_stats.acks++;
+        udp_stats.rtt_total_us += rtt;
+        if(udp_stats.rtt_min_us == 0 || rtt < udp_stats.rtt_min_us) {
+            udp_stats.rtt_min_us = rtt;
+        }
+        if(rtt > udp_stats.rtt_max_us) {
+            udp_stats.rtt_max_us = rtt;
+        }
+        portEXIT_CRITICAL(&udp_lock);
+
+        ESP_LOGD(TAG, "Ack for radio %u antenna %u after %" PRId64 "us", radio + 1, antenna, rtt);
+        antenna_reply_received(radio, antenna);
+    }
+}
+
+/**
+ * Send a command over UDP. Returns false when there is no session, the caller
+ * then uses the WebSocket.
+ */
+bool udp_fast_path_send(uint8_t radio, unsigned int antenna)
+{
+    uint8_t datagram[DATAGRAM_LEN];
+    if(radio >= CONFIG_RADIO_COUNT || antenna > UINT8_MAX) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&udp_lock);
+    if(session == 0) {
+        portEXIT_CRITICAL(&udp_lock);
+        return false;
+    }
+    pending_command_t *command = &pending[radio];
+    command->seq = next_seq++;
+    datagram[0] = DATAGRAM_TYPE_COMMAND;
+    put_u32(&datagram[1], session);
+    put_u32(&datagram[5], command->seq);
+    datagram[9] = radio;
+    datagram[10] = antenna;
+    portEXIT_CRITICAL(&udp_lock);
+
+    datagram_mac(datagram, &datagram[DATAGRAM_MAC_OFFSET]);
+    const int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&udp_lock);
+    memcpy(command->datagram, datagram, DATAGRAM_LEN);
+    command->active = true;
+    command->fallback = false;
+    command->first_sent_at = now;
+    command->sent_at = now;
+    command->retries = 0;
+    udp_stats.commands++;
+    portEXIT_CRITICAL(&udp_lock);
+
+    send(sock, datagram, DATAGRAM_LEN, 0);
+    if(!esp_timer_is_active(retransmit_timer)) {
+        esp_timer_start_once(retransmit_timer, RETRANSMIT_US);
+    }
+    return true;
+}
+
+/**
+ * Use the session the server offered over the WebSocket. Without a key anyone on
+ * the path could forge acks, the session is refused then.
+ */
+void udp_fast_path_start(const char *server_host, uint16_t port, uint32_t new_session)
+{
+    struct sockaddr_in server_addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+    };
+    if(strlen(CONFIG_UDP_FAST_PATH_KEY) == 0) {
+        ESP_LOGE(TAG, "UDP_FAST_PATH_KEY is empty, not using UDP to %s:%u", server_host, port);
+        return;
+    }
+    if(sock < 0 || new_session == 0 || inet_pton(AF_INET, server_host, &server_addr.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Cannot use UDP to %s:%u", server_host, port);
+        return;
+    }
+    if(connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0) {
+        ESP_LOGE(TAG, "UDP connect to %s:%u failed", server_host, port);
+        return;
+    }
+
+    portENTER_CRITICAL(&udp_lock);
+    memset(pending, 0, sizeof(pending));
+    session = new_session;
+    next_seq = 1;
+    portEXIT_CRITICAL(&udp_lock);
+    ESP_LOGI(TAG, "Antenna commands go to %s:%u over UDP", server_host, port);
+}
+
+/**
+ * Back to the WebSocket only, commands waiting for an ack are dropped
+ */
+void udp_fast_path_stop()
+{
+    portENTER_CRITICAL(&udp_lock);
+    session = 0;
+    memset(pending, 0, sizeof(pending));
+    portEXIT_CRITICAL(&udp_lock);
+}
+
+void udp_fast_path_get_stats(udp_fast_path_stats_t *stats)
+{
+    portENTER_CRITICAL(&udp_lock);
+    *stats = udp_stats;
+    portEXIT_CRITICAL(&udp_lock);
+}
+
+static void report_stats(void *arg)
+{
+    udp_fast_path_stats_t stats;
+    udp_fast_path_get_stats(&stats);
+    ESP_LOGI(TAG, "%" PRIu32 " commands, %" PRIu32 " acks, rtt min %" PRId64 "us avg %" PRId64 "us max %" PRId64 "us; %" PRIu32 " retransmits, %" PRIu32 " fallbacks, %" PRIu32 " rejected",
+             stats.commands, stats.acks, stats.rtt_min_us, stats.acks ? stats.rtt_total_us / stats.acks : 0, stats.rtt_max_us,
+             stats.retransmits, stats.fallbacks, stats.rejected);
+}
+
+void init_udp_fast_path()
+{
+    const char *key = CONFIG_UDP_FAST_PATH_KEY;
+    mbedtls_md_init(&mac_context);
+    if(mbedtls_md_setup(&mac_context, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0 ||
+       mbedtls_md_hmac_starts(&mac_context, (const uint8_t *)key, strlen(key)) != 0) {
+        ESP_LOGE(TAG, "Could not set up the datagram MAC");
+        return;
+    }
+    mac_lock = xSemaphoreCreateMutexStatic(&mac_lock_buffer);
+
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(sock < 0) {
+        ESP_LOGE(TAG, "Could not create UDP socket");
+        return;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = retransmit_timer_cb,
+        .name = "udp_retransmit",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &retransmit_timer));
+    const esp_timer_create_args_t report_args = {
+        .callback = report_stats,
+        .name = "udp_report",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&report_args, &report_timer));
+    esp_timer_start_periodic(report_timer, REPORT_INTERVAL_US);
+    heap_guard_watch(xTaskCreateStatic(udp_receive_task, "udp_receive_task", sizeof(receive_stack), NULL, 12,
+                                       receive_stack, &receive_tcb));
+}
+
+#else
+
+void init_udp_fast_path() {}
+void udp_fast_path_start(const char *server_host, uint16_t port, uint32_t session) { ESP_LOGW(TAG, "UDP fast path is disabled"); }
+void udp_fast_path_stop() {}
+bool udp_fast_path_send(uint8_t radio, unsigned int antenna) { return false; }
+bool udp_fast_path_take_fallback(uint8_t radio, unsigned int *antenna) { return false; }
+void udp_fast_path_get_stats(udp_fast_path_stats_t *stats) { memset(stats, 0, sizeof(udp_fast_path_stats_t)); }
+
+#endif
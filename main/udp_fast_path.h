@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Counters of the UDP command channel, round trip times in microseconds
+ */
+typedef struct {
+    uint32_t commands;
+    uint32_t acks;
+    uint32_t retransmits;
+    uint32_t fallbacks;     /* commands sent over the WebSocket after all retries */
+    uint32_t rejected;      /* datagrams with a bad length, type or MAC */
+    int64_t rtt_min_us;
+    int64_t rtt_max_us;
+    int64_t rtt_total_us;
+} udp_fast_path_stats_t;
+
+void init_udp_fast_path();
+void udp_fast_path_start(const char *server_host, uint16_t port, uint32_t session);
+void udp_fast_path_stop();
+bool udp_fast_path_send(uint8_t radio, unsigned int antenna);
+bool udp_fast_path_take_fallback(uint8_t radio, unsigned int *antenna);
+void udp_fast_path_get_stats(udp_fast_path_stats_t *stats);
@@ -4,12 +4,39 @@
 #include <esp_websocket_client.h>
 #include <esp_event.h>
 #include "antenna_control.h"
+#include "switch_trace.h"
+#include "udp_fast_path.h"
+#include "local_server.h"
+#include "network.h"
+#include "event_journal.h"
+#include "clock_sync.h"
+#include "system_state.h"
+#include "telemetry.h"
+#include "esp_timer.h"
 
 static const char *TAG = "websocket client";
 
 static const char* request_current_antenna_command = "current_antenna";
+static const char* udp_offer_command = "udp_offer";
+static const char* udp_session_prefix = "udp:";
+
+/* Server address without the port, used for the UDP fast path */
+static char server_host[60];
 
 static esp_websocket_client_handle_t client = NULL;
+/* The client as created, also while it is not connected */
+static esp_websocket_client_handle_t ws_handle = NULL;
+
+/* Trace of the last automode command per radio, closed when the server confirms it. Acks
+   come from the WebSocket and the UDP receive task, both fields are taken under ack_lock. */
+static uint32_t awaiting_ack_trace[CONFIG_RADIO_COUNT];
+static unsigned int awaiting_ack_antenna[CONFIG_RADIO_COUNT];
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED;
+/* Local time the last command of a radio went out over the WebSocket, for one-way latencies */
+static int64_t command_sent_at[CONFIG_RADIO_COUNT];
+
+/* Antenna selected per radio while the server was unreachable, forwarded when it is back. 0 if none. */
+static unsigned int offline_antenna[CONFIG_RADIO_COUNT];
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -18,6 +45,93 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
+/**
+ * Parse an antenna message from the server. With a single radio this is the bare
+ * antenna number, with more radios it is "<radio>:<antenna>" with radios numbered from 1.
+ * Servers that take part in clock sync append "@<receive time>[:<relay time>]" to acks,
+ * the times are 0 when they are not there.
+ */
+static bool parse_antenna_message(const char *data, int len, uint8_t *radio, unsigned int *antenna, int64_t *server_rx_us, int64_t *relay_us)
+{
+    char buf[64];
+    if(len <= 0 || len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    *server_rx_us = 0;
+    *relay_us = 0;
+    char *stamps = strchr(buf, '@');
+    if(stamps != NULL) {
+        *stamps++ = '\0';
+        char *end;
+        *server_rx_us = strtoll(stamps, &end, 10);
+        if(*end == ':') {
+            *relay_us = strtoll(end + 1, NULL, 10);
+        }
+    }
+
+    *radio = 0;
+    char *separator = strchr(buf, ':');
+    if(separator != NULL) {
+        int radio_number = atoi(buf);
+        if(radio_number < 1 || radio_number > CONFIG_RADIO_COUNT) {
+            return false;
+        }
+        *radio = radio_number - 1;
+        *antenna = atoi(separator + 1);
+    } else {
+        *antenna = atoi(buf);
+    }
+    return *antenna != 0;
+}
+
+/**
+ * Handle the server's answer to an antenna command, over the WebSocket or UDP.
+ * Closes the trace of the command it confirms.
+ */
+void antenna_reply_received(uint8_t radio, unsigned int antenna)
+{
+    uint32_t trace_id = SWITCH_TRACE_NONE;
+    if(radio >= CONFIG_RADIO_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&ack_lock);
+    if(awaiting_ack_trace[radio] != SWITCH_TRACE_NONE && antenna == awaiting_ack_antenna[radio]) {
+        trace_id = awaiting_ack_trace[radio];
+        awaiting_ack_trace[radio] = SWITCH_TRACE_NONE;
+    }
+    portEXIT_CRITICAL(&ack_lock);
+    switch_trace_mark(trace_id, TRACE_STAGE_SERVER_ACK);
+    select_antenna(radio, antenna);
+    switch_trace_mark(trace_id, TRACE_STAGE_LED_UPDATE);
+    switch_trace_finish(trace_id);
+}
+
+/**
+ * "udp:<port>:<session in hex>" offers the UDP fast path
+ */
+static bool parse_udp_session(const char *data, int len, uint16_t *port, uint32_t *session)
+{
+    char buf[32];
+    size_t prefix_len = strlen(udp_session_prefix);
+    if(len <= prefix_len || len >= sizeof(buf) || strncmp(data, udp_session_prefix, prefix_len) != 0) {
+        return false;
+    }
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    char *end;
+    unsigned long value = strtoul(buf + prefix_len, &end, 10);
+    if(*end != ':' || value == 0 || value > UINT16_MAX) {
+        return false;
+    }
+    *port = value;
+    *session = strtoul(end + 1, NULL, 16);
+    return true;
+}
+
 static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
@@ -25,7 +139,23 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
     case WEBSOCKET_EVENT_CONNECTED:
         ESP_LOGI(TAG, "WEBSOCKET_EVENT_CONNECTED");
         client = (esp_websocket_client_handle_t)handler_args;
+        network_session_restored();
+        event_journal_log(JOURNAL_SERVER_CONNECTED, JOURNAL_NO_RADIO, 0);
+        memset(command_sent_at, 0, sizeof(command_sent_at));
+        for(uint8_t radio = 0; radio < CONFIG_RADIO_COUNT; radio++) {
+            if(offline_antenna[radio] != 0) {
+                websocket_send_antenna(radio, offline_antenna[radio]);
+                offline_antenna[radio] = 0;
+            }
+        }
+        local_server_notify();
         esp_websocket_client_send_text(client, request_current_antenna_command, strlen(request_current_antenna_command), portMAX_DELAY);
+        system_state_subscribe();
+#if CONFIG_UDP_FAST_PATH
+        esp_websocket_client_send_text(client, udp_offer_command, strlen(udp_offer_command), portMAX_DELAY);
+#endif
+        clock_sync_start();
+        telemetry_connected();
         break;
     case WEBSOCKET_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "WEBSOCKET_EVENT_DISCONNECTED");
@@ -36,6 +166,10 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
             log_error_if_nonzero("captured as transport's socket errno",  data->error_handle.esp_transport_sock_errno);
         }
         client = NULL;
+        udp_fast_path_stop();
+        system_state_disconnected();
+        local_server_notify();
+        event_journal_log(JOURNAL_SERVER_DISCONNECTED, JOURNAL_NO_RADIO, data->error_handle.esp_transport_sock_errno);
         break;
     case WEBSOCKET_EVENT_DATA:
         ESP_LOGI(TAG, "WEBSOCKET_EVENT_DATA");
@@ -46,9 +180,24 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
             ESP_LOGI(TAG, "Received Pong frame");
         } else {
             ESP_LOGW(TAG, "Received=%.*s", data->data_len, (char *)data->data_ptr);
-            int result  = atoi((const char*)data->data_ptr);
-            if(result != 0) {
-                select_antenna(result);
+            uint8_t radio;
+            unsigned int antenna;
+            uint16_t udp_port;
+            uint32_t udp_session;
+            int64_t server_rx_us;
+            int64_t relay_us;
+            if(parse_udp_session(data->data_ptr, data->data_len, &udp_port, &udp_session)) {
+                udp_fast_path_start(server_host, udp_port, udp_session);
+            } else if(clock_sync_handle_reply(data->data_ptr, data->data_len)) {
+                /* handled */
+            } else if(system_state_handle_message(data->data_ptr, data->data_len)) {
+                /* handled */
+            } else if(parse_antenna_message(data->data_ptr, data->data_len, &radio, &antenna, &server_rx_us, &relay_us)) {
+                if(server_rx_us != 0 && command_sent_at[radio] != 0) {
+                    clock_sync_record_ack(command_sent_at[radio], server_rx_us, relay_us);
+                    command_sent_at[radio] = 0;
+                }
+                antenna_reply_received(radio, antenna);
             }
         }
 
@@ -58,6 +207,7 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
         break;
     case WEBSOCKET_EVENT_ERROR:
         ESP_LOGI(TAG, "WEBSOCKET_EVENT_ERROR");
+        event_journal_log(JOURNAL_ERROR, JOURNAL_NO_RADIO, data->error_handle.esp_transport_sock_errno);
         log_error_if_nonzero("HTTP status code",  data->error_handle.esp_ws_handshake_status_code);
         if (data->error_handle.error_type == WEBSOCKET_ERROR_TYPE_TCP_TRANSPORT) {
             log_error_if_nonzero("reported from esp-tls", data->error_handle.esp_tls_last_esp_err);
@@ -68,14 +218,94 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
     }
 }
 
-void send_current_antenna(unsigned int antenna)
+/**
+ * Send an antenna command over the WebSocket. Commands are tagged "<radio>:<antenna>" when more
+ * than one radio is configured, a single radio keeps sending the bare antenna number.
+ */
+void websocket_send_antenna(uint8_t radio, unsigned int antenna)
 {
+    esp_websocket_client_handle_t current_client = client;
+    if(current_client == NULL) {
+        return;
+    }
+    char buf[8];
+#if CONFIG_RADIO_COUNT > 1
+    snprintf(buf, sizeof(buf), "%u:%u", radio + 1, antenna);
+#else
+    snprintf(buf, sizeof(buf), "%u", antenna);
+#endif
+    command_sent_at[radio] = esp_timer_get_time();
+    esp_websocket_client_send_text(current_client, buf, strlen(buf), portMAX_DELAY);
+}
+
+/**
+ * Send a text message, false when the server is not connected
+ */
+bool websocket_send_text(const char *text)
+{
+    esp_websocket_client_handle_t current_client = client;
+    if(current_client == NULL) {
+        return false;
+    }
+    return esp_websocket_client_send_text(current_client, text, strlen(text), portMAX_DELAY) >= 0;
+}
+
+bool websocket_client_connected()
+{
+    return client != NULL;
+}
+
+/**
+ * Request an antenna for a radio, over UDP when the server offered a session and
+ * over the WebSocket otherwise. Without a server connection the antenna is selected
+ * locally and forwarded once the server is reachable again.
+ */
+void send_current_antenna(uint8_t radio, unsigned int antenna, uint32_t trace_id)
+{
+    if(radio >= CONFIG_RADIO_COUNT) {
+        switch_trace_discard(trace_id);
+        return;
+    }
     if(client == NULL) {
+        switch_trace_discard(trace_id);
+        offline_antenna[radio] = antenna;
+        select_antenna(radio, antenna);
         return;
-    } 
-    char buf[3];
-    itoa(antenna, buf, 10);
-    esp_websocket_client_send_text(client, buf, strlen(request_current_antenna_command), portMAX_DELAY);
+    }
+    /* Set up before sending, the ack can arrive before the send returns. A trace still
+       waiting is for a command this one replaces, it is dropped. */
+    if(trace_id != SWITCH_TRACE_NONE) {
+        portENTER_CRITICAL(&ack_lock);
+        const uint32_t replaced = awaiting_ack_trace[radio];
+        awaiting_ack_antenna[radio] = antenna;
+        awaiting_ack_trace[radio] = trace_id;
+        portEXIT_CRITICAL(&ack_lock);
+        switch_trace_discard(replaced);
+    }
+    if(!udp_fast_path_send(radio, antenna)) {
+        websocket_send_antenna(radio, antenna);
+    }
+    switch_trace_mark(trace_id, TRACE_STAGE_WS_SEND);
+}
+
+/**
+ * Drop the connection and connect again right away, used when the uplink changed
+ * and the old socket would only time out.
+ */
+void websocket_client_restart()
+{
+    if(ws_handle == NULL) {
+        return;
+    }
+    ESP_LOGI(TAG, "Restarting the connection");
+    esp_websocket_client_stop(ws_handle);
+    if(client != NULL) {
+        client = NULL;
+        udp_fast_path_stop();
+        system_state_disconnected();
+        local_server_notify();
+    }
+    esp_websocket_client_start(ws_handle);
 }
 
 void websocket_client_connect(const char* server_ip)
@@ -87,12 +317,19 @@ void websocket_client_connect(const char* server_ip)
     strcat(uri, "/ws");
     websocket_cfg.uri = uri;
 
+    strlcpy(server_host, server_ip, sizeof(server_host));
+    char *port_separator = strchr(server_host, ':');
+    if(port_separator != NULL) {
+        *port_separator = '\0';
+    }
+    init_udp_fast_path();
+
     ESP_LOGI(TAG, "Connecting to %s...", websocket_cfg.uri);
 
-    esp_websocket_client_handle_t client = esp_websocket_client_init(&websocket_cfg);
-    esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)client);
+    ws_handle = esp_websocket_client_init(&websocket_cfg);
+    esp_websocket_register_events(ws_handle, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)ws_handle);
 
-    esp_websocket_client_start(client);
+    esp_websocket_client_start(ws_handle);
     //xTimerStart(shutdown_signal_timer, portMAX_DELAY);
     // char data[32];
     // int len = snprintf(data, 32, "ant4");
@@ -1,4 +1,12 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 void websocket_client_connect(const char* server_ip);
-void send_current_antenna(unsigned int antenna);
\ No newline at end of file
+void websocket_client_restart();
+bool websocket_client_connected();
+void send_current_antenna(uint8_t radio, unsigned int antenna, uint32_t trace_id);
+void websocket_send_antenna(uint8_t radio, unsigned int antenna);
+bool websocket_send_text(const char *text);
+void antenna_reply_received(uint8_t radio, unsigned int antenna);
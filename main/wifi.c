@@ -1,2 +1,162 @@
 #include "wifi.h"
+#include <string.h>
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
 
+static const char *TAG = "wifi";
+
+static const char *nvs_namespace = "network";
+static const char *association_key = "wifi_assoc";
+
+/**
+ * The access point of the last association, used to skip the full scan on the next connect
+ */
+typedef struct {
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_association_t;
+
+static wifi_config_t sta_config;
+static wifi_association_t association;
+static bool using_cached_association = false;
+static int64_t connect_started_at;
+
+static bool load_association(const char *ssid)
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof(association);
+    if(nvs_open(nvs_namespace, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(nvs, association_key, &association, &size);
+    nvs_close(nvs);
+    return err == ESP_OK && size == sizeof(association) && strcmp(association.ssid, ssid) == 0 && association.channel != 0;
+}
+
+/**
+ * Remember the access point we are associated with, flash is only written when it changed
+ */
+static void store_association()
+{
+    wifi_ap_record_t ap_info;
+    if(esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    wifi_association_t current = {};
+    strlcpy(current.ssid, (const char *)sta_config.sta.ssid, sizeof(current.ssid));
+    memcpy(current.bssid, ap_info.bssid, sizeof(current.bssid));
+    current.channel = ap_info.primary;
+    if(memcmp(&current, &association, sizeof(current)) == 0) {
+        return;
+    }
+
+    nvs_handle_t nvs;
+    if(nvs_open(nvs_namespace, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if(nvs_set_blob(nvs, association_key, &current, sizeof(current)) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+        association = current;
+        ESP_LOGI(TAG, "Cached access point %02x:%02x:%02x:%02x:%02x:%02x on channel %u",
+                 current.bssid[0], current.bssid[1], current.bssid[2], current.bssid[3], current.bssid[4], current.bssid[5], current.channel);
+    }
+    nvs_close(nvs);
+}
+
+/**
+ * Forget the cached access point for this session and scan all channels from now on
+ */
+static void use_full_scan()
+{
+    using_cached_association = false;
+    sta_config.sta.bssid_set = false;
+    sta_config.sta.channel = 0;
+    sta_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    sta_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+}
+
+static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    switch(event_id) {
+    case WIFI_EVENT_STA_START:
+        connect_started_at = esp_timer_get_time();
+        esp_wifi_connect();
+        break;
+    case WIFI_EVENT_STA_CONNECTED:
+        ESP_LOGI(TAG, "Associated after %" PRId64 "ms%s", (esp_timer_get_time() - connect_started_at) / 1000,
+                 using_cached_association ? " using the cached access point" : "");
+        store_association();
+        break;
+    case WIFI_EVENT_STA_DISCONNECTED: {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        ESP_LOGW(TAG, "Disconnected, reason %d", event->reason);
+        if(using_cached_association) {
+            ESP_LOGI(TAG, "Cached access point not usable, scanning all channels");
+            use_full_scan();
+        }
+        connect_started_at = esp_timer_get_time();
+        esp_wifi_connect();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void got_ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+    ESP_LOGI(TAG, "Got address " IPSTR " %" PRId64 "ms after connecting", IP2STR(&event->ip_info.ip),
+             (esp_timer_get_time() - connect_started_at) / 1000);
+}
+
+/**
+ * Start Wi-Fi in station mode. A cached access point and channel are tried first,
+ * power save is off so the standby link answers as fast as Ethernet.
+ */
+esp_netif_t* wifi_init(const wifi_settings_t *settings)
+{
+    if(settings->ssid[0] == '\0') {
+        ESP_LOGE(TAG, "No SSID configured");
+        return NULL;
+    }
+
+    esp_netif_t *netif = esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip_event_handler, NULL));
+
+    strlcpy((char *)sta_config.sta.ssid, settings->ssid, sizeof(sta_config.sta.ssid));
+    strlcpy((char *)sta_config.sta.password, settings->password, sizeof(sta_config.sta.password));
+    sta_config.sta.threshold.authmode = settings->password[0] == '\0' ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+    if(load_association(settings->ssid)) {
+        using_cached_association = true;
+        sta_config.sta.bssid_set = true;
+        memcpy(sta_config.sta.bssid, association.bssid, sizeof(association.bssid));
+        sta_config.sta.channel = association.channel;
+        sta_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        sta_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        sta_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    }
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+#if CONFIG_POWER_SAVE
+    // Without modem sleep the Wi-Fi driver holds a lock that keeps the CPU out of light sleep
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
+#else
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+#endif
+
+    ESP_LOGI(TAG, "Connecting to %s%s", settings->ssid, using_cached_association ? " using the cached access point" : "");
+    return netif;
+}
@@ -1 +1,14 @@
-#pragma once
\ No newline at end of file
+#pragma once
+
+#include <stdbool.h>
+#include "esp_netif.h"
+#include "network.h"
+
+typedef struct {
+    char ssid[33];
+    char password[65];
+    bool primary;       /* Wi-Fi carries the server session, Ethernet is the standby */
+    network_ip_config_t ip;
+} wifi_settings_t;
+
+esp_netif_t* wifi_init(const wifi_settings_t *settings);
@@ -0,0 +1,644 @@
+"""
+Virtual radio and virtual server soak test for the antenna switch client.
+
+The radio side emulates a Kenwood transceiver on a serial port or on a pty.
+It answers IF; polls, optionally sends AI (auto information) frames on every
+change and sweeps across the HF bands in bursts. Between bursts it dwells on
+the final band so the client has time to settle.
+
+The server side is a stand-in for the antenna switch server. It listens on
+ws://<host>:<port>/ws, records every antenna command with a timestamp and
+acknowledges it like the real server does. With --udp-port it also offers the
+UDP fast path: clients that send "udp_offer" get a session and their
+antenna commands arrive as authenticated datagrams.
+
+The server also answers the client's clock exchange ("time_req:<t1>:<estimate>"
+is answered with "time:<t1>:<t2>:<t3>") on a server clock that is off by
+--clock-skew and runs --clock-drift ppm fast. Once a client has asked for the
+time, WebSocket acks carry "@<receive time>:<relay time>" so the client can
+measure one-way latency. The report shows how far the client's estimate of the
+server clock was off.
+
+Clients that send "state_sub" get a snapshot of the antenna system with the
+antennas in --busy used by position 2 and those in --locked locked out. With
+--churn a random antenna changes between free and in use every so many seconds
+and a delta is pushed. Commands for an antenna that is not free are refused with
+the current antenna, the report counts them: a client with SYSTEM_STATE should
+only send those during the round trip of a delta.
+
+Clients with TELEMETRY stream the radio state as "telemetry:<seq>:<entries>" key
+frames and "tdelta:<seq>:<entries>" deltas, see telemetry.c. The server decodes
+them, checks the sequence and reports the message and byte rates and whether the
+decoded frequency of radio 1 matches the virtual radio. --tune steps the
+frequency within the band during the dwell so there are deltas to batch.
+
+At the end a report is printed with throughput, dropped frames, missed final
+states and command latency percentiles, split by WebSocket and UDP commands.
+Run once with and once without --udp-port to compare the two.
+
+The client must have automode enabled and a band map in NVS matching --map.
+
+Example:
+    python3 virtual_station.py --port /dev/ttyUSB1 --rate 50 --burst 20 --dwell 2
+    python3 virtual_station.py --pty --ai --rate 200 --malformed 0.05 --split 0.2
+    python3 virtual_station.py --port /dev/ttyUSB1 --udp-port 4210 --udp-key secret --udp-loss 0.1
+    python3 virtual_station.py --port /dev/ttyUSB1 --clock-skew 2500 --clock-drift 40 --ack-delay 5
+    python3 virtual_station.py --port /dev/ttyUSB1 --busy 3 --locked 5 --churn 1.5
+    python3 virtual_station.py --port /dev/ttyUSB1 --tune 20 --dwell 5
+"""
+
+import argparse
+import asyncio
+import hashlib
+import hmac
+import os
+import random
+import statistics
+import struct
+import threading
+import time
+import tty
+
+import websockets
+
+BANDS = [
+    ('160M', 1830000),
+    ('80M', 3550000),
+    ('60M', 5355000),
+    ('40M', 7050000),
+    ('30M', 10120000),
+    ('20M', 14175000),
+    ('17M', 18100000),
+    ('15M', 21200000),
+    ('10M', 28500000),
+    ('6M', 50150000),
+]
+
+DEFAULT_MAP = '160M=1,80M=1,60M=2,40M=2,30M=3,20M=4,17M=4,15M=5,10M=5,6M=6'
+
+
+def if_response(frequency, tx=False, mode=2):
+    """ Kenwood IF; answer, 38 characters including the terminator """
+    return 'IF{:011d}     0000000000{}{}0000000;'.format(frequency, 1 if tx else 0, mode)
+
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(p / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+class SerialLink:
+    """ Byte link to the client, either a real serial port or a pty master """
+
+    def __init__(self, args):
+        self.serial = None
+        self.fd = None
+        if args.pty:
+            self.fd, slave = os.openpty()
+            # No echo or line editing, the client sees the bytes as a radio sends them
+            tty.setraw(slave)
+            print('Radio pty: {}'.format(os.ttyname(slave)))
+        else:
+            import serial
+            self.serial = serial.Serial(args.port, args.baudrate, timeout=0.01)
+
+    def read(self):
+        if self.serial is not None:
+            return self.serial.read(64)
+        try:
+            return os.read(self.fd, 64)
+        except BlockingIOError:
+            return b''
+
+    def write(self, data):
+        if self.serial is not None:
+            self.serial.write(data)
+            self.serial.flush()
+        else:
+            os.write(self.fd, data)
+
+
+class VirtualRadio(threading.Thread):
+    """ Kenwood radio model that sweeps bands and answers polls """
+
+    def __init__(self, args, stats):
+        super().__init__(daemon=True)
+        self.args = args
+        self.stats = stats
+        self.link = SerialLink(args)
+        self.lock = threading.Lock()
+        self.frequency = BANDS[5][1]
+        self.band = BANDS[5][0]
+        self.running = True
+        if self.link.fd is not None:
+            os.set_blocking(self.link.fd, False)
+
+    def corrupt(self, frame):
+        kind = random.choice(['truncate', 'digits', 'garbage'])
+        if kind == 'truncate':
+            return frame[:random.randint(1, len(frame) - 2)] + ';'
+        if kind == 'digits':
+            position = random.randint(2, 12)
+            return frame[:position] + 'X' + frame[position + 1:]
+        return 'IF' + ''.join(random.choice('0123456789 ') for _ in range(random.randint(3, 40))) + ';'
+
+    def send_frame(self):
+        with self.lock:
+            frame = if_response(self.frequency)
+        malformed = random.random() < self.args.malformed
+        if malformed:
+            frame = self.corrupt(frame)
+            self.stats.malformed_frames += 1
+        if random.random() < self.args.noise:
+            noise = bytes(random.randint(0, 255) for _ in range(random.randint(1, 8)))
+            self.link.write(noise)
+            self.stats.noise_bytes += len(noise)
+        data = frame.encode()
+        if random.random() < self.args.split:
+            cut = random.randint(1, len(data) - 1)
+            self.link.write(data[:cut])
+            time.sleep(random.uniform(0, self.args.split_delay))
+            self.link.write(data[cut:])
+            self.stats.split_frames += 1
+        else:
+            self.link.write(data)
+        self.stats.frames_sent += 1
+        self.stats.bytes_sent += len(data)
+
+    def set_band(self, band, frequency):
+        with self.lock:
+            self.band = band
+            self.frequency = frequency
+        self.stats.band_change(band)
+        if self.args.ai:
+            self.send_frame()
+
+    def run(self):
+        pending = b''
+        while self.running:
+            data = self.link.read()
+            if not data:
+                time.sleep(0.001)
+                continue
+            pending += data
+            while b';' in pending:
+                command, pending = pending.split(b';', 1)
+                if command.endswith(b'IF'):
+                    self.stats.polls += 1
+                    self.send_frame()
+
+    def tune(self, duration):
+        """ Step the frequency within the band, no band changes """
+        end = time.monotonic() + duration
+        while time.monotonic() < end:
+            with self.lock:
+                self.frequency += random.choice([-100, 100])
+            if self.args.ai:
+                self.send_frame()
+            time.sleep(1.0 / self.args.tune)
+
+    def sweep(self):
+        """ Bursts of band changes followed by a dwell on the final band """
+        end = time.monotonic() + self.args.duration
+        current = 5
+        while time.monotonic() < end:
+            for _ in range(self.args.burst):
+                current = random.choice([i for i in range(len(BANDS)) if i != current])
+                band, frequency = BANDS[current]
+                self.set_band(band, frequency + random.randint(0, 20) * 1000)
+                time.sleep(1.0 / self.args.rate)
+            self.stats.final_state(BANDS[current][0])
+            if self.args.tune:
+                self.tune(self.args.dwell)
+            else:
+                time.sleep(self.args.dwell)
+        with self.lock:
+            self.stats.radio_frequency = self.frequency
+        self.stats.close_final_state()
+        self.running = False
+
+
+class Stats:
+    """ Shared record of what the radio did and what the server received """
+
+    def __init__(self, band_map):
+        self.band_map = band_map
+        self.lock = threading.Lock()
+        self.start = time.monotonic()
+        self.frames_sent = 0
+        self.bytes_sent = 0
+        self.malformed_frames = 0
+        self.split_frames = 0
+        self.noise_bytes = 0
+        self.polls = 0
+        self.changes = []       # (time, band)
+        self.commands = []      # (time, antenna, transport)
+        self.udp_lost = 0
+        self.udp_rejected = 0
+        self.udp_duplicates = 0
+        self.finals = []        # (time, band, end time)
+        self.clock_errors = []  # client estimate minus server clock, ms
+        self.conflicts = 0      # commands for antennas in use elsewhere or locked out
+        self.deltas = 0
+        self.telemetry = None
+        self.radio_frequency = None
+
+    def band_change(self, band):
+        with self.lock:
+            self.changes.append((time.monotonic(), band))
+
+    def final_state(self, band):
+        """ Close the previous dwell and open a new one starting at the last band change """
+        with self.lock:
+            now = time.monotonic()
+            if self.finals and self.finals[-1][2] is None:
+                self.finals[-1] = (self.finals[-1][0], self.finals[-1][1], now)
+            start = self.changes[-1][0] if self.changes else now
+            self.finals.append((start, band, None))
+
+    def close_final_state(self):
+        self.final_state(None)
+        with self.lock:
+            self.finals.pop()
+
+    def command(self, antenna, transport='ws'):
+        with self.lock:
+            self.commands.append((time.monotonic(), antenna, transport))
+
+    def clock_error(self, error_ms):
+        with self.lock:
+            self.clock_errors.append(error_ms)
+
+    def first_command_between(self, antenna, start, end):
+        for stamp, value, transport in self.commands:
+            if start <= stamp < end and value == antenna:
+                return stamp, transport
+        return None, None
+
+    def report(self):
+        elapsed = time.monotonic() - self.start
+        latencies = {'ws': [], 'udp': []}
+        dropped = 0
+        for index, (stamp, band) in enumerate(self.changes):
+            end = self.changes[index + 1][0] if index + 1 < len(self.changes) else float('inf')
+            received, transport = self.first_command_between(self.band_map.get(band), stamp, end)
+            if received is None:
+                dropped += 1
+            else:
+                latencies[transport].append((received - stamp) * 1000.0)
+
+        missed = 0
+        final_latencies = {'ws': [], 'udp': []}
+        for stamp, band, end in self.finals:
+            received, transport = self.first_command_between(self.band_map.get(band), stamp, end)
+            if received is None:
+                missed += 1
+            else:
+                final_latencies[transport].append((received - stamp) * 1000.0)
+
+        print('')
+        print('Duration            : {:.1f} s'.format(elapsed))
+        print('Frames sent         : {} ({:.1f}/s, {:.0f} B/s)'.format(
+            self.frames_sent, self.frames_sent / elapsed, self.bytes_sent / elapsed))
+        print('Polls answered      : {}'.format(self.polls))
+        print('Malformed/split     : {}/{} (noise bytes {})'.format(
+            self.malformed_frames, self.split_frames, self.noise_bytes))
+        print('Band changes        : {}'.format(len(self.changes)))
+        udp_commands = sum(1 for command in self.commands if command[2] == 'udp')
+        print('Commands received   : {} ({:.1f}/s, {} over UDP)'.format(
+            len(self.commands), len(self.commands) / elapsed, udp_commands))
+        if udp_commands or self.udp_lost or self.udp_rejected:
+            print('UDP lost/rejected   : {}/{} (retransmits received {})'.format(
+                self.udp_lost, self.udp_rejected, self.udp_duplicates))
+        print('Dropped changes     : {} (no command before the next change)'.format(dropped))
+        print('Missed final states : {} of {}'.format(missed, len(self.finals)))
+        if self.deltas or self.conflicts:
+            print('Refused commands    : {} ({} state deltas pushed)'.format(self.conflicts, self.deltas))
+        if self.telemetry is not None and self.telemetry.messages:
+            self.telemetry.report(elapsed, self.radio_frequency)
+        if self.clock_errors:
+            # The first requests go out before the client has an estimate
+            settled = self.clock_errors[len(self.clock_errors) // 4:]
+            print('Clock estimate error: p50 {:.2f} ms, max {:.2f} ms ({} requests)'.format(
+                percentile([abs(e) for e in settled], 50), max(abs(e) for e in settled), len(self.clock_errors)))
+        for name, values in (('change latency ws', latencies['ws']), ('change latency udp', latencies['udp']),
+                             ('final latency ws', final_latencies['ws']), ('final latency udp', final_latencies['udp'])):
+            if values:
+                print('{:<20}: p50 {:.1f} ms, p90 {:.1f} ms, p99 {:.1f} ms, max {:.1f} ms, mean {:.1f} ms'.format(
+                    name, percentile(values, 50), percentile(values, 90), percentile(values, 99),
+                    max(values), statistics.mean(values)))
+
+
+class FastPathServer(asyncio.DatagramProtocol):
+    """ UDP side of the stand-in server, see udp_fast_path.c for the datagram layout """
+
+    def __init__(self, args, stats, current, sessions):
+        self.args = args
+        self.stats = stats
+        self.current = current
+        self.sessions = sessions
+        self.last_seq = {}
+        self.transport = None
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def mac(self, data):
+        return hmac.new(self.args.udp_key.encode(), data[:11], hashlib.sha256).digest()[:8]
+
+    def datagram_received(self, data, addr):
+        if random.random() < self.args.udp_loss:
+            self.stats.udp_lost += 1
+            return
+        if len(data) != 19 or data[0:1] != b'C' or not hmac.compare_digest(self.mac(data), data[11:]):
+            self.stats.udp_rejected += 1
+            return
+        session, seq = struct.unpack('>II', data[1:9])
+        radio, antenna = data[9], data[10]
+        if session not in self.sessions:
+            self.stats.udp_rejected += 1
+            return
+        # Retransmits of a command that was already applied are only acked again
+        if seq > self.last_seq.get((session, radio), 0):
+            self.last_seq[(session, radio)] = seq
+            if radio == 0:
+                self.stats.command(antenna, 'udp')
+                self.current['antenna'] = antenna
+        else:
+            self.stats.udp_duplicates += 1
+        ack = b'A' + data[1:11]
+        ack += self.mac(ack)
+        if self.args.ack_delay:
+            asyncio.get_running_loop().call_later(self.args.ack_delay / 1000.0, self.transport.sendto, ack, addr)
+        else:
+            self.transport.sendto(ack, addr)
+
+
+class RadioTelemetry:
+    """ Radio state as streamed by the client, rebuilt from key frames and deltas """
+
+    FIELDS = {'f': 'frequency', 'm': 'mode', 'v': 'vfo', 't': 'tx', 's': 'split'}
+
+    def __init__(self):
+        self.radios = {}
+        self.seq = None
+        self.messages = 0
+        self.keyframes = 0
+        self.bytes = 0
+        self.gaps = 0
+        self.updates = 0
+
+    def parse_entry(self, entry, state):
+        radio = ''
+        while entry and entry[0].isdigit():
+            radio, entry = radio + entry[0], entry[1:]
+        fields = state.setdefault(int(radio), {})
+        index = 0
+        while index < len(entry):
+            key = entry[index]
+            end = index + 1
+            while end < len(entry) and (entry[end].isdigit() or entry[end] in '+-'):
+                end += 1
+            value = entry[index + 1:end]
+            if key == 'f' and value[0] in '+-':
+                fields['frequency'] = fields.get('frequency', 0) + int(value)
+            else:
+                fields[self.FIELDS[key]] = int(value)
+            self.updates += 1
+            index = end
+
+    def handle(self, message):
+        """ True if the message was telemetry """
+        if message.startswith('telemetry:'):
+            keyframe = True
+        elif message.startswith('tdelta:'):
+            keyframe = False
+        else:
+            return False
+        _, seq, entries = message.split(':', 2)
+        seq = int(seq)
+        if keyframe:
+            self.radios = {}
+            self.keyframes += 1
+        elif self.seq is None or seq != self.seq + 1:
+            self.gaps += 1
+        self.seq = seq
+        for entry in entries.split(','):
+            self.parse_entry(entry, self.radios)
+        self.messages += 1
+        self.bytes += len(message)
+        return True
+
+    def report(self, elapsed, frequency):
+        print('Telemetry           : {} messages ({:.2f}/s, {:.0f} B/s), {} fields, {} key frames, {} gaps'.format(
+            self.messages, self.messages / elapsed, self.bytes / elapsed, self.updates, self.keyframes, self.gaps))
+        decoded = self.radios.get(1, {}).get('frequency')
+        if frequency is not None:
+            print('Telemetry frequency : {} Hz ({})'.format(
+                decoded, 'matches' if decoded == frequency else 'radio is on {} Hz'.format(frequency)))
+
+
+class ServerClock:
+    """ Server clock in microseconds since the epoch, off by a fixed skew and drifting """
+
+    def __init__(self, args):
+        self.skew_us = args.clock_skew * 1000.0
+        self.drift = args.clock_drift / 1e6
+        self.origin = time.monotonic()
+        self.epoch_origin = time.time()
+
+    def now_us(self):
+        elapsed = time.monotonic() - self.origin
+        return int((self.epoch_origin + elapsed * (1.0 + self.drift)) * 1e6 + self.skew_us)
+
+
+class AntennaSystem:
+    """ Antennas as the other operating positions see them, "f" free, "u2" in use, "l" locked """
+
+    def __init__(self, args):
+        self.status = {antenna: 'f' for antenna in range(1, args.antennas + 1)}
+        for antenna in parse_list(args.busy):
+            self.status[antenna] = 'u2'
+        for antenna in parse_list(args.locked):
+            self.status[antenna] = 'l'
+        self.version = 1
+        self.subscribers = set()
+
+    def entries(self, antennas):
+        return ','.join('{}={}/3ff'.format(antenna, self.status[antenna]) for antenna in antennas)
+
+    def snapshot(self):
+        return 'state:{}:{}'.format(self.version, self.entries(sorted(self.status)))
+
+    def free(self, antenna):
+        return self.status.get(antenna, 'f') == 'f'
+
+    async def churn(self, args, stats, current):
+        while True:
+            await asyncio.sleep(args.churn)
+            candidates = [a for a, status in self.status.items() if status != 'l' and a != current['antenna']]
+            if not candidates:
+                continue
+            antenna = random.choice(candidates)
+            self.status[antenna] = 'f' if self.status[antenna] != 'f' else 'u2'
+            self.version += 1
+            stats.deltas += 1
+            delta = 'delta:{}:{}'.format(self.version, self.entries([antenna]))
+            for websocket in list(self.subscribers):
+                try:
+                    await websocket.send(delta)
+                except websockets.ConnectionClosed:
+                    self.subscribers.discard(websocket)
+
+
+async def serve(args, stats, radio):
+    current = {'antenna': 1}
+    sessions = set()
+    clock = ServerClock(args)
+    system = AntennaSystem(args)
+    stats.telemetry = RadioTelemetry()
+
+    async def handler(websocket, path=None):
+        request_path = path if path is not None else websocket.request.path
+        if request_path != '/ws':
+            await websocket.close()
+            return
+        print('Client connected')
+        stamps = False
+        async for message in websocket:
+            received_us = clock.now_us()
+            if message.startswith('time_req:'):
+                try:
+                    _, t1, estimate = message.split(':')
+                    estimate = int(estimate)
+                except ValueError:
+                    print('Bad time request: {!r}'.format(message))
+                    continue
+                # Includes the one-way delay to the server, well below a millisecond on a LAN
+                if estimate:
+                    stats.clock_error((estimate - received_us) / 1000.0)
+                stamps = True
+                await websocket.send('time:{}:{}:{}'.format(t1, received_us, clock.now_us()))
+                continue
+            if stats.telemetry.handle(message):
+                continue
+            if message == 'current_antenna':
+                await websocket.send(str(current['antenna']))
+                continue
+            if message == 'state_sub':
+                system.subscribers.add(websocket)
+                await websocket.send(system.snapshot())
+                continue
+            if message == 'udp_offer':
+                if args.udp_port:
+                    session = random.randint(1, 0xFFFFFFFF)
+                    sessions.add(session)
+                    await websocket.send('udp:{}:{:08x}'.format(args.udp_port, session))
+                continue
+            try:
+                # SO2R clients tag commands as "<radio>:<antenna>", only radio 1 is emulated
+                radio, _, antenna = message.rpartition(':')
+                antenna = int(antenna)
+            except ValueError:
+                print('Unknown message: {!r}'.format(message))
+                continue
+            if not system.free(antenna):
+                # Refused, the ack carries the antenna that stays selected
+                stats.conflicts += 1
+                if radio in ('', '1'):
+                    await websocket.send('{}:{}'.format(radio, current['antenna']) if radio else str(current['antenna']))
+                continue
+            if radio in ('', '1'):
+                stats.command(antenna)
+                current['antenna'] = antenna
+            if args.ack_delay:
+                await asyncio.sleep(args.ack_delay / 1000.0)
+            if stamps:
+                # The relay time stands for the antenna switch relay answering the server
+                await websocket.send('{}@{}:{}'.format(message, received_us, clock.now_us()))
+            else:
+                await websocket.send(message)
+
+    if args.udp_port:
+        await asyncio.get_running_loop().create_datagram_endpoint(
+            lambda: FastPathServer(args, stats, current, sessions), local_addr=(args.host, args.udp_port))
+        print('UDP fast path on port {}'.format(args.udp_port))
+
+    if args.churn:
+        asyncio.get_running_loop().create_task(system.churn(args, stats, current))
+
+    async with websockets.serve(handler, args.host, args.ws_port):
+        print('Server listening on ws://{}:{}/ws'.format(args.host, args.ws_port))
+        if args.wait_connect:
+            await asyncio.sleep(args.wait_connect)
+        radio.start()
+        await asyncio.get_running_loop().run_in_executor(None, radio.sweep)
+        await asyncio.sleep(args.dwell)
+
+
+def parse_map(text):
+    band_map = {}
+    for item in text.split(','):
+        band, antenna = item.split('=')
+        band_map[band.strip().upper()] = int(antenna)
+    return band_map
+
+
+def parse_list(text):
+    return [int(item) for item in text.split(',') if item.strip()]
+
+
+def add_server_arguments(parser):
+    """ Options of the stand-in server, shared with cat_replay.py """
+    parser.add_argument('--host', default='0.0.0.0', help='address the stand-in server listens on')
+    parser.add_argument('--ws-port', type=int, default=80)
+    parser.add_argument('--map', default=DEFAULT_MAP, help='band to antenna map, e.g. 20M=4,40M=2')
+    parser.add_argument('--ack-delay', type=float, default=0.0, help='server ack delay in milliseconds')
+    parser.add_argument('--udp-port', type=int, default=0, help='offer the UDP fast path on this port')
+    parser.add_argument('--udp-key', default='', help='UDP_FAST_PATH_KEY of the client')
+    parser.add_argument('--udp-loss', type=float, default=0.0, help='probability a command datagram is dropped')
+    parser.add_argument('--clock-skew', type=float, default=0.0, help='server clock offset in milliseconds')
+    parser.add_argument('--clock-drift', type=float, default=0.0, help='server clock drift in ppm')
+    parser.add_argument('--antennas', type=int, default=6, help='antennas in the state snapshot')
+    parser.add_argument('--busy', default='', help='antennas in use by another position, e.g. 3,4')
+    parser.add_argument('--locked', default='', help='antennas locked out')
+    parser.add_argument('--churn', type=float, default=0.0, help='seconds between pushed state changes')
+    parser.add_argument('--wait-connect', type=float, default=5.0, help='seconds to wait before sweeping')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    link = parser.add_mutually_exclusive_group(required=True)
+    link.add_argument('--port', help='serial port connected to the client CAT UART')
+    link.add_argument('--pty', action='store_true', help='create a pty instead of opening a serial port')
+    parser.add_argument('--baudrate', type=int, default=57600)
+    add_server_arguments(parser)
+    parser.add_argument('--rate', type=float, default=10.0, help='band changes per second during a burst')
+    parser.add_argument('--burst', type=int, default=5, help='band changes per burst')
+    parser.add_argument('--dwell', type=float, default=2.0, help='seconds on the final band after a burst')
+    parser.add_argument('--duration', type=float, default=60.0, help='test duration in seconds')
+    parser.add_argument('--ai', action='store_true', help='send an IF frame on every change (AI mode)')
+    parser.add_argument('--tune', type=float, default=0.0, help='frequency steps per second during the dwell')
+    parser.add_argument('--malformed', type=float, default=0.0, help='probability a frame is corrupted')
+    parser.add_argument('--split', type=float, default=0.0, help='probability a frame is written in two parts')
+    parser.add_argument('--split-delay', type=float, default=0.005, help='max seconds between split parts')
+    parser.add_argument('--noise', type=float, default=0.0, help='probability of line noise before a frame')
+    parser.add_argument('--seed', type=int, default=None)
+    args = parser.parse_args()
+
+    random.seed(args.seed)
+    stats = Stats(parse_map(args.map))
+    radio = VirtualRadio(args, stats)
+    try:
+        asyncio.run(serve(args, stats, radio))
+    except KeyboardInterrupt:
+        pass
+    radio.running = False
+    stats.report()
+
+
+if __name__ == '__main__':
+    main()